@@ -23,46 +23,180 @@
 //   https://developers.google.com/search/reference/robots_txt
 
 #include "robots.h"
+#include "robots_ascii.h"
 
+#include <algorithm>
+#include <cassert>
 #include <cstdlib>
 #include <cstddef>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <string_view>
 
-#include "absl/container/fixed_array.h"
 
-#include <boost/algorithm/string/predicate.hpp>
-#include <boost/algorithm/string/trim.hpp>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#ifdef ROBOTS_ENABLE_STATS
+#include <chrono>
+#endif
 
 // Allow for typos such as DISALOW in robots.txt.
 static bool kAllowFrequentTypos = true;
 
 namespace googlebot {
 
-// A RobotsMatchStrategy defines a strategy for matching individual lines in a
-// robots.txt file. Each Match* method should return a match priority, which is
-// interpreted as:
-//
-// match priority < 0:
-//    No match.
+void RobotsStats::Add(const RobotsStats& other) {
+  lines_parsed += other.lines_parsed;
+  truncated_bytes += other.truncated_bytes;
+  escaped_values += other.escaped_values;
+  rules_evaluated += other.rules_evaluated;
+  pattern_matches += other.pattern_matches;
+  pattern_bytes_scanned += other.pattern_bytes_scanned;
+  parse_nanos += other.parse_nanos;
+  match_nanos += other.match_nanos;
+  limits_exceeded += other.limits_exceeded;
+}
+
+#ifdef ROBOTS_ENABLE_STATS
+// The stats of the innermost RobotsStatsScope of the thread, if any.
+static thread_local RobotsStats* current_stats = nullptr;
+
+RobotsStatsScope::RobotsStatsScope(RobotsStats* stats)
+    : previous_(current_stats) {
+  current_stats = stats;
+}
+
+RobotsStatsScope::~RobotsStatsScope() { current_stats = previous_; }
+
+// Adds its lifetime to a wall time of the stats being collected, if any.
+class RobotsStatsTimer {
+ public:
+  explicit RobotsStatsTimer(uint64_t RobotsStats::*nanos)
+      : stats_(current_stats), nanos_(nanos) {
+    if (stats_ != nullptr) start_ = std::chrono::steady_clock::now();
+  }
+  ~RobotsStatsTimer() {
+    if (stats_ == nullptr) return;
+    stats_->*nanos_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start_)
+                           .count();
+  }
+
+  RobotsStatsTimer(const RobotsStatsTimer&) = delete;
+  RobotsStatsTimer& operator=(const RobotsStatsTimer&) = delete;
+
+ private:
+  RobotsStats* const stats_;
+  uint64_t RobotsStats::*const nanos_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Adds 'n' to the counter 'field' of the stats being collected, if any.
+#define ROBOTS_STATS_ADD(field, n)                          \
+  do {                                                      \
+    if (current_stats != nullptr) current_stats->field += (n); \
+  } while (0)
+// Adds the wall time until the end of the scope to 'field'.
+#define ROBOTS_STATS_TIMER(field) \
+  RobotsStatsTimer robots_stats_timer(&RobotsStats::field)
+#else
+#define ROBOTS_STATS_ADD(field, n) \
+  do {                             \
+  } while (0)
+#define ROBOTS_STATS_TIMER(field) \
+  do {                            \
+  } while (0)
+#endif  // ROBOTS_ENABLE_STATS
+
+// Greedy matcher behind RobotsMatchStrategy::Matches() and RobotsRuleSet. A
+// pattern is a sequence of literal segments separated by '*' wildcards,
+// optionally followed by a '$' anchor. The first segment is anchored at the
+// beginning of 'path', and with '$' the last one is anchored at its end.
 //
-// match priority == 0:
-//    Match, but treat it as if matched an empty pattern.
+// Matching each middle segment at its leftmost occurrence never loses a match,
+// since it leaves the most room to the segments after it. This makes the cost
+// O(|path| * |pattern|) in the worst case, without any allocation. The bytes of
+// 'path' compared or scanned are spent from 'budget', and the match fails once
+// it runs out.
 //
-// match priority > 0:
-//    Match.
-class RobotsMatchStrategy {
- public:
-  virtual ~RobotsMatchStrategy() = default;
+// 'segments' yields the literal segments in order with Next(), and Done()
+// returns true once the last one was yielded. A pattern without any '*' is a
+// single segment.
+template <typename SegmentIterator>
+static bool MatchSegments(std::string_view path, SegmentIterator segments,
+                          bool anchored, RobotsMatchBudget* budget) {
+  const std::string_view first = segments.Next();
+  // Plain prefixes are not counted as pattern matches.
+  if (anchored || !segments.Done()) {
+    ROBOTS_STATS_ADD(pattern_matches, 1);
+    ROBOTS_STATS_ADD(pattern_bytes_scanned,
+                     std::min(first.size(), path.size()));
+  }
+  if (!budget->Spend(std::min(first.size(), path.size())) ||
+      path.substr(0, first.size()) != first) {
+    return false;
+  }
+  if (segments.Done()) {
+    return !anchored || path.size() == first.size();
+  }
+  size_t pos = first.size();
+  for (;;) {
+    const std::string_view segment = segments.Next();
+    if (segments.Done() && anchored) {
+      ROBOTS_STATS_ADD(pattern_bytes_scanned, segment.size());
+      return budget->Spend(segment.size()) &&
+             path.size() - pos >= segment.size() &&
+             path.substr(path.size() - segment.size()) == segment;
+    }
+    const size_t found = path.find(segment, pos);
+    const size_t scanned =
+        (found == std::string_view::npos ? path.size()
+                                         : found + segment.size()) -
+        pos;
+    ROBOTS_STATS_ADD(pattern_bytes_scanned, scanned);
+    if (!budget->Spend(scanned) || found == std::string_view::npos) {
+      return false;
+    }
+    if (segments.Done()) return true;
+    pos = found + segment.size();
+  }
+}
 
-  virtual int MatchAllow(std::string_view path,
-                         std::string_view pattern) = 0;
-  virtual int MatchDisallow(std::string_view path,
-                            std::string_view pattern) = 0;
+// Yields the segments of a pattern as written in a robots.txt, without its
+// '$' anchor.
+class PatternSegmentIterator {
+ public:
+  explicit PatternSegmentIterator(std::string_view pattern)
+      : rest_(pattern) {}
+
+  std::string_view Next() {
+    const size_t star = rest_.find('*');
+    const std::string_view segment = rest_.substr(0, star);
+    if (star == std::string_view::npos) {
+      done_ = true;
+    } else {
+      rest_.remove_prefix(star + 1);
+    }
+    return segment;
+  }
+  bool Done() const { return done_; }
 
- protected:
-  // Implements robots.txt pattern matching.
-  static bool Matches(std::string_view path, std::string_view pattern);
+ private:
+  std::string_view rest_;
+  bool done_ = false;
 };
 
 // Returns true if URI path matches the specified pattern. Pattern is anchored
@@ -70,56 +204,27 @@ class RobotsMatchStrategy {
 //
 // Since 'path' and 'pattern' are both externally determined (by the webmaster),
 // we make sure to have acceptable worst-case performance.
-/* static */ bool RobotsMatchStrategy::Matches(
-    std::string_view path, std::string_view pattern) {
-  const size_t pathlen = path.length();
-  absl::FixedArray<size_t> pos(pathlen + 1);
-  int numpos;
-
-  // The pos[] array holds a sorted list of indexes of 'path', with length
-  // 'numpos'.  At the start and end of each iteration of the main loop below,
-  // the pos[] array will hold a list of the prefixes of the 'path' which can
-  // match the current prefix of 'pattern'. If this list is ever empty,
-  // return false. If we reach the end of 'pattern' with at least one element
-  // in pos[], return true.
-
-  pos[0] = 0;
-  numpos = 1;
-
-  for (auto pat = pattern.begin(); pat != pattern.end(); ++pat) {
-    if (*pat == '$' && pat + 1 == pattern.end()) {
-      return (pos[numpos - 1] == pathlen);
-    }
-    if (*pat == '*') {
-      numpos = pathlen - pos[0] + 1;
-      for (int i = 1; i < numpos; i++) {
-        pos[i] = pos[i-1] + 1;
-      }
-    } else {
-      // Includes '$' when not at end of pattern.
-      int newnumpos = 0;
-      for (int i = 0; i < numpos; i++) {
-        if (pos[i] < pathlen && path[pos[i]] == *pat) {
-          pos[newnumpos++] = pos[i] + 1;
-        }
-      }
-      numpos = newnumpos;
-      if (numpos == 0) return false;
-    }
-  }
-
-  return true;
+/* static */ bool RobotsMatchStrategy::Matches(std::string_view path,
+                                              std::string_view pattern,
+                                              RobotsMatchBudget* budget) {
+  const bool anchored = !pattern.empty() && pattern.back() == '$';
+  if (anchored) pattern.remove_suffix(1);
+  return MatchSegments(path, PatternSegmentIterator(pattern), anchored,
+                       budget);
 }
 
 static const char* kHexDigits = "0123456789ABCDEF";
 
-// GetPathParamsQuery is not in anonymous namespace to allow testing.
+// GetPathParamsQueryView is not in anonymous namespace to allow testing.
 //
 // Extracts path (with params) and query part from URL. Removes scheme,
-// authority, and fragment. Result always starts with "/".
-// Returns "/" if the url doesn't have a path or is not valid.
-std::string GetPathParamsQuery(const std::string& url) {
-  std::string path;
+// authority, and fragment. Returns a view into 'url', or "/" if the url doesn't
+// have a path or is not valid. The view starts with "/", unless
+// '*needs_leading_slash' is set to tell that one must be prepended, e.g. for
+// "example.com?a".
+std::string_view GetPathParamsQueryView(std::string_view url,
+                                        bool* needs_leading_slash) {
+  *needs_leading_slash = false;
 
   // Initial two slashes are ignored.
   size_t search_start = 0;
@@ -129,49 +234,55 @@ std::string GetPathParamsQuery(const std::string& url) {
   size_t protocol_end = url.find("://", search_start);
   if (early_path < protocol_end) {
     // If path, param or query starts before ://, :// doesn't indicate protocol.
-    protocol_end = std::string::npos;
+    protocol_end = std::string_view::npos;
   }
-  if (protocol_end == std::string::npos) {
+  if (protocol_end == std::string_view::npos) {
     protocol_end = search_start;
   } else {
     protocol_end += 3;
   }
 
   size_t path_start = url.find_first_of("/?;", protocol_end);
-  if (path_start != std::string::npos) {
+  if (path_start != std::string_view::npos) {
     size_t hash_pos = url.find('#', search_start);
     if (hash_pos < path_start) return "/";
-    size_t path_end = (hash_pos == std::string::npos) ? url.size() : hash_pos;
-    if (url[path_start] != '/') {
-      // Prepend a slash if the result would start e.g. with '?'.
-      return "/" + url.substr(path_start, path_end - path_start);
-    }
+    size_t path_end =
+        (hash_pos == std::string_view::npos) ? url.size() : hash_pos;
+    // A slash is prepended if the result would start e.g. with '?'.
+    *needs_leading_slash = url[path_start] != '/';
     return url.substr(path_start, path_end - path_start);
   }
 
   return "/";
 }
 
-// ASCII character classification functions
-static inline bool AsciiIsAlpha(char ch) noexcept
-{
-  return static_cast<bool>(std::isalpha(static_cast<unsigned char>(ch)));
-}
-static inline bool AsciiIsSpace(char ch) noexcept
-{
-  return static_cast<bool>(std::isspace(static_cast<unsigned char>(ch)));
-}
-static inline bool AsciiIsXDigit(char ch) noexcept
-{
-  return static_cast<bool>(std::isxdigit(static_cast<unsigned char>(ch)));
+// GetPathParamsQuery is not in anonymous namespace to allow testing.
+//
+// Same as GetPathParamsQueryView(), with the leading slash. Result always
+// starts with "/".
+std::string GetPathParamsQuery(const std::string& url) {
+  bool needs_leading_slash;
+  const std::string_view path = GetPathParamsQueryView(url, &needs_leading_slash);
+  return needs_leading_slash ? "/" + std::string(path) : std::string(path);
 }
-static inline char AsciiToLower(char ch) noexcept
-{
-  return static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+
+// Same as GetPathParamsQuery(), without copying the path unless a slash must be
+// prepended to it. The result is then a view into '*storage', whose memory is
+// reused, and a view into 'url' otherwise.
+static std::string_view PathParamsQuery(std::string_view url,
+                                        std::string* storage) {
+  bool needs_leading_slash;
+  const std::string_view path = GetPathParamsQueryView(url, &needs_leading_slash);
+  if (!needs_leading_slash) return path;
+  storage->assign(1, '/');
+  storage->append(path.data(), path.size());
+  return *storage;
 }
-static inline char AsciiToUpper(char ch) noexcept
-{
-  return static_cast<char>(std::toupper(static_cast<unsigned char>(ch)));
+
+// Returns true if 'src' has a %-escape sequence at 'i'.
+static inline bool IsEscapeSequenceAt(std::string_view src, size_t i) {
+  return src[i] == '%' && i + 2 < src.size() && AsciiIsXDigit(src[i + 1]) &&
+         AsciiIsXDigit(src[i + 2]);
 }
 
 // MaybeEscapePattern is not in anonymous namespace to allow testing.
@@ -179,19 +290,20 @@ static inline char AsciiToUpper(char ch) noexcept
 // Canonicalize the allowed/disallowed paths. For example:
 //     /SanJoséSellers ==> /Sanjos%C3%A9Sellers
 //     %aa ==> %AA
-// When the function returns, (*dst) either points to src, or is newly
-// allocated.
-// Returns true if dst was newly allocated.
-bool MaybeEscapePattern(const char* src, char** dst) {
+// Returns 'src' itself if no changes are needed, which is the common case.
+// Otherwise the canonical pattern is written into '*scratch' and a view of it
+// is returned. The view is valid until the next use of '*scratch', whose
+// capacity is reused so that escaping many patterns does not allocate.
+std::string_view MaybeEscapePattern(std::string_view src,
+                                    std::string* scratch) {
   int num_to_escape = 0;
   bool need_capitalize = false;
 
   // First, scan the buffer to see if changes are needed. Most don't.
-  for (int i = 0; src[i] != 0; i++) {
+  for (size_t i = 0; i < src.size(); i++) {
     // (a) % escape sequence.
-    if (src[i] == '%' &&
-        AsciiIsXDigit(src[i+1]) && AsciiIsXDigit(src[i+2])) {
-      if (AsciiToLower(src[i+1]) || AsciiToLower(src[i+2])) {
+    if (IsEscapeSequenceAt(src, i)) {
+      if (AsciiIsLower(src[i+1]) || AsciiIsLower(src[i+2])) {
         need_capitalize = true;
       }
       i += 2;
@@ -203,31 +315,31 @@ bool MaybeEscapePattern(const char* src, char** dst) {
   }
   // Return if no changes needed.
   if (!num_to_escape && !need_capitalize) {
-    (*dst) = const_cast<char*>(src);
-    return false;
+    return src;
   }
-  (*dst) = new char[num_to_escape * 2 + strlen(src) + 1];
-  int j = 0;
-  for (int i = 0; src[i] != 0; i++) {
+  ROBOTS_STATS_ADD(escaped_values, 1);
+  scratch->resize(num_to_escape * 2 + src.size());
+  char* const dst = &(*scratch)[0];
+  size_t j = 0;
+  for (size_t i = 0; i < src.size(); i++) {
     // (a) Normalize %-escaped sequence (eg. %2f -> %2F).
-    if (src[i] == '%' &&
-        AsciiIsXDigit(src[i+1]) && AsciiIsXDigit(src[i+2])) {
-      (*dst)[j++] = src[i++];
-      (*dst)[j++] = AsciiToUpper(src[i++]);
-      (*dst)[j++] = AsciiToUpper(src[i]);
+    if (IsEscapeSequenceAt(src, i)) {
+      dst[j++] = src[i++];
+      dst[j++] = AsciiToUpper(src[i++]);
+      dst[j++] = AsciiToUpper(src[i]);
       // (b) %-escape octets whose highest bit is set. These are outside the
       // ASCII range.
     } else if (src[i] & 0x80) {
-      (*dst)[j++] = '%';
-      (*dst)[j++] = kHexDigits[(src[i] >> 4) & 0xf];
-      (*dst)[j++] = kHexDigits[src[i] & 0xf];
+      dst[j++] = '%';
+      dst[j++] = kHexDigits[(src[i] >> 4) & 0xf];
+      dst[j++] = kHexDigits[src[i] & 0xf];
     // (c) Normal character, no modification needed.
     } else {
-      (*dst)[j++] = src[i];
+      dst[j++] = src[i];
     }
   }
-  (*dst)[j] = 0;
-  return true;
+  assert(j == scratch->size());
+  return std::string_view(dst, j);
 }
 
 // Internal helper classes and functions.
@@ -272,53 +384,194 @@ class ParsedRobotsKey {
   std::string_view GetUnknownText() const;
 
  private:
-  static bool KeyIsUserAgent(std::string_view key);
-  static bool KeyIsAllow(std::string_view key);
-  static bool KeyIsDisallow(std::string_view key);
-  static bool KeyIsSitemap(std::string_view key);
-  static bool KeyIsCrawlDelay(std::string_view key);
+  // Returns the type of 'key', or UNKNOWN.
+  static KeyType Classify(std::string_view key);
 
   KeyType type_;
   std::string_view key_text_;
 };
 
-void EmitKeyValueToHandler(int line, const ParsedRobotsKey& key,
-                           std::string_view value,
-                           RobotsParseHandler* handler) {
+// An accepted spelling of a key. A key has the type of the first spelling it
+// starts with, ignoring case; so "Disallow-Foo" is a DISALLOW key.
+struct KeySpelling {
+  std::string_view text;  // Lowercase.
+  ParsedRobotsKey::KeyType type;
+  bool is_typo;           // Only accepted with kAllowFrequentTypos.
+};
+
+// All accepted spellings, grouped by their first letter.
+constexpr KeySpelling kKeySpellings[] = {
+    {"allow", ParsedRobotsKey::ALLOW, false},
+    {"crawl-delay", ParsedRobotsKey::CRAWL_DELAY, false},
+    {"crawldelay", ParsedRobotsKey::CRAWL_DELAY, true},
+    {"crawl delay", ParsedRobotsKey::CRAWL_DELAY, true},
+    {"disallow", ParsedRobotsKey::DISALLOW, false},
+    {"dissallow", ParsedRobotsKey::DISALLOW, true},
+    {"dissalow", ParsedRobotsKey::DISALLOW, true},
+    {"disalow", ParsedRobotsKey::DISALLOW, true},
+    {"diasllow", ParsedRobotsKey::DISALLOW, true},
+    {"disallaw", ParsedRobotsKey::DISALLOW, true},
+    {"sitemap", ParsedRobotsKey::SITEMAP, false},
+    {"site-map", ParsedRobotsKey::SITEMAP, false},
+    {"user-agent", ParsedRobotsKey::USER_AGENT, false},
+    {"useragent", ParsedRobotsKey::USER_AGENT, true},
+    {"user agent", ParsedRobotsKey::USER_AGENT, true},
+};
+constexpr size_t kNumKeySpellings =
+    sizeof(kKeySpellings) / sizeof(kKeySpellings[0]);
+
+// Length of the longest spelling, i.e. how much of a key is ever looked at.
+constexpr size_t MaxKeySpellingLength() {
+  size_t max = 0;
+  for (const KeySpelling& spelling : kKeySpellings) {
+    if (spelling.text.size() > max) max = spelling.text.size();
+  }
+  return max;
+}
+constexpr size_t kMaxKeySpellingLength = MaxKeySpellingLength();
+
+// The range of kKeySpellings starting with a given lowercase letter.
+struct KeySpellingRange {
+  uint8_t begin = 0;
+  uint8_t end = 0;
+};
+struct KeySpellingIndex {
+  KeySpellingRange letters[26];
+};
+
+constexpr KeySpellingIndex MakeKeySpellingIndex() {
+  KeySpellingIndex index;
+  for (size_t i = kNumKeySpellings; i-- > 0;) {
+    KeySpellingRange& range = index.letters[kKeySpellings[i].text[0] - 'a'];
+    if (range.end == 0) range.end = i + 1;
+    range.begin = i;
+  }
+  return index;
+}
+constexpr KeySpellingIndex kKeySpellingIndex = MakeKeySpellingIndex();
+
+// Checks that the spellings of each letter are contiguous, so that the index
+// covers all of them.
+constexpr bool KeySpellingsAreGrouped() {
+  for (size_t i = 0; i < kNumKeySpellings; ++i) {
+    const KeySpellingRange& range =
+        kKeySpellingIndex.letters[kKeySpellings[i].text[0] - 'a'];
+    if (i < range.begin || i >= range.end) return false;
+  }
+  return true;
+}
+static_assert(KeySpellingsAreGrouped(),
+              "kKeySpellings must be grouped by first letter");
+
+// Returns the directive of 'key', with 'value'.
+internal::RobotsDirective MakeDirective(const ParsedRobotsKey& key,
+                                        std::string_view value) {
   typedef ParsedRobotsKey Key;
+  typedef internal::RobotsDirective Directive;
+  Directive directive;
+  directive.value = value;
   switch (key.type()) {
-    case Key::USER_AGENT:     handler->HandleUserAgent(line, value); break;
-    case Key::ALLOW:          handler->HandleAllow(line, value); break;
-    case Key::DISALLOW:       handler->HandleDisallow(line, value); break;
-    case Key::SITEMAP:        handler->HandleSitemap(line, value); break;
-    case Key::CRAWL_DELAY:    handler->HandleCrawlDelay(line, value); break;
+    case Key::USER_AGENT:     directive.type = Directive::USER_AGENT; break;
+    case Key::ALLOW:          directive.type = Directive::ALLOW; break;
+    case Key::DISALLOW:       directive.type = Directive::DISALLOW; break;
+    case Key::SITEMAP:        directive.type = Directive::SITEMAP; break;
+    case Key::CRAWL_DELAY:    directive.type = Directive::CRAWL_DELAY; break;
     case Key::UNKNOWN:
-      handler->HandleUnknownAction(line, key.GetUnknownText(), value);
+      directive.type = Directive::UNKNOWN;
+      directive.unknown_key = key.GetUnknownText();
       break;
       // No default case Key:: to have the compiler warn about new values.
   }
+  return directive;
+}
+
+// Returns the index of the lowest set bit of a non-zero 'mask'.
+static inline int CountTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+// Returns a pointer to the first byte of [begin, end) that is either 'a' or
+// 'b', or 'end' if there is none. Robots.txt files of misconfigured hosts can
+// be several megabytes long, so when SSE2, AVX2 or NEON are available, this
+// checks 32 or 16 bytes at once.
+static const char* FindFirstOf(const char* begin, const char* end, char a,
+                               char b) {
+  const char* p = begin;
+#if defined(__AVX2__)
+  {
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32) {
+      const __m256i chunk =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      const uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(
+          _mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb)));
+      if (mask != 0) return p + CountTrailingZeros(mask);
+    }
+  }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+  {
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+      const __m128i chunk =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const uint32_t mask = _mm_movemask_epi8(
+          _mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+      if (mask != 0) return p + CountTrailingZeros(mask);
+    }
+  }
+#elif defined(__ARM_NEON)
+  {
+    const uint8x16_t va = vdupq_n_u8(static_cast<uint8_t>(a));
+    const uint8x16_t vb = vdupq_n_u8(static_cast<uint8_t>(b));
+    for (; end - p >= 16; p += 16) {
+      const uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+      const uint8x16_t eq = vorrq_u8(vceqq_u8(chunk, va), vceqq_u8(chunk, vb));
+      // Narrow each byte of the comparison to 4 bits of a 64-bit mask.
+      const uint64_t mask = vget_lane_u64(
+          vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+      if (mask != 0) return p + __builtin_ctzll(mask) / 4;
+    }
+  }
+#endif
+  for (; p < end; ++p) {
+    if (*p == a || *p == b) return p;
+  }
+  return end;
 }
 
+// Parses single robots.txt lines into their directives. The body is split into
+// lines by RobotsStreamParser and internal::RobotsParser.
 class RobotsTxtParser {
  public:
   typedef ParsedRobotsKey Key;
 
-  RobotsTxtParser(std::string_view robots_body,
-                  RobotsParseHandler* handler)
-      : robots_body_(robots_body), handler_(handler) {
-  }
+  // Certain browsers limit the URL length to 2083 bytes. In a robots.txt, it's
+  // fairly safe to assume any valid line isn't going to be more than many times
+  // that max url length of 2KB. We want some padding for
+  // UTF-8 encoding/nulls/etc. but a much smaller bound would be okay as well.
+  // If so, we can ignore the chars on a line past that.
+  static const size_t kMaxLineLen = 2083 * 8;
 
-  void Parse();
+  // Parses 'line' into its directive, if any. 'escape_scratch' holds the
+  // value when it needs to be escaped.
+  static internal::RobotsDirective ParseLine(std::string_view line,
+                                             std::string* escape_scratch);
 
  private:
-  static bool GetKeyAndValueFrom(char ** key, char **value, char *line);
-  static void StripWhitespaceSlowly(char ** s);
-
-  void ParseAndEmitLine(int current_line, char* line);
-  bool NeedEscapeValueForKey(const Key& key);
+  static bool GetKeyAndValueFrom(std::string_view* key,
+                                 std::string_view* value,
+                                 std::string_view line);
 
-  std::string_view robots_body_;
-  RobotsParseHandler* const handler_;
+  static bool NeedEscapeValueForKey(const Key& key);
 };
 
 bool RobotsTxtParser::NeedEscapeValueForKey(const Key& key) {
@@ -350,242 +603,480 @@ static inline void Trim(std::string_view& view)
   TrimLeft(view);
 }
 
-// Removes leading and trailing whitespace from null-terminated string s.
-/* static */ void RobotsTxtParser::StripWhitespaceSlowly(char ** s) {
-  std::string_view str(*s);
-  Trim(str);
-  *s = const_cast<char*>(str.data());
-  (*s)[str.size()] = '\0';
-}
-
-bool RobotsTxtParser::GetKeyAndValueFrom(char ** key, char ** value,
-                                         char * line) {
-  // Remove comments from the current robots.txt line.
-  char* const comment = strchr(line, '#');
-  if (nullptr != comment) {
-          *comment = '\0';
+// Splits 'line' into its key and value, as views into 'line'. Returns false if
+// the line does not hold any key.
+bool RobotsTxtParser::GetKeyAndValueFrom(std::string_view* key,
+                                         std::string_view* value,
+                                         std::string_view line) {
+  // Find both the comment and the separator in a single scan of the line.
+  const char* line_end = line.data() + line.size();
+  const char* sep = FindFirstOf(line.data(), line_end, '#', ':');
+  const char* comment = sep;
+  if (sep != line_end && *sep == ':') {
+    comment = static_cast<const char*>(
+        memchr(sep + 1, '#', line_end - sep - 1));
+    if (comment == nullptr) comment = line_end;
+  } else {
+    sep = nullptr;
   }
-  StripWhitespaceSlowly(&line);
+  // Remove comments from the current robots.txt line.
+  line = line.substr(0, comment - line.data());
+  Trim(line);
+  line_end = line.data() + line.size();
 
   // Rules must match the following pattern:
   //   <key>[ \t]*:[ \t]*<value>
-  char* sep = strchr(line, ':');
   if (nullptr == sep) {
     // Google-specific optimization: some people forget the colon, so we need to
     // accept whitespace in its stead.
-    static const char * const kWhite = " \t";
-    sep = strpbrk(line, kWhite);
-    if (nullptr != sep) {
-      const char* const val = sep + strspn(sep, kWhite);
-      assert(*val);  // since we dropped trailing whitespace above.
-      if (nullptr != strpbrk(val, kWhite)) {
+    sep = FindFirstOf(line.data(), line_end, ' ', '\t');
+    if (sep != line_end) {
+      const char* val = sep;
+      while (val != line_end && (*val == ' ' || *val == '\t')) ++val;
+      assert(val != line_end);  // since we dropped trailing whitespace above.
+      if (FindFirstOf(val, line_end, ' ', '\t') != line_end) {
         // We only accept whitespace as a separator if there are exactly two
         // sequences of non-whitespace characters.  If we get here, there were
         // more than 2 such sequences since we stripped trailing whitespace
         // above.
         return false;
       }
+    } else {
+      sep = nullptr;
     }
   }
   if (nullptr == sep) {
     return false;                     // Couldn't find a separator.
   }
 
-  *key = line;                        // Key starts at beginning of line.
-  *sep = '\0';                        // And stops at the separator.
-  StripWhitespaceSlowly(key);         // Get rid of any trailing whitespace.
+  // Key starts at beginning of line, and stops at the separator.
+  *key = line.substr(0, sep - line.data());
+  TrimRight(*key);                    // Get rid of any trailing whitespace.
 
-  if (*key[0] != '\0') {
-    *value = 1 + sep;                 // Value starts after the separator.
-    StripWhitespaceSlowly(value);     // Get rid of any leading whitespace.
+  if (!key->empty()) {
+    // Value starts after the separator.
+    *value = std::string_view(sep + 1, line_end - sep - 1);
+    TrimLeft(*value);                 // Get rid of any leading whitespace.
     return true;
   }
   return false;
 }
 
-void RobotsTxtParser::ParseAndEmitLine(int current_line, char* line) {
-  char* string_key;
-  char* value;
+internal::RobotsDirective RobotsTxtParser::ParseLine(
+    std::string_view line, std::string* escape_scratch) {
+  // Characters past kMaxLineLen are ignored, and a NUL byte ends the line.
+  if (line.size() > kMaxLineLen - 1) {
+    ROBOTS_STATS_ADD(truncated_bytes, line.size() - (kMaxLineLen - 1));
+    line = line.substr(0, kMaxLineLen - 1);
+  }
+  ROBOTS_STATS_ADD(lines_parsed, 1);
+  if (line.empty()) return internal::RobotsDirective();
+  const void* const nul = memchr(line.data(), '\0', line.size());
+  if (nul != nullptr) {
+    line = line.substr(0, static_cast<const char*>(nul) - line.data());
+  }
+
+  std::string_view string_key;
+  std::string_view value;
   if (!GetKeyAndValueFrom(&string_key, &value, line)) {
-    return;
+    return internal::RobotsDirective();
   }
 
   Key key;
   key.Parse(string_key);
   if (NeedEscapeValueForKey(key)) {
-    char* escaped_value = nullptr;
-    const bool is_escaped = MaybeEscapePattern(value, &escaped_value);
-    EmitKeyValueToHandler(current_line, key, escaped_value, handler_);
-    if (is_escaped) delete[] escaped_value;
-  } else {
-    EmitKeyValueToHandler(current_line, key, value, handler_);
+    value = MaybeEscapePattern(value, escape_scratch);
   }
+  return MakeDirective(key, value);
 }
+}  // end anonymous namespace
+
+namespace internal {
+
+RobotsDirective ParseRobotsLine(std::string_view line, std::string* scratch) {
+  return RobotsTxtParser::ParseLine(line, scratch);
+}
+
+const char* FindRobotsLineEnd(const char* begin, const char* end) {
+  return FindFirstOf(begin, end, 0x0A, 0x0D);
+}
+
+#ifdef ROBOTS_ENABLE_STATS
+static int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+ParseTimer::ParseTimer() : stats_(current_stats), start_nanos_(NowNanos()) {}
 
-void RobotsTxtParser::Parse() {
+ParseTimer::~ParseTimer() {
+  if (stats_ != nullptr) stats_->parse_nanos += NowNanos() - start_nanos_;
+}
+#endif  // ROBOTS_ENABLE_STATS
+
+}  // namespace internal
+
+RobotsStreamParser::RobotsStreamParser(RobotsParseHandler* handler)
+    : handler_(handler) {}
+
+void RobotsStreamParser::Reset() {
+  line_num_ = 0;
+  bom_pos_ = 0;
+  last_was_carriage_return_ = false;
+  started_ = false;
+  finished_ = false;
+  stopped_ = false;
+  partial_line_.clear();
+}
+
+void RobotsStreamParser::Feed(std::string_view chunk) {
+  Consume(chunk, /*is_last=*/false);
+}
+
+void RobotsStreamParser::Finish() { Consume(std::string_view(), true); }
+
+void RobotsStreamParser::Finish(std::string_view last_chunk) {
+  Consume(last_chunk, /*is_last=*/true);
+}
+
+void RobotsStreamParser::Consume(std::string_view chunk, bool is_last) {
   // UTF-8 byte order marks.
   static const unsigned char utf_bom[3] = {0xEF, 0xBB, 0xBF};
 
-  // Certain browsers limit the URL length to 2083 bytes. In a robots.txt, it's
-  // fairly safe to assume any valid line isn't going to be more than many times
-  // that max url length of 2KB. We want some padding for
-  // UTF-8 encoding/nulls/etc. but a much smaller bound would be okay as well.
-  // If so, we can ignore the chars on a line past that.
-  const int kMaxLineLen = 2083 * 8;
-  // Allocate a buffer used to process the current line.
-  char* const line_buffer = new char[kMaxLineLen];
-  // last_line_pos is the last writeable pos within the line array
-  // (only a final '\0' may go here).
-  const char* const line_buffer_end = line_buffer + kMaxLineLen - 1;
-  char* line_pos = line_buffer;
-  int line_num = 0;
-  size_t bom_pos = 0;
-  bool last_was_carriage_return = false;
-  handler_->HandleRobotsStart();
-
-      {
-        for (const unsigned char ch : robots_body_) {
-      assert(line_pos <= line_buffer_end);
-      // Google-specific optimization: UTF-8 byte order marks should never
-      // appear in a robots.txt file, but they do nevertheless. Skipping
-      // possible BOM-prefix in the first bytes of the input.
-      if (bom_pos < sizeof(utf_bom) && ch == utf_bom[bom_pos++]) {
-        continue;
-      }
-      bom_pos = sizeof(utf_bom);
-      if (ch != 0x0A && ch != 0x0D) {  // Non-line-ending char case.
-        // Put in next spot on current line, as long as there's room.
-        if (line_pos < line_buffer_end) {
-          *(line_pos++) = ch;
-        }
-      } else {                         // Line-ending character char case.
-        *line_pos = '\0';
-        // Only emit an empty line if this was not due to the second character
-        // of the DOS line-ending \r\n .
-        const bool is_CRLF_continuation =
-            (line_pos == line_buffer) && last_was_carriage_return && ch == 0x0A;
-        if (!is_CRLF_continuation) {
-          ParseAndEmitLine(++line_num, line_buffer);
-        }
-        line_pos = line_buffer;
-        last_was_carriage_return = (ch == 0x0D);
-      }
+  if (finished_) return;
+  ROBOTS_STATS_TIMER(parse_nanos);
+  if (!started_) {
+    started_ = true;
+    handler_->HandleRobotsStart();
+  }
+
+  // Complete lines are handed out as views into the chunk, which is never
+  // copied nor modified.
+  const char* pos = chunk.data();
+  const char* const end = pos + chunk.size();
+
+  // Google-specific optimization: UTF-8 byte order marks should never appear
+  // in a robots.txt file, but they do nevertheless. Skipping possible
+  // BOM-prefix in the first bytes of the input.
+  while (bom_pos_ < sizeof(utf_bom) && pos != end) {
+    if (static_cast<unsigned char>(*pos) == utf_bom[bom_pos_]) {
+      ++pos;
+      ++bom_pos_;
+    } else {
+      bom_pos_ = sizeof(utf_bom);
+    }
+  }
+
+  while (!stopped_) {
+    const char* const line_end = FindFirstOf(pos, end, 0x0A, 0x0D);
+    if (line_end == end) break;
+    const std::string_view line(pos, line_end - pos);
+    if (!partial_line_.empty()) {
+      AppendToPartialLine(line);
+      EmitLine(partial_line_);
+      partial_line_.clear();
+    } else if (!line.empty() || !last_was_carriage_return_ ||
+               *line_end != 0x0A) {
+      // Only emit an empty line if this was not due to the second character
+      // of the DOS line-ending \r\n .
+      EmitLine(line);
     }
+    last_was_carriage_return_ = (*line_end == 0x0D);
+    pos = line_end + 1;
+    if (handler_->IsDone(is_last ? end - pos : SIZE_MAX)) stopped_ = true;
   }
-  *line_pos = '\0';
-  ParseAndEmitLine(++line_num, line_buffer);
+
+  const std::string_view rest(pos, end - pos);
+  if (!is_last) {
+    if (!stopped_) AppendToPartialLine(rest);
+    return;
+  }
+  if (!stopped_) {
+    if (partial_line_.empty()) {
+      EmitLine(rest);
+    } else {
+      AppendToPartialLine(rest);
+      EmitLine(partial_line_);
+    }
+  }
+  partial_line_.clear();
+  finished_ = true;
   handler_->HandleRobotsEnd();
-  delete [] line_buffer;
 }
 
-// Implements the default robots.txt matching strategy. The maximum number of
-// characters matched by a pattern is returned as its match priority.
-class LongestMatchRobotsMatchStrategy : public RobotsMatchStrategy {
- public:
-  LongestMatchRobotsMatchStrategy() = default;
-
-  // Disallow copying and assignment.
-  LongestMatchRobotsMatchStrategy(const LongestMatchRobotsMatchStrategy&) =
-      delete;
-  LongestMatchRobotsMatchStrategy& operator=(
-      const LongestMatchRobotsMatchStrategy&) = delete;
+void RobotsStreamParser::EmitLine(std::string_view line) {
+  internal::RobotsParser<RobotsParseHandler>::Emit(++line_num_, line, handler_,
+                                                   &escape_scratch_);
+}
 
-  int MatchAllow(std::string_view path, std::string_view pattern) override;
-  int MatchDisallow(std::string_view path, std::string_view pattern) override;
-};
-}  // end anonymous namespace
+void RobotsStreamParser::AppendToPartialLine(std::string_view bytes) {
+  // The characters past kMaxLineLen - 1 are ignored when parsing the line.
+  const size_t max_size = RobotsTxtParser::kMaxLineLen - 1;
+  const size_t size = std::min(bytes.size(), max_size - partial_line_.size());
+  ROBOTS_STATS_ADD(truncated_bytes, bytes.size() - size);
+  partial_line_.append(bytes.data(), size);
+}
 
 void ParseRobotsTxt(std::string_view robots_body,
                     RobotsParseHandler* parse_callback) {
-  RobotsTxtParser parser(robots_body, parse_callback);
-  parser.Parse();
+  ParseRobotsTxt(robots_body, *parse_callback);
 }
 
-RobotsMatcher::RobotsMatcher()
+template <typename Strategy>
+BasicRobotsMatcher<Strategy>::BasicRobotsMatcher()
     : seen_global_agent_(false),
       seen_specific_agent_(false),
       ever_seen_specific_agent_(false),
       seen_separator_(false),
-      path_(nullptr),
-      user_agents_(nullptr) {
-  match_strategy_ = new LongestMatchRobotsMatchStrategy();
-}
-
-RobotsMatcher::~RobotsMatcher() {
-  delete match_strategy_;
+      user_agents_(nullptr),
+      batch_(nullptr),
+      per_agent_(nullptr),
+      early_exit_(false),
+      num_rules_(0),
+      body_limit_exceeded_(false),
+      num_limits_exceeded_(0) {}
+
+template <typename Strategy>
+BasicRobotsMatcher<Strategy>::~BasicRobotsMatcher() {}
+
+template <typename Strategy>
+void BasicRobotsMatcher<Strategy>::Parse(std::string_view robots_body) {
+  num_rules_ = 0;
+  // A body too large is not parsed at all, but an empty one still is, to
+  // reset the match state.
+  body_limit_exceeded_ = limits_.max_body_bytes != 0 &&
+                         robots_body.size() > limits_.max_body_bytes;
+  budget_.Reset(limits_.max_match_steps);
+  if (batch_ != nullptr) {
+    for (UrlMatchState& state : *batch_) {
+      state.budget.Reset(limits_.max_match_steps);
+    }
+  }
+  internal::RobotsParser<BasicRobotsMatcher>::Parse(
+      body_limit_exceeded_ ? std::string_view() : robots_body, this,
+      &escape_scratch_);
 }
 
-bool RobotsMatcher::ever_seen_specific_agent() const {
+template <typename Strategy>
+bool BasicRobotsMatcher<Strategy>::ever_seen_specific_agent() const {
   return ever_seen_specific_agent_;
 }
 
-void RobotsMatcher::InitUserAgentsAndPath(
-    const std::vector<std::string>* user_agents, const char* path) {
+template <typename Strategy>
+void BasicRobotsMatcher<Strategy>::InitUserAgentsAndPath(
+    const UserAgentSet* user_agents, std::string_view path) {
   // The RobotsParser object doesn't own path_ or user_agents_, so overwriting
   // these pointers doesn't cause a memory leak.
   path_ = path;
-  assert('/' == *path_);
+  assert(!path_.empty() && '/' == path_[0]);
   user_agents_ = user_agents;
 }
 
-bool RobotsMatcher::AllowedByRobots(std::string_view robots_body,
-                                    const std::vector<std::string>* user_agents,
-                                    const std::string& url) {
+template <typename Strategy>
+bool BasicRobotsMatcher<Strategy>::AllowedByRobots(
+    std::string_view robots_body, const std::vector<std::string>* user_agents,
+    std::string_view url) {
+  user_agent_set_.Assign(*user_agents);
+  return AllowedByRobots(robots_body, user_agent_set_, url);
+}
+
+template <typename Strategy>
+bool BasicRobotsMatcher<Strategy>::AllowedByRobots(
+    std::string_view robots_body, const UserAgentSet& user_agents,
+    std::string_view url) {
+  ROBOTS_STATS_TIMER(match_nanos);
   // The url is not normalized (escaped, percent encoded) here because the user
   // is asked to provide it in escaped form already.
-  std::string path = GetPathParamsQuery(url);
-  InitUserAgentsAndPath(user_agents, path.c_str());
-  ParseRobotsTxt(robots_body, this);
+  InitUserAgentsAndPath(&user_agents, PathParamsQuery(url, &path_storage_));
+  Parse(robots_body);
+  if (limit_exceeded()) {
+    ++num_limits_exceeded_;
+    ROBOTS_STATS_ADD(limits_exceeded, 1);
+  }
   return !disallow();
 }
 
-bool RobotsMatcher::OneAgentAllowedByRobots(std::string_view robots_txt,
-                                            const std::string& user_agent,
-                                            const std::string& url) {
-  std::vector<std::string> v;
-  v.push_back(user_agent);
-  return AllowedByRobots(robots_txt, &v, url);
+template <typename Strategy>
+std::vector<RobotsMatchResult>
+BasicRobotsMatcher<Strategy>::AllowedByRobotsBatch(
+    std::string_view robots_body, const std::vector<std::string>* user_agents,
+    const std::vector<std::string>& urls) {
+  user_agent_set_.Assign(*user_agents);
+  return AllowedByRobotsBatch(robots_body, user_agent_set_, urls);
 }
 
-bool RobotsMatcher::disallow() const {
-  if (allow_.specific.priority() > 0 || disallow_.specific.priority() > 0) {
-    return (disallow_.specific.priority() > allow_.specific.priority());
+template <typename Strategy>
+std::vector<RobotsMatchResult>
+BasicRobotsMatcher<Strategy>::AllowedByRobotsBatch(
+    std::string_view robots_body, const UserAgentSet& user_agents,
+    const std::vector<std::string>& urls) {
+  ROBOTS_STATS_TIMER(match_nanos);
+  std::vector<UrlMatchState>& batch = batch_storage_;
+  batch.resize(urls.size());
+  for (size_t i = 0; i < urls.size(); ++i) {
+    batch[i].path = PathParamsQuery(urls[i], &batch[i].path_storage);
+    batch[i].allow.Clear();
+    batch[i].disallow.Clear();
+  }
+  // The single-URL state is left cleared; all matches go to 'batch'.
+  path_ = "/";
+  user_agents_ = &user_agents;
+  batch_ = &batch;
+  Parse(robots_body);
+  batch_ = nullptr;
+
+  std::vector<RobotsMatchResult> results(urls.size());
+  for (size_t i = 0; i < urls.size(); ++i) {
+    const UrlMatchState& state = batch[i];
+    RobotsMatchResult& result = results[i];
+    if (body_limit_exceeded_ || state.budget.exhausted()) {
+      result = LimitExceededResult(limits_.fallback_allowed,
+                                   ever_seen_specific_agent_);
+      ++num_limits_exceeded_;
+      ROBOTS_STATS_ADD(limits_exceeded, 1);
+      continue;
+    }
+    result.allowed =
+        !Disallow(state.allow, state.disallow, ever_seen_specific_agent_);
+    result.matching_line =
+        MatchingLine(state.allow, state.disallow, ever_seen_specific_agent_);
+    result.ever_seen_specific_agent = ever_seen_specific_agent_;
+  }
+  return results;
+}
+
+template <typename Strategy>
+std::vector<RobotsMatchResult>
+BasicRobotsMatcher<Strategy>::AllowedByRobotsPerAgent(
+    std::string_view robots_body, const std::vector<std::string>& user_agents,
+    std::string_view url) {
+  ROBOTS_STATS_TIMER(match_nanos);
+  user_agent_set_.Assign(user_agents);
+  std::vector<AgentMatchState>& per_agent = per_agent_storage_;
+  per_agent.assign(user_agent_set_.size(), AgentMatchState());
+  // The url is not normalized (escaped, percent encoded) here because the user
+  // is asked to provide it in escaped form already.
+  InitUserAgentsAndPath(&user_agent_set_, PathParamsQuery(url, &path_storage_));
+  per_agent_ = &per_agent;
+  Parse(robots_body);
+  per_agent_ = nullptr;
+
+  std::vector<RobotsMatchResult> results(user_agents.size());
+  for (size_t i = 0; i < user_agents.size(); ++i) {
+    const AgentMatchState& state =
+        per_agent[user_agent_set_.Find(user_agents[i])];
+    RobotsMatchResult& result = results[i];
+    if (limit_exceeded()) {
+      result = LimitExceededResult(limits_.fallback_allowed,
+                                   state.ever_seen_specific_agent);
+      ++num_limits_exceeded_;
+      ROBOTS_STATS_ADD(limits_exceeded, 1);
+      continue;
+    }
+    result.allowed = !Disallow(state.allow, state.disallow,
+                               state.ever_seen_specific_agent);
+    result.matching_line = MatchingLine(state.allow, state.disallow,
+                                        state.ever_seen_specific_agent);
+    result.ever_seen_specific_agent = state.ever_seen_specific_agent;
+  }
+  return results;
+}
+
+template <typename Strategy>
+bool BasicRobotsMatcher<Strategy>::OneAgentAllowedByRobots(
+    std::string_view robots_txt, std::string_view user_agent,
+    std::string_view url) {
+  user_agent_set_.Clear();
+  user_agent_set_.Insert(user_agent);
+  return AllowedByRobots(robots_txt, user_agent_set_, url);
+}
+
+template <typename Strategy>
+bool BasicRobotsMatcher<Strategy>::disallow() const {
+  if (limit_exceeded()) return !limits_.fallback_allowed;
+  return Disallow(allow_, disallow_, ever_seen_specific_agent_);
+}
+
+template <typename Strategy>
+bool BasicRobotsMatcher<Strategy>::limit_exceeded() const {
+  return body_limit_exceeded_ || budget_.exhausted();
+}
+
+template <typename Strategy>
+/* static */ RobotsMatchResult
+BasicRobotsMatcher<Strategy>::LimitExceededResult(
+    bool fallback_allowed, bool ever_seen_specific_agent) {
+  RobotsMatchResult result;
+  result.allowed = fallback_allowed;
+  result.ever_seen_specific_agent = ever_seen_specific_agent;
+  result.limit_exceeded = true;
+  return result;
+}
+
+template <typename Strategy>
+/* static */ bool BasicRobotsMatcher<Strategy>::Disallow(
+    const MatchHierarchy& allow, const MatchHierarchy& disallow,
+    bool ever_seen_specific_agent) {
+  if (allow.specific.priority() > 0 || disallow.specific.priority() > 0) {
+    return (disallow.specific.priority() > allow.specific.priority());
   }
 
-  if (ever_seen_specific_agent_) {
+  if (ever_seen_specific_agent) {
     // Matching group for user-agent but either without disallow or empty one,
     // i.e. priority == 0.
     return false;
   }
 
-  if (disallow_.global.priority() > 0 || allow_.global.priority() > 0) {
-    return disallow_.global.priority() > allow_.global.priority();
+  if (disallow.global.priority() > 0 || allow.global.priority() > 0) {
+    return disallow.global.priority() > allow.global.priority();
   }
   return false;
 }
 
-bool RobotsMatcher::disallow_ignore_global() const {
+template <typename Strategy>
+bool BasicRobotsMatcher<Strategy>::disallow_ignore_global() const {
+  if (limit_exceeded()) return !limits_.fallback_allowed;
   if (allow_.specific.priority() > 0 || disallow_.specific.priority() > 0) {
     return disallow_.specific.priority() > allow_.specific.priority();
   }
   return false;
 }
 
-const int RobotsMatcher::matching_line() const {
-  if (ever_seen_specific_agent_) {
-    return Match::HigherPriorityMatch(disallow_.specific, allow_.specific)
+template <typename Strategy>
+const int BasicRobotsMatcher<Strategy>::matching_line() const {
+  if (limit_exceeded()) return 0;
+  return MatchingLine(allow_, disallow_, ever_seen_specific_agent_);
+}
+
+template <typename Strategy>
+/* static */ int BasicRobotsMatcher<Strategy>::MatchingLine(
+    const MatchHierarchy& allow, const MatchHierarchy& disallow,
+    bool ever_seen_specific_agent) {
+  if (ever_seen_specific_agent) {
+    return Match::HigherPriorityMatch(disallow.specific, allow.specific)
         .line();
   }
-  return Match::HigherPriorityMatch(disallow_.global, allow_.global).line();
+  return Match::HigherPriorityMatch(disallow.global, allow.global).line();
 }
 
-void RobotsMatcher::HandleRobotsStart() {
+template <typename Strategy>
+void BasicRobotsMatcher<Strategy>::HandleRobotsStart() {
   // This is a new robots.txt file, so we need to reset all the instance member
   // variables. We do it in the same order the instance member variables are
   // declared, so it's easier to keep track of which ones we have (or maybe
   // haven't!) done.
   allow_.Clear();
   disallow_.Clear();
+  if (batch_ != nullptr) {
+    for (UrlMatchState& state : *batch_) {
+      state.allow.Clear();
+      state.disallow.Clear();
+    }
+  }
+  if (per_agent_ != nullptr) {
+    for (AgentMatchState& state : *per_agent_) state = AgentMatchState();
+  }
 
   seen_global_agent_ = false;
   seen_specific_agent_ = false;
@@ -593,38 +1084,111 @@ void RobotsMatcher::HandleRobotsStart() {
   seen_separator_ = false;
 }
 
-/*static*/ std::string_view RobotsMatcher::ExtractUserAgent(
+template <typename Strategy>
+/*static*/ std::string_view BasicRobotsMatcher<Strategy>::ExtractUserAgent(
     std::string_view user_agent) {
   // Allowed characters in user-agent are [a-zA-Z_-].
-  const char* end = user_agent.data();
-  while (AsciiIsAlpha(*end) || *end == '-' || *end == '_') {
-    ++end;
+  return user_agent.substr(0, AsciiProductTokenLength(user_agent));
+}
+
+UserAgentSet::UserAgentSet(const std::vector<std::string>& user_agents) {
+  Assign(user_agents);
+}
+
+void UserAgentSet::Assign(const std::vector<std::string>& user_agents) {
+  Clear();
+  for (const auto& user_agent : user_agents) {
+    Insert(user_agent);
+  }
+}
+
+void UserAgentSet::Insert(std::string_view user_agent) {
+  const uint64_t hash = Hash(user_agent);
+  if (Find(user_agent, hash) >= 0) return;
+  if (size_ == agents_.size()) agents_.emplace_back();
+  Agent& agent = agents_[size_++];
+  agent.hash = hash;
+  agent.lowercase.resize(user_agent.size());
+  AsciiToLower(user_agent, &agent.lowercase[0]);
+}
+
+bool UserAgentSet::Contains(std::string_view user_agent) const {
+  return Find(user_agent) >= 0;
+}
+
+int UserAgentSet::Find(std::string_view user_agent) const {
+  return Find(user_agent, Hash(user_agent));
+}
+
+int UserAgentSet::Find(std::string_view user_agent, uint64_t hash) const {
+  for (size_t i = 0; i < size_; ++i) {
+    const Agent& agent = agents_[i];
+    if (agent.hash == hash && AsciiEqualsIgnoreCase(agent.lowercase, user_agent)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool UserAgentSet::Intersects(const UserAgentSet& other) const {
+  if (other.size_ < size_) return other.Intersects(*this);
+  for (size_t i = 0; i < size_; ++i) {
+    if (other.Find(agents_[i].lowercase, agents_[i].hash) >= 0) return true;
+  }
+  return false;
+}
+
+size_t UserAgentSet::SpaceUsedExcludingSelf() const {
+  size_t bytes = agents_.capacity() * sizeof(Agent);
+  for (const Agent& agent : agents_) bytes += agent.lowercase.capacity();
+  return bytes;
+}
+
+// FNV-1a over the lowercased bytes of 'user_agent'.
+/* static */ uint64_t UserAgentSet::Hash(std::string_view user_agent) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char ch : user_agent) {
+    hash ^= static_cast<unsigned char>(AsciiToLower(ch));
+    hash *= 1099511628211ULL;
   }
-  return user_agent.substr(0, end - user_agent.data());
+  return hash;
 }
 
-/*static*/ bool RobotsMatcher::IsValidUserAgentToObey(
+// Google-specific optimization: a '*' followed by space and more characters
+// in a user-agent record is still regarded a global rule.
+static bool IsGlobalUserAgent(std::string_view user_agent) {
+  return user_agent.length() >= 1 && user_agent[0] == '*' &&
+         (user_agent.length() == 1 || AsciiIsSpace(user_agent[1]));
+}
+
+template <typename Strategy>
+/*static*/ bool BasicRobotsMatcher<Strategy>::IsValidUserAgentToObey(
     std::string_view user_agent) {
   return user_agent.length() > 0 && ExtractUserAgent(user_agent) == user_agent;
 }
 
-void RobotsMatcher::HandleUserAgent(int line_num,
-                                    std::string_view user_agent) {
+template <typename Strategy>
+void BasicRobotsMatcher<Strategy>::HandleUserAgent(
+    int line_num, std::string_view user_agent) {
   if (seen_separator_) {
     seen_specific_agent_ = seen_global_agent_ = seen_separator_ = false;
+    if (per_agent_ != nullptr) {
+      for (AgentMatchState& state : *per_agent_) {
+        state.seen_specific_agent = false;
+      }
+    }
   }
 
-  // Google-specific optimization: a '*' followed by space and more characters
-  // in a user-agent record is still regarded a global rule.
-  if (user_agent.length() >= 1 && user_agent[0] == '*' &&
-      (user_agent.length() == 1 || isspace(user_agent[1]))) {
+  if (IsGlobalUserAgent(user_agent)) {
     seen_global_agent_ = true;
   } else {
     user_agent = ExtractUserAgent(user_agent);
-    for (const auto& agent : *user_agents_) {
-      if (boost::iequals(user_agent, agent)) {
-        ever_seen_specific_agent_ = seen_specific_agent_ = true;
-        break;
+    const int agent = user_agents_->Find(user_agent);
+    if (agent >= 0) {
+      ever_seen_specific_agent_ = seen_specific_agent_ = true;
+      if (per_agent_ != nullptr) {
+        AgentMatchState& state = (*per_agent_)[agent];
+        state.ever_seen_specific_agent = state.seen_specific_agent = true;
       }
     }
   }
@@ -637,134 +1201,1057 @@ static inline std::string_view clipped_substr(std::string_view s, size_t pos,
   return s.substr(pos, n);
 }
 
-void RobotsMatcher::HandleAllow(int line_num, std::string_view value) {
-  if (!seen_any_agent()) return;
+template <typename Strategy>
+void BasicRobotsMatcher<Strategy>::HandleAllow(int line_num,
+                                               std::string_view value) {
+  if (!CheckRuleLimits(value) || !seen_any_agent()) return;
+  seen_separator_ = true;
+  if (batch_ != nullptr) {
+    for (UrlMatchState& state : *batch_) {
+      if (state.budget.exhausted()) continue;
+      RecordMatch(
+          MatchAllowPriority(state.path, value, line_num, &state.budget),
+          line_num, seen_specific_agent_, &state.allow);
+    }
+    return;
+  }
+  const int priority = MatchAllowPriority(path_, value, line_num, &budget_);
+  if (per_agent_ == nullptr) {
+    RecordMatch(priority, line_num, seen_specific_agent_, &allow_);
+    return;
+  }
+  // The agents not in the current group only follow its rules if it is also a
+  // group for all agents.
+  for (AgentMatchState& state : *per_agent_) {
+    if (state.seen_specific_agent || seen_global_agent_) {
+      RecordMatch(priority, line_num, state.seen_specific_agent, &state.allow);
+    }
+  }
+}
+
+template <typename Strategy>
+void BasicRobotsMatcher<Strategy>::HandleDisallow(int line_num,
+                                                  std::string_view value) {
+  if (!CheckRuleLimits(value) || !seen_any_agent()) return;
   seen_separator_ = true;
-  const int priority = match_strategy_->MatchAllow(path_, value);
-  if (priority >= 0) {
-    if (seen_specific_agent_) {
-      if (allow_.specific.priority() < priority) {
-        allow_.specific.Set(priority, line_num);
+  if (batch_ != nullptr) {
+    for (UrlMatchState& state : *batch_) {
+      if (state.budget.exhausted()) continue;
+      RecordMatch(
+          MatchDisallowPriority(state.path, value, line_num, &state.budget),
+          line_num, seen_specific_agent_, &state.disallow);
+    }
+    return;
+  }
+  const int priority =
+      MatchDisallowPriority(path_, value, line_num, &budget_);
+  if (per_agent_ == nullptr) {
+    RecordMatch(priority, line_num, seen_specific_agent_, &disallow_);
+    return;
+  }
+  for (AgentMatchState& state : *per_agent_) {
+    if (state.seen_specific_agent || seen_global_agent_) {
+      RecordMatch(priority, line_num, state.seen_specific_agent,
+                  &state.disallow);
+    }
+  }
+}
+
+// Rules are counted on all lines, whether or not they are for our agents, so
+// that the limits do not depend on the agents checked.
+template <typename Strategy>
+bool BasicRobotsMatcher<Strategy>::CheckRuleLimits(std::string_view value) {
+  if ((limits_.max_rules != 0 && ++num_rules_ > limits_.max_rules) ||
+      (limits_.max_wildcards != 0 &&
+       static_cast<size_t>(std::count(value.begin(), value.end(), '*')) >
+           limits_.max_wildcards)) {
+    body_limit_exceeded_ = true;
+  }
+  return !body_limit_exceeded_;
+}
+
+template <typename Strategy>
+int BasicRobotsMatcher<Strategy>::MatchAllowPriority(
+    std::string_view path, std::string_view value, int line_num,
+    RobotsMatchBudget* budget) {
+  ROBOTS_STATS_ADD(rules_evaluated, 1);
+  if (!budget->Spend(1)) return -1;
+  const int priority = Strategy::MatchAllow(path, value, line_num, budget);
+  if (priority >= 0) return priority;
+  // Google-specific optimization: 'index.htm' and 'index.html' are normalized
+  // to '/'.
+  const size_t slash_pos = value.find_last_of('/');
+
+  if (slash_pos != std::string_view::npos &&
+      clipped_substr(value, slash_pos, 10) == "/index.htm") {
+    // The rewritten pattern ends with '$', it is not rewritten again.
+    index_pattern_.assign(value.data(), slash_pos + 1);
+    index_pattern_.push_back('$');
+    return MatchAllowPriority(path, index_pattern_, line_num, budget);
+  }
+  return -1;
+}
+
+template <typename Strategy>
+int BasicRobotsMatcher<Strategy>::MatchDisallowPriority(
+    std::string_view path, std::string_view value, int line_num,
+    RobotsMatchBudget* budget) {
+  ROBOTS_STATS_ADD(rules_evaluated, 1);
+  if (!budget->Spend(1)) return -1;
+  return Strategy::MatchDisallow(path, value, line_num, budget);
+}
+
+template <typename Strategy>
+/* static */ void BasicRobotsMatcher<Strategy>::RecordMatch(
+    int priority, int line_num, bool specific, MatchHierarchy* hierarchy) {
+  if (priority < 0) return;
+  Match& match = specific ? hierarchy->specific : hierarchy->global;
+  if (match.priority() < priority) {
+    match.Set(priority, line_num);
+  }
+}
+
+// The maximum number of characters matched by a pattern is returned as its
+// match priority.
+/* static */ int LongestMatchRobotsMatchStrategy::MatchAllow(
+    std::string_view path, std::string_view pattern, int line_num,
+    RobotsMatchBudget* budget) {
+  return Matches(path, pattern, budget) ? pattern.length() : -1;
+}
+
+/* static */ int LongestMatchRobotsMatchStrategy::MatchDisallow(
+    std::string_view path, std::string_view pattern, int line_num,
+    RobotsMatchBudget* budget) {
+  return Matches(path, pattern, budget) ? pattern.length() : -1;
+}
+
+// The priority of a rule is the length of its pattern, which wildcards let grow
+// past the length of the path, but the pattern of a rule from the rest of the
+// body is at most three times as long as the bytes left, when all of them are
+// escaped.
+/* static */ bool LongestMatchRobotsMatchStrategy::CanBeOutranked(
+    int priority, size_t max_bytes_left) {
+  return max_bytes_left > static_cast<size_t>(priority - 1) / 3;
+}
+
+// Earlier lines get higher priorities. An empty pattern keeps its meaning of
+// an empty rule, with priority 0.
+/* static */ int FirstMatchRobotsMatchStrategy::MatchAllow(
+    std::string_view path, std::string_view pattern, int line_num,
+    RobotsMatchBudget* budget) {
+  if (!Matches(path, pattern, budget)) return -1;
+  return pattern.empty() ? 0 : std::numeric_limits<int>::max() - line_num;
+}
+
+/* static */ int FirstMatchRobotsMatchStrategy::MatchDisallow(
+    std::string_view path, std::string_view pattern, int line_num,
+    RobotsMatchBudget* budget) {
+  return MatchAllow(path, pattern, line_num, budget);
+}
+
+// Rules from the rest of the body are on later lines.
+/* static */ bool FirstMatchRobotsMatchStrategy::CanBeOutranked(
+    int priority, size_t max_bytes_left) {
+  return false;
+}
+
+template <typename Strategy>
+void BasicRobotsMatcher<Strategy>::HandleCrawlDelay(int line_num,
+                                                    std::string_view value) {
+  seen_separator_ = true;
+}
+
+template <typename Strategy>
+void BasicRobotsMatcher<Strategy>::HandleSitemap(int line_num,
+                                                 std::string_view value) {
+  seen_separator_ = true;
+}
+
+template <typename Strategy>
+void BasicRobotsMatcher<Strategy>::HandleUnknownAction(
+    int line_num, std::string_view action, std::string_view value) {
+  seen_separator_ = true;
+}
+
+template <typename Strategy>
+bool BasicRobotsMatcher<Strategy>::IsDone(size_t max_bytes_left) {
+  // Past the limits, the rest of the body cannot change the verdict any more.
+  if (body_limit_exceeded_ || (batch_ == nullptr && budget_.exhausted())) {
+    return true;
+  }
+  if (!early_exit_ || batch_ != nullptr) return false;
+  // Once a rule for one of the agents matched, only rules for these agents
+  // with a higher priority can change the verdict.
+  const int priority =
+      std::max(allow_.specific.priority(), disallow_.specific.priority());
+  return priority > 0 && !Strategy::CanBeOutranked(priority, max_bytes_left);
+}
+
+template class BasicRobotsMatcher<LongestMatchRobotsMatchStrategy>;
+template class BasicRobotsMatcher<FirstMatchRobotsMatchStrategy>;
+
+// Parses the value of a crawl-delay line, a non-negative decimal number of
+// seconds such as "10" or "0.5", into '*seconds'. Returns false if it is not
+// one.
+static bool ParseCrawlDelay(std::string_view value, double* seconds) {
+  uint64_t mantissa = 0;
+  int num_digits = 0;
+  int num_decimals = 0;
+  bool seen_point = false;
+  for (const char ch : value) {
+    if (ch == '.' && !seen_point) {
+      seen_point = true;
+      continue;
+    }
+    if (ch < '0' || ch > '9') return false;
+    // Past 18 digits the mantissa could overflow, and the delay makes no sense
+    // anyway.
+    if (++num_digits > 18) return false;
+    mantissa = mantissa * 10 + (ch - '0');
+    if (seen_point) ++num_decimals;
+  }
+  if (num_digits == 0) return false;
+  double scale = 1;
+  for (int i = 0; i < num_decimals; ++i) scale *= 10;
+  *seconds = mantissa / scale;
+  return true;
+}
+
+// Collects the rules of a robots.txt into RobotsRuleSet groups. A new group
+// starts at a user-agent line that follows any other directive, the same way
+// RobotsMatcher::HandleUserAgent() resets its agent state, so all the agents
+// of consecutive user-agent lines share the rules that follow.
+//
+// Patterns are canonicalized and identical ones share their segments, across
+// all groups. Rules that can never set the matching line, because another rule
+// of their group always beats them, are dropped.
+//
+// Rules are counted against 'limits' the same way RobotsMatcher counts them.
+// Past the limits, the parse stops and every table is left empty.
+class RobotsRuleSet::Builder final : public RobotsParseHandler {
+ public:
+  Builder(RobotsRuleSet* rules, const RobotsLimits& limits)
+      : rules_(rules), limits_(limits) {}
+
+  void HandleRobotsStart() override {
+    rules_->groups_.clear();
+    rules_->agents_.clear();
+    rules_->rules_.clear();
+    rules_->segments_.clear();
+    rules_->trie_nodes_.clear();
+    rules_->trie_rules_.clear();
+    rules_->sitemaps_.clear();
+    rules_->literals_.clear();
+    group_first_rules_.clear();
+    patterns_.clear();
+    seen_separator_ = true;
+    num_rules_ = 0;
+  }
+  void HandleRobotsEnd() override {
+    if (rules_->limit_exceeded_) {
+      HandleRobotsStart();
+      return;
+    }
+    group_first_rules_.push_back(rules_->rules_.size());
+    std::vector<Rule> kept;
+    for (size_t i = 0; i < rules_->groups_.size(); ++i) {
+      rules_->groups_[i].trie_root =
+          BuildTrie(group_first_rules_[i], group_first_rules_[i + 1], &kept);
+    }
+    rules_->rules_.swap(kept);
+  }
+
+  void HandleUserAgent(int line_num, std::string_view user_agent) override {
+    if (seen_separator_) {
+      Group group;
+      group.global = 0;
+      group.first_agent = rules_->agents_.size();
+      group.num_agents = 0;
+      group.trie_root = 0;
+      group.crawl_delay = -1;
+      rules_->groups_.push_back(group);
+      group_first_rules_.push_back(rules_->rules_.size());
+      seen_separator_ = false;
+    }
+    Group& group = rules_->groups_.back();
+    if (IsGlobalUserAgent(user_agent)) {
+      group.global = 1;
+      return;
+    }
+    user_agent = RobotsMatcher::ExtractUserAgent(user_agent);
+    Agent agent;
+    agent.hash = UserAgentSet::Hash(user_agent);
+    agent.offset = rules_->literals_.size();
+    agent.length = user_agent.size();
+    for (const char ch : user_agent) {
+      rules_->literals_.push_back(AsciiToLower(ch));
+    }
+    rules_->agents_.push_back(agent);
+    ++group.num_agents;
+  }
+
+  void HandleAllow(int line_num, std::string_view value) override {
+    if (!CheckRuleLimits(value)) return;
+    AddRule(line_num, /*allow=*/true, value);
+    // Google-specific optimization: 'index.htm' and 'index.html' are
+    // normalized to '/'. RobotsMatcher::HandleAllow() only tries the rewritten
+    // pattern if the original one does not match, but the rewritten pattern is
+    // always shorter, so it can never win over the original one.
+    const size_t slash_pos = value.find_last_of('/');
+    if (slash_pos != std::string_view::npos &&
+        value.substr(slash_pos, 10) == "/index.htm") {
+      std::string pattern(value.substr(0, slash_pos + 1));
+      pattern += '$';
+      AddRule(line_num, /*allow=*/true, pattern);
+    }
+  }
+
+  void HandleDisallow(int line_num, std::string_view value) override {
+    if (!CheckRuleLimits(value)) return;
+    AddRule(line_num, /*allow=*/false, value);
+  }
+
+  void HandleCrawlDelay(int line_num, std::string_view value) override {
+    seen_separator_ = true;
+    // Like rules, a crawl-delay before the first user-agent line does not
+    // apply to anyone.
+    if (rules_->groups_.empty()) return;
+    Group& group = rules_->groups_.back();
+    double seconds;
+    if (group.crawl_delay < 0 && ParseCrawlDelay(value, &seconds)) {
+      group.crawl_delay = seconds;
+    }
+  }
+
+  void HandleSitemap(int line_num, std::string_view value) override {
+    seen_separator_ = true;
+    if (value.empty()) return;
+    rules_->sitemaps_.push_back(
+        Segment{static_cast<uint32_t>(rules_->literals_.size()),
+                static_cast<uint32_t>(value.size())});
+    rules_->literals_.append(value.data(), value.size());
+  }
+
+  void HandleUnknownAction(int line_num, std::string_view action,
+                           std::string_view value) override {
+    seen_separator_ = true;
+  }
+
+  bool IsDone(size_t max_bytes_left) override {
+    return rules_->limit_exceeded_;
+  }
+
+ private:
+  // Counts the rule 'value' against the limits, like
+  // RobotsMatcher::CheckRuleLimits(). Returns false past them.
+  bool CheckRuleLimits(std::string_view value) {
+    if ((limits_.max_rules != 0 && ++num_rules_ > limits_.max_rules) ||
+        (limits_.max_wildcards != 0 &&
+         static_cast<size_t>(std::count(value.begin(), value.end(), '*')) >
+             limits_.max_wildcards)) {
+      rules_->limit_exceeded_ = true;
+    }
+    return !rules_->limit_exceeded_;
+  }
+
+  // Compiles 'pattern' into the segments between its wildcards.
+  void AddRule(int line_num, bool allow, std::string_view pattern) {
+    seen_separator_ = true;
+    // Rules before the first user-agent line do not apply to anyone.
+    if (rules_->groups_.empty()) return;
+
+    Rule rule = {};
+    rule.line = line_num;
+    rule.allow = allow;
+    // The priority is the length of the pattern as written, canonicalizing it
+    // only changes how it is matched.
+    rule.priority = pattern.length();
+    rule.anchored = !pattern.empty() && pattern.back() == '$';
+    if (rule.anchored) pattern.remove_suffix(1);
+
+    // Empty segments after the first one match anywhere, i.e. "**" is the
+    // same as "*", and a trailing "*" or "*$" matches any rest of the path.
+    segments_.clear();
+    PatternSegmentIterator segments(pattern);
+    segments_.push_back(segments.Next());
+    while (!segments.Done()) {
+      const std::string_view segment = segments.Next();
+      if (!segment.empty()) {
+        segments_.push_back(segment);
+      } else if (segments.Done()) {
+        rule.anchored = false;
       }
+    }
+
+    // The key of a canonical pattern is its anchor followed by its segments,
+    // which contain no '*'.
+    key_.assign(1, rule.anchored ? '$' : '*');
+    for (const std::string_view segment : segments_) {
+      key_.append(segment.data(), segment.size());
+      key_ += '*';
+    }
+    const auto it = patterns_.find(key_);
+    if (it != patterns_.end()) {
+      rule.first_segment = it->second;
     } else {
-      assert(seen_global_agent_);
-      if (allow_.global.priority() < priority) {
-        allow_.global.Set(priority, line_num);
+      rule.first_segment = rules_->segments_.size();
+      for (const std::string_view segment : segments_) {
+        rules_->segments_.push_back(
+            Segment{static_cast<uint32_t>(rules_->literals_.size()),
+                    static_cast<uint32_t>(segment.size())});
+        rules_->literals_.append(segment.data(), segment.size());
       }
+      patterns_.emplace(key_, rule.first_segment);
     }
-  } else {
-    // Google-specific optimization: 'index.htm' and 'index.html' are normalized
-    // to '/'.
-    const size_t slash_pos = value.find_last_of('/');
+    rule.num_segments = segments_.size();
+    rules_->rules_.push_back(rule);
+  }
 
-    if (slash_pos != std::string_view::npos &&
-        boost::starts_with(clipped_substr(value, slash_pos),
-                            "/index.htm")) {
-      const int len = slash_pos + 1;
-      absl::FixedArray<char> newpattern(len + 1);
-      strncpy(newpattern.data(), value.data(), len);
-      newpattern[len] = '$';
-      HandleAllow(line_num,
-                  std::string_view(newpattern.data(), newpattern.size()));
+  // Returns true if 'a' wins over 'b' on the paths both match, as their
+  // priorities are compared by MatchGroup().
+  static bool Beats(const Rule& a, const Rule& b) {
+    return a.priority > b.priority ||
+           (a.priority == b.priority && a.line < b.line);
+  }
+
+  // Returns true if 'rule' has no wildcard nor anchor, and so matches all the
+  // paths starting with its literal prefix.
+  static bool IsPrefixRule(const Rule& rule) {
+    return rule.num_segments == 1 && !rule.anchored;
+  }
+
+  // Indexes the rules [first_rule, end_rule) of a group in a trie keyed by
+  // their literal prefix, and returns the index of its root. See TrieNode.
+  // The rules indexed are moved to '*kept', the others can never set the
+  // matching line of any path and are dropped:
+  // - a rule beaten by one with the same canonical pattern and kind (allow or
+  //   disallow), which matches the same paths,
+  // - a rule beaten by a prefix rule of the same kind whose literal is a prefix
+  //   of its own, and so matches at least the same paths.
+  uint32_t BuildTrie(uint32_t first_rule, uint32_t end_rule,
+                     std::vector<Rule>* kept) {
+    const std::vector<Rule>& rules = rules_->rules_;
+    // Rules sharing their canonical pattern share their segments.
+    std::map<std::pair<uint32_t, uint8_t>, uint32_t> best_by_pattern;
+    for (uint32_t i = first_rule; i < end_rule; ++i) {
+      const auto it = best_by_pattern
+                          .emplace(std::make_pair(rules[i].first_segment,
+                                                  rules[i].allow),
+                                   i)
+                          .first;
+      if (Beats(rules[i], rules[it->second])) it->second = i;
     }
+
+    struct Node {
+      unsigned char byte = 0;
+      std::map<unsigned char, size_t> children;
+      std::vector<uint32_t> rules;
+      // Best prefix rule of each kind ending at this node or above it, or -1.
+      int64_t best_prefix_rule[2] = {-1, -1};
+    };
+    std::vector<Node> nodes(1);
+    for (const auto& pattern : best_by_pattern) {
+      const uint32_t i = pattern.second;
+      const Segment& prefix = rules_->segments_[rules[i].first_segment];
+      size_t node = 0;
+      for (uint32_t j = 0; j < prefix.length; ++j) {
+        const unsigned char byte = rules_->literals_[prefix.offset + j];
+        const auto it = nodes[node].children.find(byte);
+        if (it != nodes[node].children.end()) {
+          node = it->second;
+          continue;
+        }
+        const size_t child = nodes.size();
+        nodes[node].children.emplace(byte, child);
+        nodes.emplace_back();
+        nodes[child].byte = byte;
+        node = child;
+      }
+      nodes[node].rules.push_back(i);
+    }
+
+    // Lay the nodes out in breadth-first order, so that the children of each
+    // node are contiguous, and the ancestors of a node come before it.
+    const uint32_t base = rules_->trie_nodes_.size();
+    std::vector<size_t> order(1, 0);
+    for (size_t k = 0; k < order.size(); ++k) {
+      Node& node = nodes[order[k]];
+      int64_t* const best = node.best_prefix_rule;
+      for (const uint32_t i : node.rules) {
+        if (IsPrefixRule(rules[i]) &&
+            (best[rules[i].allow] < 0 ||
+             Beats(rules[i], rules[best[rules[i].allow]]))) {
+          best[rules[i].allow] = i;
+        }
+      }
+      TrieNode flat = {};
+      flat.byte = node.byte;
+      flat.first_child = base + order.size();
+      flat.num_children = node.children.size();
+      for (const auto& child : node.children) {
+        order.push_back(child.second);
+        std::copy(best, best + 2, nodes[child.second].best_prefix_rule);
+      }
+      flat.first_rule = rules_->trie_rules_.size();
+      for (const uint32_t i : node.rules) {
+        const int64_t best_prefix = best[rules[i].allow];
+        if (best_prefix >= 0 && Beats(rules[best_prefix], rules[i])) continue;
+        rules_->trie_rules_.push_back(kept->size());
+        kept->push_back(rules[i]);
+      }
+      flat.num_rules = rules_->trie_rules_.size() - flat.first_rule;
+      rules_->trie_nodes_.push_back(flat);
+    }
+    return base;
   }
+
+  RobotsRuleSet* const rules_;
+  const RobotsLimits limits_;
+  size_t num_rules_ = 0;
+  bool seen_separator_ = true;
+  // Index in 'rules_' of the first rule of each group.
+  std::vector<uint32_t> group_first_rules_;
+  // First segment of each canonical pattern, by key (see AddRule()).
+  std::unordered_map<std::string, uint32_t> patterns_;
+  // Scratch space of AddRule().
+  std::vector<std::string_view> segments_;
+  std::string key_;
+};
+
+RobotsRuleSet::RobotsRuleSet(std::string_view robots_body)
+    : RobotsRuleSet(robots_body, RobotsLimits()) {}
+
+RobotsRuleSet::RobotsRuleSet(std::string_view robots_body,
+                             const RobotsLimits& limits)
+    : max_match_steps_(limits.max_match_steps),
+      fallback_allowed_(limits.fallback_allowed),
+      limit_exceeded_(limits.max_body_bytes != 0 &&
+                      robots_body.size() > limits.max_body_bytes) {
+  if (limit_exceeded_) return;
+  Builder builder(this, limits);
+  ParseRobotsTxt(robots_body, builder);
 }
 
-void RobotsMatcher::HandleDisallow(int line_num, std::string_view value) {
-  if (!seen_any_agent()) return;
-  seen_separator_ = true;
-  const int priority = match_strategy_->MatchDisallow(path_, value);
-  if (priority >= 0) {
-    if (seen_specific_agent_) {
-      if (disallow_.specific.priority() < priority) {
-        disallow_.specific.Set(priority, line_num);
+RobotsRuleSet::RobotsRuleSet(const Tables& tables, uint64_t max_match_steps,
+                             bool fallback_allowed, bool limit_exceeded)
+    : max_match_steps_(max_match_steps),
+      fallback_allowed_(fallback_allowed),
+      limit_exceeded_(limit_exceeded),
+      mapped_(true),
+      mapped_tables_(tables) {}
+
+RobotsRuleSet::Tables RobotsRuleSet::tables() const {
+  if (mapped_) return mapped_tables_;
+  Tables tables;
+  tables.groups = groups_.data();
+  tables.agents = agents_.data();
+  tables.rules = rules_.data();
+  tables.segments = segments_.data();
+  tables.trie_nodes = trie_nodes_.data();
+  tables.trie_rules = trie_rules_.data();
+  tables.sitemaps = sitemaps_.data();
+  tables.literals = literals_.data();
+  tables.num_groups = groups_.size();
+  tables.num_agents = agents_.size();
+  tables.num_rules = rules_.size();
+  tables.num_segments = segments_.size();
+  tables.num_trie_nodes = trie_nodes_.size();
+  tables.num_trie_rules = trie_rules_.size();
+  tables.num_sitemaps = sitemaps_.size();
+  tables.literals_size = literals_.size();
+  return tables;
+}
+
+// Yields the compiled segments of a rule.
+class RobotsRuleSet::SegmentIterator {
+ public:
+  SegmentIterator(const Tables& tables, const Rule& rule)
+      : literals_(tables.literals),
+        segment_(tables.segments + rule.first_segment),
+        end_(segment_ + rule.num_segments) {}
+
+  std::string_view Next() {
+    const Segment& segment = *segment_++;
+    return std::string_view(literals_ + segment.offset, segment.length);
+  }
+  bool Done() const { return segment_ == end_; }
+
+ private:
+  const char* const literals_;
+  const Segment* segment_;
+  const Segment* const end_;
+};
+
+/* static */ bool RobotsRuleSet::GroupHasAgent(
+    const Tables& tables, const Group& group, const UserAgentSet& user_agents) {
+  for (uint32_t i = 0; i < group.num_agents; ++i) {
+    const Agent& agent = tables.agents[group.first_agent + i];
+    if (user_agents.Find(
+            std::string_view(tables.literals + agent.offset, agent.length),
+            agent.hash) >= 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* static */ bool RobotsRuleSet::RuleMatches(const Tables& tables,
+                                             const Rule& rule,
+                                             std::string_view path,
+                                             RobotsMatchBudget* budget) {
+  return MatchSegments(path, SegmentIterator(tables, rule), rule.anchored,
+                       budget);
+}
+
+/* static */ void RobotsRuleSet::MatchGroup(
+    const Tables& tables, const Group& group, std::string_view path,
+    bool specific, RobotsMatchBudget* budget,
+    RobotsMatcher::MatchHierarchy* allow,
+    RobotsMatcher::MatchHierarchy* disallow) {
+  const TrieNode* node = tables.trie_nodes + group.trie_root;
+  for (size_t depth = 0;; ++depth) {
+    for (uint32_t i = 0; i < node->num_rules; ++i) {
+      const Rule& rule = tables.rules[tables.trie_rules[node->first_rule + i]];
+      ROBOTS_STATS_ADD(rules_evaluated, 1);
+      RobotsMatcher::MatchHierarchy* hierarchy = rule.allow ? allow : disallow;
+      RobotsMatcher::Match& match =
+          specific ? hierarchy->specific : hierarchy->global;
+      // Rules are visited out of file order, so on equal priorities the
+      // earliest line wins, like it does in RobotsMatcher. Longest-match: the
+      // priority of a rule is the length of its pattern, the same as for
+      // LongestMatchRobotsMatchStrategy.
+      if (rule.priority < match.priority() ||
+          (rule.priority == match.priority() && rule.line > match.line())) {
+        continue;
       }
-    } else {
-      assert(seen_global_agent_);
-      if (disallow_.global.priority() < priority) {
-        disallow_.global.Set(priority, line_num);
+      if (!budget->Spend(1)) return;
+      // The literal prefix is known to match, so a pattern without any
+      // wildcard or anchor does not need to be matched again.
+      if ((rule.num_segments == 1 && !rule.anchored) ||
+          RuleMatches(tables, rule, path, budget)) {
+        match.Set(rule.priority, rule.line);
       }
+      if (budget->exhausted()) return;
     }
+    if (depth == path.size()) break;
+    const unsigned char byte = path[depth];
+    const TrieNode* const children = tables.trie_nodes + node->first_child;
+    const TrieNode* const children_end = children + node->num_children;
+    node = std::lower_bound(
+        children, children_end, byte,
+        [](const TrieNode& child, unsigned char b) { return child.byte < b; });
+    if (node == children_end || node->byte != byte) break;
   }
 }
 
-int LongestMatchRobotsMatchStrategy::MatchAllow(std::string_view path,
-                                                std::string_view pattern) {
-  return Matches(path, pattern) ? pattern.length() : -1;
+RobotsMatchResult RobotsRuleSet::Match(
+    const std::vector<std::string>* user_agents, std::string_view url) const {
+  return Match(UserAgentSet(*user_agents), url);
 }
 
-int LongestMatchRobotsMatchStrategy::MatchDisallow(std::string_view path,
-                                                   std::string_view pattern) {
-  return Matches(path, pattern) ? pattern.length() : -1;
+RobotsMatchResult RobotsRuleSet::Match(const UserAgentSet& user_agents,
+                                       std::string_view url) const {
+  // The url is not normalized (escaped, percent encoded) here because the user
+  // is asked to provide it in escaped form already.
+  std::string storage;
+  return MatchPath(user_agents, PathParamsQuery(url, &storage));
 }
 
-void RobotsMatcher::HandleCrawlDelay(int line_num, std::string_view value) {
-  seen_separator_ = true;
+std::vector<RobotsMatchResult> RobotsRuleSet::MatchPerAgent(
+    const std::vector<std::string>& user_agents, std::string_view url) const {
+  std::string storage;
+  const std::string_view path = PathParamsQuery(url, &storage);
+  std::vector<RobotsMatchResult> results;
+  results.reserve(user_agents.size());
+  UserAgentSet agent;
+  for (const std::string& user_agent : user_agents) {
+    agent.Clear();
+    agent.Insert(user_agent);
+    results.push_back(MatchPath(agent, path));
+  }
+  return results;
 }
 
-void RobotsMatcher::HandleSitemap(int line_num, std::string_view value) {
-  seen_separator_ = true;
+RobotsMatchResult RobotsRuleSet::MatchPath(const UserAgentSet& user_agents,
+                                           std::string_view path) const {
+  ROBOTS_STATS_TIMER(match_nanos);
+  typedef RobotsMatcher::MatchHierarchy MatchHierarchy;
+  const Tables tables = this->tables();
+  const Group* const groups_end = tables.groups + tables.num_groups;
+
+  // Once a group for one of the agents is seen, the global rules can no longer
+  // decide the verdict, so they are only walked while none was found.
+  RobotsMatchResult result;
+  for (const Group* group = tables.groups; group != groups_end; ++group) {
+    if (GroupHasAgent(tables, *group, user_agents)) {
+      result.ever_seen_specific_agent = true;
+      break;
+    }
+  }
+
+  MatchHierarchy allow;
+  MatchHierarchy disallow;
+  RobotsMatchBudget budget(max_match_steps_);
+  for (const Group* group = tables.groups;
+       group != groups_end && !budget.exhausted(); ++group) {
+    const bool specific = result.ever_seen_specific_agent &&
+                          GroupHasAgent(tables, *group, user_agents);
+    if (!specific && (result.ever_seen_specific_agent || !group->global)) {
+      continue;
+    }
+    MatchGroup(tables, *group, path, specific, &budget, &allow, &disallow);
+  }
+  if (limit_exceeded_ || budget.exhausted()) {
+    ROBOTS_STATS_ADD(limits_exceeded, 1);
+    return RobotsMatcher::LimitExceededResult(fallback_allowed_,
+                                              result.ever_seen_specific_agent);
+  }
+
+  result.allowed = !RobotsMatcher::Disallow(allow, disallow,
+                                            result.ever_seen_specific_agent);
+  result.matching_line = RobotsMatcher::MatchingLine(
+      allow, disallow, result.ever_seen_specific_agent);
+  return result;
 }
 
-void RobotsMatcher::HandleUnknownAction(int line_num, std::string_view action,
-                                        std::string_view value) {
-  seen_separator_ = true;
+bool RobotsRuleSet::Allowed(const std::vector<std::string>* user_agents,
+                            std::string_view url) const {
+  return Match(user_agents, url).allowed;
 }
 
-void ParsedRobotsKey::Parse(std::string_view key) {
-  key_text_ = std::string_view();
-  if (KeyIsUserAgent(key)) {
-    type_ = USER_AGENT;
-  } else if (KeyIsAllow(key)) {
-    type_ = ALLOW;
-  } else if (KeyIsDisallow(key)) {
-    type_ = DISALLOW;
-  } else if (KeyIsSitemap(key)) {
-    type_ = SITEMAP;
-  }  else if (KeyIsSitemap(key)) {
-    type_ = CRAWL_DELAY;
-  } else {
-    type_ = UNKNOWN;
-    key_text_ = key;
+bool RobotsRuleSet::OneAgentAllowed(std::string_view user_agent,
+                                    std::string_view url) const {
+  UserAgentSet user_agents;
+  user_agents.Insert(user_agent);
+  return Match(user_agents, url).allowed;
+}
+
+bool RobotsRuleSet::CrawlDelay(const std::vector<std::string>* user_agents,
+                               double* seconds) const {
+  return CrawlDelay(UserAgentSet(*user_agents), seconds);
+}
+
+bool RobotsRuleSet::CrawlDelay(const UserAgentSet& user_agents,
+                               double* seconds) const {
+  const Tables tables = this->tables();
+  const Group* const groups_end = tables.groups + tables.num_groups;
+  bool ever_seen_specific_agent = false;
+  for (const Group* group = tables.groups; group != groups_end; ++group) {
+    if (GroupHasAgent(tables, *group, user_agents)) {
+      ever_seen_specific_agent = true;
+      break;
+    }
   }
+
+  double max_delay = -1;
+  for (const Group* group = tables.groups; group != groups_end; ++group) {
+    const bool applies = ever_seen_specific_agent
+                             ? GroupHasAgent(tables, *group, user_agents)
+                             : group->global != 0;
+    if (applies && group->crawl_delay > max_delay) {
+      max_delay = group->crawl_delay;
+    }
+  }
+  if (max_delay < 0) return false;
+  *seconds = max_delay;
+  return true;
 }
 
-std::string_view ParsedRobotsKey::GetUnknownText() const {
-  assert(type_ == UNKNOWN && !key_text_.empty());
-  return key_text_;
+std::vector<std::string_view> RobotsRuleSet::Sitemaps() const {
+  const Tables tables = this->tables();
+  std::vector<std::string_view> sitemaps;
+  sitemaps.reserve(tables.num_sitemaps);
+  for (uint32_t i = 0; i < tables.num_sitemaps; ++i) {
+    const Segment& sitemap = tables.sitemaps[i];
+    sitemaps.emplace_back(tables.literals + sitemap.offset, sitemap.length);
+  }
+  return sitemaps;
+}
+
+size_t RobotsRuleSet::SpaceUsed() const {
+  if (mapped_) return sizeof(*this) + mapped_size_;
+  return sizeof(*this) + groups_.capacity() * sizeof(Group) +
+         agents_.capacity() * sizeof(Agent) + rules_.capacity() * sizeof(Rule) +
+         segments_.capacity() * sizeof(Segment) +
+         trie_nodes_.capacity() * sizeof(TrieNode) +
+         trie_rules_.capacity() * sizeof(uint32_t) +
+         sitemaps_.capacity() * sizeof(Segment) + literals_.capacity();
 }
 
-bool ParsedRobotsKey::KeyIsUserAgent(std::string_view key) {
-  return (
-      boost::istarts_with(key, "user-agent") ||
-      (kAllowFrequentTypos && (boost::istarts_with(key, "useragent") ||
-                               boost::istarts_with(key, "user agent"))));
+namespace {
+
+// Header of the binary encoding of a RobotsRuleSet. The tables follow in the
+// order below, each one 8-byte aligned:
+//   Group groups[num_groups];
+//   Agent agents[num_agents];
+//   Rule rules[num_rules];
+//   Segment segments[num_segments];
+//   TrieNode trie_nodes[num_trie_nodes];
+//   uint32_t trie_rules[num_trie_rules];
+//   Segment sitemaps[num_sitemaps];
+//   char literals[literals_size];
+// The encoding is padded with zeros to a multiple of 8 bytes.
+struct RuleSetHeader {
+  uint32_t magic;
+  // Changes whenever the tables or UserAgentSet::Hash() change.
+  uint32_t version;
+  // Checksum of the encoding from 'num_groups' on.
+  uint64_t checksum;
+  uint32_t num_groups;
+  uint32_t num_agents;
+  uint32_t num_rules;
+  uint32_t num_segments;
+  uint32_t num_trie_nodes;
+  uint32_t num_trie_rules;
+  uint32_t literals_size;
+  uint32_t num_sitemaps;
+  // The RobotsLimits the rule set was compiled with that still apply to it.
+  uint64_t max_match_steps;
+  uint32_t fallback_allowed;
+  uint32_t limit_exceeded;
+};
+
+// "RBTX" when read in the byte order it was written in.
+const uint32_t kRuleSetMagic = 0x58544252;
+const uint32_t kRuleSetVersion = 3;
+const size_t kRuleSetChecksumStart = offsetof(RuleSetHeader, num_groups);
+
+// Offsets of the tables in the encoding of a RobotsRuleSet.
+struct RuleSetLayout {
+  uint64_t groups;
+  uint64_t agents;
+  uint64_t rules;
+  uint64_t segments;
+  uint64_t trie_nodes;
+  uint64_t trie_rules;
+  uint64_t sitemaps;
+  uint64_t literals;
+  uint64_t size;  // Of the whole encoding.
+};
+
+uint64_t RoundUpTo8(uint64_t n) { return (n + 7) & ~uint64_t{7}; }
+
+RuleSetLayout GetRuleSetLayout(const RuleSetHeader& header, size_t group_size,
+                               size_t agent_size, size_t rule_size,
+                               size_t segment_size, size_t trie_node_size) {
+  RuleSetLayout layout;
+  uint64_t offset = sizeof(RuleSetHeader);
+  auto place = [&offset](uint64_t count, size_t size) {
+    offset = RoundUpTo8(offset);
+    const uint64_t start = offset;
+    offset += count * size;
+    return start;
+  };
+  layout.groups = place(header.num_groups, group_size);
+  layout.agents = place(header.num_agents, agent_size);
+  layout.rules = place(header.num_rules, rule_size);
+  layout.segments = place(header.num_segments, segment_size);
+  layout.trie_nodes = place(header.num_trie_nodes, trie_node_size);
+  layout.trie_rules = place(header.num_trie_rules, sizeof(uint32_t));
+  layout.sitemaps = place(header.num_sitemaps, segment_size);
+  layout.literals = place(header.literals_size, 1);
+  layout.size = RoundUpTo8(offset);
+  return layout;
+}
+
+// Returns true if [first, first + count) is within [0, size).
+bool InRange(uint64_t first, uint64_t count, uint64_t size) {
+  return first <= size && count <= size - first;
+}
+
+}  // namespace
+
+/* static */ uint64_t RobotsRuleSet::Checksum(const char* data, size_t size) {
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ size;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 32;
+  }
+  for (; i < size; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ULL;
+  }
+  return hash;
 }
 
-bool ParsedRobotsKey::KeyIsAllow(std::string_view key) {
-  return boost::istarts_with(key, "allow");
+std::string RobotsRuleSet::ToBytes() const {
+  static_assert(sizeof(Group) == 24 && sizeof(Agent) == 16 &&
+                    sizeof(Rule) == 20 && sizeof(Segment) == 8 &&
+                    sizeof(TrieNode) == 20,
+                "RobotsRuleSet tables must not have implicit padding");
+  const Tables tables = this->tables();
+  RuleSetHeader header = {};
+  header.magic = kRuleSetMagic;
+  header.version = kRuleSetVersion;
+  header.num_groups = tables.num_groups;
+  header.num_agents = tables.num_agents;
+  header.num_rules = tables.num_rules;
+  header.num_segments = tables.num_segments;
+  header.num_trie_nodes = tables.num_trie_nodes;
+  header.num_trie_rules = tables.num_trie_rules;
+  header.num_sitemaps = tables.num_sitemaps;
+  header.literals_size = tables.literals_size;
+  header.max_match_steps = max_match_steps_;
+  header.fallback_allowed = fallback_allowed_;
+  header.limit_exceeded = limit_exceeded_;
+  const RuleSetLayout layout =
+      GetRuleSetLayout(header, sizeof(Group), sizeof(Agent), sizeof(Rule),
+                       sizeof(Segment), sizeof(TrieNode));
+
+  std::string bytes(layout.size, '\0');
+  auto copy = [&bytes](uint64_t offset, const void* data, size_t size) {
+    if (size > 0) memcpy(&bytes[offset], data, size);
+  };
+  copy(layout.groups, tables.groups, header.num_groups * sizeof(Group));
+  copy(layout.agents, tables.agents, header.num_agents * sizeof(Agent));
+  copy(layout.rules, tables.rules, header.num_rules * sizeof(Rule));
+  copy(layout.segments, tables.segments, header.num_segments * sizeof(Segment));
+  copy(layout.trie_nodes, tables.trie_nodes,
+       header.num_trie_nodes * sizeof(TrieNode));
+  copy(layout.trie_rules, tables.trie_rules,
+       header.num_trie_rules * sizeof(uint32_t));
+  copy(layout.sitemaps, tables.sitemaps,
+       header.num_sitemaps * sizeof(Segment));
+  copy(layout.literals, tables.literals, header.literals_size);
+  copy(0, &header, sizeof(header));
+  header.checksum = Checksum(bytes.data() + kRuleSetChecksumStart,
+                             bytes.size() - kRuleSetChecksumStart);
+  copy(0, &header, sizeof(header));
+  return bytes;
+}
+
+/* static */ bool RobotsRuleSet::FromBytes(std::string_view bytes,
+                                           RobotsRuleSet* rules) {
+  if (bytes.size() < sizeof(RuleSetHeader) ||
+      reinterpret_cast<uintptr_t>(bytes.data()) % 8 != 0) {
+    return false;
+  }
+  RuleSetHeader header;
+  memcpy(&header, bytes.data(), sizeof(header));
+  if (header.magic != kRuleSetMagic || header.version != kRuleSetVersion) {
+    return false;
+  }
+  const RuleSetLayout layout =
+      GetRuleSetLayout(header, sizeof(Group), sizeof(Agent), sizeof(Rule),
+                       sizeof(Segment), sizeof(TrieNode));
+  if (layout.size != bytes.size() ||
+      header.checksum != Checksum(bytes.data() + kRuleSetChecksumStart,
+                                  bytes.size() - kRuleSetChecksumStart)) {
+    return false;
+  }
+
+  Tables tables;
+  const char* const data = bytes.data();
+  tables.groups = reinterpret_cast<const Group*>(data + layout.groups);
+  tables.agents = reinterpret_cast<const Agent*>(data + layout.agents);
+  tables.rules = reinterpret_cast<const Rule*>(data + layout.rules);
+  tables.segments = reinterpret_cast<const Segment*>(data + layout.segments);
+  tables.trie_nodes =
+      reinterpret_cast<const TrieNode*>(data + layout.trie_nodes);
+  tables.trie_rules =
+      reinterpret_cast<const uint32_t*>(data + layout.trie_rules);
+  tables.sitemaps = reinterpret_cast<const Segment*>(data + layout.sitemaps);
+  tables.literals = data + layout.literals;
+  tables.num_groups = header.num_groups;
+  tables.num_agents = header.num_agents;
+  tables.num_rules = header.num_rules;
+  tables.num_segments = header.num_segments;
+  tables.num_trie_nodes = header.num_trie_nodes;
+  tables.num_trie_rules = header.num_trie_rules;
+  tables.num_sitemaps = header.num_sitemaps;
+  tables.literals_size = header.literals_size;
+
+  // The checksum only catches accidental corruption, so check that all
+  // indexes stay within their tables before trusting them.
+  for (uint32_t i = 0; i < tables.num_groups; ++i) {
+    const Group& group = tables.groups[i];
+    if (!InRange(group.first_agent, group.num_agents, tables.num_agents) ||
+        group.trie_root >= tables.num_trie_nodes) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < tables.num_agents; ++i) {
+    const Agent& agent = tables.agents[i];
+    if (!InRange(agent.offset, agent.length, tables.literals_size)) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < tables.num_rules; ++i) {
+    const Rule& rule = tables.rules[i];
+    if (rule.num_segments == 0 ||
+        !InRange(rule.first_segment, rule.num_segments, tables.num_segments)) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < tables.num_segments; ++i) {
+    const Segment& segment = tables.segments[i];
+    if (!InRange(segment.offset, segment.length, tables.literals_size)) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < tables.num_trie_nodes; ++i) {
+    const TrieNode& node = tables.trie_nodes[i];
+    if (!InRange(node.first_child, node.num_children, tables.num_trie_nodes) ||
+        !InRange(node.first_rule, node.num_rules, tables.num_trie_rules)) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < tables.num_trie_rules; ++i) {
+    if (tables.trie_rules[i] >= tables.num_rules) return false;
+  }
+  for (uint32_t i = 0; i < tables.num_sitemaps; ++i) {
+    const Segment& sitemap = tables.sitemaps[i];
+    if (!InRange(sitemap.offset, sitemap.length, tables.literals_size)) {
+      return false;
+    }
+  }
+
+  *rules = RobotsRuleSet();
+  rules->mapped_ = true;
+  rules->mapped_size_ = bytes.size();
+  rules->mapped_tables_ = tables;
+  rules->max_match_steps_ = header.max_match_steps;
+  rules->fallback_allowed_ = header.fallback_allowed != 0;
+  rules->limit_exceeded_ = header.limit_exceeded != 0;
+  return true;
 }
 
-bool ParsedRobotsKey::KeyIsDisallow(std::string_view key) {
-  return (
-      boost::istarts_with(key, "disallow") ||
-      (kAllowFrequentTypos && ((boost::istarts_with(key, "dissallow")) ||
-                               (boost::istarts_with(key, "dissalow")) ||
-                               (boost::istarts_with(key, "disalow")) ||
-                               (boost::istarts_with(key, "diasllow")) ||
-                               (boost::istarts_with(key, "disallaw")))));
+void ParsedRobotsKey::Parse(std::string_view key) {
+  key_text_ = std::string_view();
+  type_ = Classify(key);
+  if (type_ == UNKNOWN) {
+    key_text_ = key;
+  }
 }
 
-bool ParsedRobotsKey::KeyIsSitemap(std::string_view key) {
-  return ((boost::istarts_with(key, "sitemap")) ||
-          (boost::istarts_with(key, "site-map")));
+std::string_view ParsedRobotsKey::GetUnknownText() const {
+  assert(type_ == UNKNOWN && !key_text_.empty());
+  return key_text_;
 }
 
-bool ParsedRobotsKey::KeyIsCrawlDelay(std::string_view key) {
-  return (
-    boost::istarts_with(key, "crawl-delay") ||
-    (kAllowFrequentTypos && ((boost::istarts_with(key, "crawldelay")) ||
-                             (boost::istarts_with(key, "crawl delay")))));
+/* static */ ParsedRobotsKey::KeyType ParsedRobotsKey::Classify(
+    std::string_view key) {
+  // Fold only as much of the key as the longest spelling, then dispatch on its
+  // first letter to the few spellings that can match.
+  char folded[kMaxKeySpellingLength];
+  const size_t length = std::min(key.size(), kMaxKeySpellingLength);
+  if (length == 0) return UNKNOWN;
+  AsciiToLower(key.substr(0, length), folded);
+  const unsigned letter = static_cast<unsigned char>(folded[0]) - 'a';
+  if (letter >= 26) return UNKNOWN;
+
+  const KeySpellingRange& range = kKeySpellingIndex.letters[letter];
+  for (size_t i = range.begin; i < range.end; ++i) {
+    const KeySpelling& spelling = kKeySpellings[i];
+    if (spelling.is_typo && !kAllowFrequentTypos) continue;
+    if (spelling.text.size() <= length &&
+        memcmp(folded, spelling.text.data(), spelling.text.size()) == 0) {
+      return spelling.type;
+    }
+  }
+  return UNKNOWN;
 }
 
 }  // namespace googlebot
@@ -29,17 +29,89 @@
 // found at:
 //   https://developers.google.com/search/reference/robots_txt
 //
-// This library provides a low-level parser for robots.txt (ParseRobotsTxt()),
-// and a matcher for URLs against a robots.txt (class RobotsMatcher).
+// This library provides a low-level parser for robots.txt (ParseRobotsTxt(),
+// or class RobotsStreamParser for bodies received in chunks), and a matcher for
+// URLs against a robots.txt (class RobotsMatcher).
 
 #ifndef THIRD_PARTY_ROBOTSTXT_ROBOTS_H__
 #define THIRD_PARTY_ROBOTSTXT_ROBOTS_H__
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <string_view>
+#include <type_traits>
 
 namespace googlebot {
+
+// RobotsStats - counters of the work done by the library, to find what makes
+// some robots.txt files or URLs slow.
+//
+// They are only collected when the library is built with ROBOTS_ENABLE_STATS
+// defined; otherwise they cost nothing and stay zero. The work of all the
+// calls made on a thread while a RobotsStatsScope is alive, whether through
+// ParseRobotsTxt(), RobotsMatcher or RobotsRuleSet, is added to its stats:
+//
+//   RobotsStats stats;
+//   {
+//     RobotsStatsScope scope(&stats);
+//     matcher.OneAgentAllowedByRobots(robots_body, "FooBot", url);
+//   }
+//   ExportToMetrics(stats);
+struct RobotsStats {
+#ifdef ROBOTS_ENABLE_STATS
+  static constexpr bool kEnabled = true;
+#else
+  static constexpr bool kEnabled = false;
+#endif
+
+  uint64_t lines_parsed = 0;
+  // Bytes ignored past the end of lines longer than the parser accepts.
+  uint64_t truncated_bytes = 0;
+  // Values of allow and disallow lines that had to be escaped.
+  uint64_t escaped_values = 0;
+  // Rules whose pattern was matched against a path. For a rule set, the rules
+  // its index did not rule out.
+  uint64_t rules_evaluated = 0;
+  // Pattern matches with wildcards or anchors, and the number of bytes of the
+  // paths they scanned.
+  uint64_t pattern_matches = 0;
+  uint64_t pattern_bytes_scanned = 0;
+  // Wall time spent parsing, handler callbacks included, and in the matching
+  // calls of RobotsMatcher and RobotsRuleSet. RobotsMatcher parses the
+  // robots.txt while matching, so its parse time is part of its match time.
+  uint64_t parse_nanos = 0;
+  uint64_t match_nanos = 0;
+  // Verdicts replaced by the fallback verdict of RobotsLimits.
+  uint64_t limits_exceeded = 0;
+
+  void Clear() { *this = RobotsStats(); }
+  // Adds the counters of 'other' to these ones.
+  void Add(const RobotsStats& other);
+};
+
+// Collects the stats of the calls made on the current thread into '*stats' for
+// its lifetime. Scopes nest: an inner scope collects instead of the outer one
+// until it ends.
+class RobotsStatsScope {
+ public:
+#ifdef ROBOTS_ENABLE_STATS
+  explicit RobotsStatsScope(RobotsStats* stats);
+  ~RobotsStatsScope();
+#else
+  explicit RobotsStatsScope(RobotsStats* stats) {}
+#endif
+
+  // Disallow copying and assignment.
+  RobotsStatsScope(const RobotsStatsScope&) = delete;
+  RobotsStatsScope& operator=(const RobotsStatsScope&) = delete;
+
+#ifdef ROBOTS_ENABLE_STATS
+ private:
+  RobotsStats* const previous_;
+#endif
+};
+
 // Handler for directives found in robots.txt. These callbacks are called by
 // ParseRobotsTxt() in the sequence they have been found in the file.
 class RobotsParseHandler {
@@ -64,6 +136,11 @@ class RobotsParseHandler {
   // Any other unrecognized name/value pairs.
   virtual void HandleUnknownAction(int line_num, std::string_view action,
                                    std::string_view value) = 0;
+
+  // Called after each line. Returning true stops the parse: no more
+  // directives are emitted, but HandleRobotsEnd() still is. 'max_bytes_left'
+  // bounds the size of the rest of the body, or is SIZE_MAX if unknown.
+  virtual bool IsDone(size_t max_bytes_left) { return false; }
 };
 
 // Parses body of a robots.txt and emits parse callbacks. This will accept
@@ -74,38 +151,408 @@ class RobotsParseHandler {
 void ParseRobotsTxt(std::string_view robots_body,
                     RobotsParseHandler* parse_callback);
 
-// RobotsMatcher - matches robots.txt against URLs.
+// Same as above, but calls the methods of 'handler' directly instead of
+// through the virtual methods of RobotsParseHandler, so that they can be
+// inlined. 'Handler' must have all the methods of RobotsParseHandler, IsDone()
+// included, but does not need to derive from it; if it does, mark it or its
+// methods final. Handler pointers, as in the overload above, are not handlers.
+template <typename Handler,
+          typename = std::enable_if_t<!std::is_pointer<Handler>::value>>
+void ParseRobotsTxt(std::string_view robots_body, Handler& handler);
+
+namespace internal {
+
+// The directive of a robots.txt line, see ParseRobotsLine().
+struct RobotsDirective {
+  enum Type {
+    NONE,
+    USER_AGENT,
+    SITEMAP,
+    ALLOW,
+    DISALLOW,
+    CRAWL_DELAY,
+    UNKNOWN,
+  };
+  Type type = NONE;
+  // The key as written, for UNKNOWN directives.
+  std::string_view unknown_key;
+  std::string_view value;
+};
+
+// Parses a robots.txt line, without its end of line, into its directive. The
+// value of allow and disallow lines is escaped into '*scratch' if needed.
+RobotsDirective ParseRobotsLine(std::string_view line, std::string* scratch);
+
+// Returns the first end of line ('\n' or '\r') in [begin, end), or 'end'.
+const char* FindRobotsLineEnd(const char* begin, const char* end);
+
+// Adds its lifetime to the RobotsStats::parse_nanos being collected, if any.
+class ParseTimer {
+ public:
+#ifdef ROBOTS_ENABLE_STATS
+  ParseTimer();
+  ~ParseTimer();
+
+ private:
+  RobotsStats* const stats_;
+  int64_t start_nanos_;
+#else
+  ParseTimer() {}
+#endif
+};
+
+// The implementation of ParseRobotsTxt(), a class to be a friend of handlers
+// with private or protected methods.
+template <typename Handler>
+class RobotsParser {
+ public:
+  // Parses 'robots_body' like RobotsStreamParser would, as a single chunk.
+  static void Parse(std::string_view robots_body, Handler* handler,
+                    std::string* scratch) {
+    ParseTimer timer;
+    handler->HandleRobotsStart();
+    // Google-specific optimization: UTF-8 byte order marks should never
+    // appear in a robots.txt file, but they do nevertheless. Skipping possible
+    // BOM-prefix in the first bytes of the input.
+    static const char kUtfBom[] = "\xEF\xBB\xBF";
+    size_t bom_size = 0;
+    while (bom_size < 3 && bom_size < robots_body.size() &&
+           robots_body[bom_size] == kUtfBom[bom_size]) {
+      ++bom_size;
+    }
+    const char* pos = robots_body.data() + bom_size;
+    const char* const end = robots_body.data() + robots_body.size();
+    int line_num = 0;
+    bool last_was_carriage_return = false;
+    for (;;) {
+      const char* const line_end = FindRobotsLineEnd(pos, end);
+      if (line_end == end) break;
+      // Only emit an empty line if this was not due to the second character
+      // of the DOS line-ending \r\n .
+      if (line_end != pos || !last_was_carriage_return || *line_end != '\n') {
+        Emit(++line_num, std::string_view(pos, line_end - pos), handler,
+             scratch);
+      }
+      last_was_carriage_return = (*line_end == '\r');
+      pos = line_end + 1;
+      if (handler->IsDone(end - pos)) {
+        handler->HandleRobotsEnd();
+        return;
+      }
+    }
+    Emit(++line_num, std::string_view(pos, end - pos), handler, scratch);
+    handler->HandleRobotsEnd();
+  }
+
+  // Parses line 'line_num' and emits its directive, if any, to 'handler'.
+  static void Emit(int line_num, std::string_view line, Handler* handler,
+                   std::string* scratch) {
+    const RobotsDirective directive = ParseRobotsLine(line, scratch);
+    switch (directive.type) {
+      case RobotsDirective::NONE:
+        break;
+      case RobotsDirective::USER_AGENT:
+        handler->HandleUserAgent(line_num, directive.value);
+        break;
+      case RobotsDirective::ALLOW:
+        handler->HandleAllow(line_num, directive.value);
+        break;
+      case RobotsDirective::DISALLOW:
+        handler->HandleDisallow(line_num, directive.value);
+        break;
+      case RobotsDirective::SITEMAP:
+        handler->HandleSitemap(line_num, directive.value);
+        break;
+      case RobotsDirective::CRAWL_DELAY:
+        handler->HandleCrawlDelay(line_num, directive.value);
+        break;
+      case RobotsDirective::UNKNOWN:
+        handler->HandleUnknownAction(line_num, directive.unknown_key,
+                                     directive.value);
+        break;
+        // No default case to have the compiler warn about new values.
+    }
+  }
+};
+
+}  // namespace internal
+
+template <typename Handler, typename>
+void ParseRobotsTxt(std::string_view robots_body, Handler& handler) {
+  std::string scratch;
+  internal::RobotsParser<Handler>::Parse(robots_body, &handler, &scratch);
+}
+
+// RobotsStreamParser - parses a robots.txt body that arrives in chunks.
+//
+// The handler receives the same callbacks, in the same order, as from
+// ParseRobotsTxt() on the concatenation of all the chunks. Each line is emitted
+// as soon as it is complete: only a line split between chunks is buffered, and
+// only up to the length past which the parser ignores characters anyway.
+//
+// Example:
+//
+//   RobotsStreamParser parser(&handler);
+//   while (ReadChunk(&chunk)) parser.Feed(chunk);
+//   parser.Finish();
+class RobotsStreamParser {
+ public:
+  explicit RobotsStreamParser(RobotsParseHandler* handler);
+
+  // Disallow copying and assignment.
+  RobotsStreamParser(const RobotsStreamParser&) = delete;
+  RobotsStreamParser& operator=(const RobotsStreamParser&) = delete;
+
+  // Parses the next chunk of the body. The first call also calls
+  // HandleRobotsStart(). 'chunk' only needs to stay valid during the call.
+  void Feed(std::string_view chunk);
+
+  // Parses the last line of the body and calls HandleRobotsEnd(). Feed() must
+  // not be called after.
+  void Finish();
+  // Same as Feed(last_chunk) followed by Finish(), without buffering the last
+  // line.
+  void Finish(std::string_view last_chunk);
+
+  // Stops parsing, e.g. from a callback once the handler has seen what it
+  // needed: no more lines are emitted, and Finish() only calls
+  // HandleRobotsEnd().
+  void Stop() { stopped_ = true; }
+  bool stopped() const { return stopped_; }
+
+  // Starts parsing a new body with the same handler, reusing the buffers
+  // allocated for the previous ones.
+  void Reset();
+
+ private:
+  // Emits the complete lines of 'chunk', and buffers the rest. The rest is
+  // emitted as the last line if 'is_last'.
+  void Consume(std::string_view chunk, bool is_last);
+  void EmitLine(std::string_view line);
+  // Buffers as much of 'bytes' as may still matter in 'partial_line_'.
+  void AppendToPartialLine(std::string_view bytes);
+
+  RobotsParseHandler* const handler_;
+  int line_num_ = 0;
+  // Number of bytes of the UTF-8 byte order mark seen at the start of the
+  // body, or 3 once the BOM is skipped or known to be absent.
+  size_t bom_pos_ = 0;
+  bool last_was_carriage_return_ = false;
+  bool started_ = false;
+  bool finished_ = false;
+  bool stopped_ = false;
+  // The start of the current line, when it began in a previous chunk.
+  std::string partial_line_;
+  // Reused for all the values escaped by MaybeEscapePattern().
+  std::string escape_scratch_;
+};
+
+// UserAgentSet - the user agents robots.txt groups are matched against.
+//
+// Agents are lowercased and hashed once, when added. Testing whether the agent
+// of a user-agent line is in the set then takes a single case-folding pass
+// over that agent, however many agents the set has. Like for user-agent lines,
+// agents are compared case-insensitively. Used by both RobotsMatcher and
+// RobotsRuleSet.
+class UserAgentSet {
+ public:
+  UserAgentSet() = default;
+  explicit UserAgentSet(const std::vector<std::string>& user_agents);
+
+  // Replaces the agents of the set with 'user_agents', reusing its storage.
+  void Assign(const std::vector<std::string>& user_agents);
+
+  // Adds 'user_agent' to the set, unless it is already there.
+  void Insert(std::string_view user_agent);
+
+  // Removes all the agents, keeping the storage for the next ones.
+  void Clear() { size_ = 0; }
+
+  // Returns true if 'user_agent' is in the set, ignoring case.
+  bool Contains(std::string_view user_agent) const;
+
+  // Returns the position of 'user_agent' among the agents of the set, in the
+  // order they were added, or -1 if it is not in the set.
+  int Find(std::string_view user_agent) const;
+
+  // Returns true if both sets have an agent in common.
+  bool Intersects(const UserAgentSet& other) const;
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+  // Approximate number of bytes of memory used by the set, beyond its own
+  // size.
+  size_t SpaceUsedExcludingSelf() const;
+
+ private:
+  struct Agent {
+    uint64_t hash;          // Hash() of the agent.
+    std::string lowercase;  // The agent, lowercased.
+  };
+
+  // Case-insensitive hash of 'user_agent'.
+  static uint64_t Hash(std::string_view user_agent);
+
+  // Returns the position of the agent of the set that has 'hash' and is equal
+  // to 'user_agent', ignoring case, or -1.
+  int Find(std::string_view user_agent, uint64_t hash) const;
+
+  friend class RobotsRuleSet;
+
+  // Only the first 'size_' agents are in the set. The others are kept for
+  // Assign() to reuse their strings.
+  std::vector<Agent> agents_;
+  size_t size_ = 0;
+};
+
+// RobotsLimits - bounds on the work of checking URLs against a robots.txt.
+//
+// Matching costs grow with the size of the robots.txt and of its patterns, so
+// a hostile one, e.g. with thousands of "disallow: /*a*a*a*a..." lines, can
+// stall the thread checking long URLs against it. A check that goes past any
+// of these limits stops early, and its verdict is the fallback one, with
+// RobotsMatchResult::limit_exceeded set.
+//
+// A limit of zero is no limit, which is the default for all of them.
+struct RobotsLimits {
+  // Size of the robots.txt body.
+  size_t max_body_bytes = 0;
+  // Allow and disallow lines in the robots.txt, in all its groups.
+  size_t max_rules = 0;
+  // Wildcards ('*') in a single allow or disallow pattern.
+  size_t max_wildcards = 0;
+  // Steps spent matching the patterns of the robots.txt against one URL: one
+  // per pattern, plus one per byte of the path compared to its literal parts.
+  // RobotsRuleSet, which skips the patterns its index rules out, takes fewer
+  // steps than RobotsMatcher for the same URL.
+  uint64_t max_match_steps = 0;
+  // Verdict of the URLs whose check goes past a limit. Disallowing them is the
+  // conservative choice for a crawler.
+  bool fallback_allowed = false;
+};
+
+// The steps left to match patterns against one path, see
+// RobotsLimits::max_match_steps.
+class RobotsMatchBudget {
+ public:
+  // A budget of 'max_steps' steps, unlimited if 0.
+  explicit RobotsMatchBudget(uint64_t max_steps = 0) { Reset(max_steps); }
+
+  void Reset(uint64_t max_steps) {
+    steps_left_ = max_steps != 0 ? max_steps : UINT64_MAX;
+    exhausted_ = false;
+  }
+
+  // Spends 'steps'. Returns false if fewer were left, in which case the budget
+  // is exhausted and any match in progress must give up.
+  bool Spend(uint64_t steps) {
+    if (steps > steps_left_) {
+      steps_left_ = 0;
+      exhausted_ = true;
+      return false;
+    }
+    steps_left_ -= steps;
+    return true;
+  }
+
+  bool exhausted() const { return exhausted_; }
+
+ private:
+  uint64_t steps_left_;
+  bool exhausted_;
+};
+
+// Verdict for one URL, as reported by RobotsMatcher after an AllowedByRobots()
+// call through disallow(), matching_line() and ever_seen_specific_agent().
+struct RobotsMatchResult {
+  bool allowed = true;
+  int matching_line = 0;
+  bool ever_seen_specific_agent = false;
+  // True if the check went past one of the RobotsLimits, in which case
+  // 'allowed' is their fallback verdict and 'matching_line' is 0.
+  bool limit_exceeded = false;
+};
+
+// A RobotsMatchStrategy defines a strategy for matching individual lines in a
+// robots.txt file, as the template parameter of BasicRobotsMatcher. Each of
+// its static Match* methods should return a match priority, which is
+// interpreted as:
+//
+// match priority < 0:
+//    No match.
 //
-// The Matcher uses a default match strategy for Allow/Disallow patterns which
-// is the official way of Google crawler to match robots.txt. It is also
-// possible to provide a custom match strategy.
+// match priority == 0:
+//    Match, but treat it as if matched an empty pattern.
+//
+// match priority > 0:
+//    Match.
+//
+// The highest priority wins, and on equal priorities the earliest line, with
+// allow winning over disallow. Matching gives up, as if there was no match,
+// once 'budget' runs out. CanBeOutranked() returns true if a rule from the
+// rest of the robots.txt, at most 'max_bytes_left' bytes long, may get a
+// higher priority than 'priority', for RobotsMatcher::set_early_exit().
+class RobotsMatchStrategy {
+ protected:
+  // Implements robots.txt pattern matching.
+  static bool Matches(std::string_view path, std::string_view pattern,
+                      RobotsMatchBudget* budget);
+};
+
+// The default matching strategy is longest-match as opposed to the former
+// internet draft that provisioned first-match strategy. Analysis shows that
+// longest-match, while more restrictive for crawlers, is what webmasters
+// assume when writing directives. For example, in case of conflicting matches
+// (both Allow and Disallow), the longest match is the one the user wants. For
+// example, in case of a robots.txt file that has the following rules
+//   Allow: /
+//   Disallow: /cgi-bin
+// it's pretty obvious what the webmaster wants: they want to allow crawl of
+// every URI except /cgi-bin. However, according to the expired internet
+// standard, crawlers should be allowed to crawl everything with such a rule.
+class LongestMatchRobotsMatchStrategy : public RobotsMatchStrategy {
+ public:
+  static int MatchAllow(std::string_view path, std::string_view pattern,
+                        int line_num, RobotsMatchBudget* budget);
+  static int MatchDisallow(std::string_view path, std::string_view pattern,
+                           int line_num, RobotsMatchBudget* budget);
+  static bool CanBeOutranked(int priority, size_t max_bytes_left);
+};
+
+// The first-match strategy of the former internet draft: the first line
+// matching the path decides, whatever the length of its pattern. For audits of
+// crawlers still following it.
+class FirstMatchRobotsMatchStrategy : public RobotsMatchStrategy {
+ public:
+  static int MatchAllow(std::string_view path, std::string_view pattern,
+                        int line_num, RobotsMatchBudget* budget);
+  static int MatchDisallow(std::string_view path, std::string_view pattern,
+                           int line_num, RobotsMatchBudget* budget);
+  static bool CanBeOutranked(int priority, size_t max_bytes_left);
+};
+
+// BasicRobotsMatcher - matches robots.txt against URLs.
+//
+// The Matcher uses the match strategy 'Strategy' for Allow/Disallow patterns,
+// resolved at compile time. RobotsMatcher uses the default one, which is the
+// official way of Google crawler to match robots.txt. BasicRobotsMatcher is
+// only instantiated for the strategies above, in robots.cc.
 //
 // The entry point for the user is to call one of the *AllowedByRobots()
 // methods that return directly if a URL is being allowed according to the
 // robots.txt and the crawl agent.
 // The RobotsMatcher can be re-used for URLs/robots.txt but is not thread-safe.
-class RobotsMatchStrategy;
-class RobotsMatcher : protected RobotsParseHandler {
+template <typename Strategy>
+class BasicRobotsMatcher : protected RobotsParseHandler {
  public:
-  // Create a RobotsMatcher with the default matching strategy. The default
-  // matching strategy is longest-match as opposed to the former internet draft
-  // that provisioned first-match strategy. Analysis shows that longest-match,
-  // while more restrictive for crawlers, is what webmasters assume when writing
-  // directives. For example, in case of conflicting matches (both Allow and
-  // Disallow), the longest match is the one the user wants. For example, in
-  // case of a robots.txt file that has the following rules
-  //   Allow: /
-  //   Disallow: /cgi-bin
-  // it's pretty obvious what the webmaster wants: they want to allow crawl of
-  // every URI except /cgi-bin. However, according to the expired internet
-  // standard, crawlers should be allowed to crawl everything with such a rule.
-  RobotsMatcher();
-
-  ~RobotsMatcher() override;
+  BasicRobotsMatcher();
+
+  ~BasicRobotsMatcher() override;
 
   // Disallow copying and assignment.
-  RobotsMatcher(const RobotsMatcher&) = delete;
-  RobotsMatcher& operator=(const RobotsMatcher&) = delete;
+  BasicRobotsMatcher(const BasicRobotsMatcher&) = delete;
+  BasicRobotsMatcher& operator=(const BasicRobotsMatcher&) = delete;
 
   // Verifies that the given user agent is valid to be matched against
   // robots.txt. Valid user agent strings only contain the characters
@@ -116,13 +563,38 @@ class RobotsMatcher : protected RobotsParseHandler {
   // "user_agents" vector. 'url' must be %-encoded according to RFC3986.
   bool AllowedByRobots(std::string_view robots_body,
                        const std::vector<std::string>* user_agents,
-                       const std::string& url);
+                       std::string_view url);
+
+  // Same as above, for agents already in a UserAgentSet.
+  bool AllowedByRobots(std::string_view robots_body,
+                       const UserAgentSet& user_agents, std::string_view url);
 
   // Do robots check for 'url' when there is only one user agent. 'url' must
   // be %-encoded according to RFC3986.
   bool OneAgentAllowedByRobots(std::string_view robots_txt,
-                               const std::string& user_agent,
-                               const std::string& url);
+                               std::string_view user_agent,
+                               std::string_view url);
+
+  // Matches every URL of 'urls' against a single parse of 'robots_body', and
+  // returns one verdict per URL, in the same order. Each verdict is the same as
+  // the one AllowedByRobots() would return for that URL, along with the
+  // matching line. The accessors below do not report on any of these URLs.
+  std::vector<RobotsMatchResult> AllowedByRobotsBatch(
+      std::string_view robots_body,
+      const std::vector<std::string>* user_agents,
+      const std::vector<std::string>& urls);
+  std::vector<RobotsMatchResult> AllowedByRobotsBatch(
+      std::string_view robots_body, const UserAgentSet& user_agents,
+      const std::vector<std::string>& urls);
+
+  // Matches 'url' for each agent of 'user_agents' on its own, against a single
+  // parse of 'robots_body', and returns one verdict per agent, in the same
+  // order. Each verdict is the same as the one OneAgentAllowedByRobots() would
+  // return for that agent. The accessors below do not report on any of these
+  // agents.
+  std::vector<RobotsMatchResult> AllowedByRobotsPerAgent(
+      std::string_view robots_body, const std::vector<std::string>& user_agents,
+      std::string_view url);
 
   // Returns true if we are disallowed from crawling a matching URI.
   bool disallow() const;
@@ -139,21 +611,45 @@ class RobotsMatcher : protected RobotsParseHandler {
   // Returns the line that matched or 0 if none matched.
   const int matching_line() const;
 
+  // When set, AllowedByRobots() stops parsing as soon as no line left in the
+  // body can change disallow() or matching_line(). Off by default.
+  void set_early_exit(bool early_exit) { early_exit_ = early_exit; }
+
+  // Bounds the work of the *AllowedByRobots() calls. None by default.
+  void set_limits(const RobotsLimits& limits) { limits_ = limits; }
+
+  // Returns true iff, when AllowedByRobots() was called, the check went past
+  // one of the limits, so that disallow() reports their fallback verdict.
+  bool limit_exceeded() const;
+
+  // Number of verdicts, since the matcher was created, that were the fallback
+  // verdict of the limits: one per AllowedByRobots() call, and one per URL or
+  // agent of the AllowedByRobotsBatch() and AllowedByRobotsPerAgent() calls.
+  uint64_t num_limits_exceeded() const { return num_limits_exceeded_; }
+
  protected:
+  // RobotsRuleSet shares the match bookkeeping and the verdict logic below, so
+  // that both give the same answers.
+  friend class RobotsRuleSet;
+  // Parse() calls the callbacks below directly, not through the vtable.
+  friend class internal::RobotsParser<BasicRobotsMatcher>;
+
   // Parse callbacks.
   // Protected because used in unittest. Never override RobotsMatcher, implement
   // googlebot::RobotsParseHandler instead.
-  void HandleRobotsStart() override;
-  void HandleRobotsEnd() override {}
+  void HandleRobotsStart() final;
+  void HandleRobotsEnd() final {}
 
-  void HandleUserAgent(int line_num, std::string_view value) override;
-  void HandleAllow(int line_num, std::string_view value) override;
-  void HandleDisallow(int line_num, std::string_view value) override;
-  void HandleCrawlDelay(int line_num, std::string_view value) override;
+  void HandleUserAgent(int line_num, std::string_view value) final;
+  void HandleAllow(int line_num, std::string_view value) final;
+  void HandleDisallow(int line_num, std::string_view value) final;
+  void HandleCrawlDelay(int line_num, std::string_view value) final;
 
-  void HandleSitemap(int line_num, std::string_view value) override;
+  void HandleSitemap(int line_num, std::string_view value) final;
   void HandleUnknownAction(int line_num, std::string_view action,
-                           std::string_view value) override;
+                           std::string_view value) final;
+
+  bool IsDone(size_t max_bytes_left) final;
 
  protected:
   // Extract the matchable part of a user agent string, essentially stopping at
@@ -163,8 +659,11 @@ class RobotsMatcher : protected RobotsParseHandler {
 
   // Initialize next path and user-agents to check. Path must contain only the
   // path, params, and query (if any) of the url and must start with a '/'.
-  void InitUserAgentsAndPath(const std::vector<std::string>* user_agents,
-                             const char* path);
+  void InitUserAgentsAndPath(const UserAgentSet* user_agents,
+                             std::string_view path);
+
+  // Parses 'robots_body' into this matcher, after InitUserAgentsAndPath().
+  void Parse(std::string_view robots_body);
 
   // Returns true if any user-agent was seen.
   bool seen_any_agent() const {
@@ -221,6 +720,37 @@ class RobotsMatcher : protected RobotsParseHandler {
       specific.Clear();
     }
   };
+
+  // Verdict logic behind disallow() and matching_line(), given the match
+  // scores of a whole robots.txt.
+  static bool Disallow(const MatchHierarchy& allow,
+                       const MatchHierarchy& disallow,
+                       bool ever_seen_specific_agent);
+  static int MatchingLine(const MatchHierarchy& allow,
+                          const MatchHierarchy& disallow,
+                          bool ever_seen_specific_agent);
+
+  // Returns the match score of the Allow (resp. Disallow) pattern 'value' of
+  // line 'line_num' against 'path', or -1 if it does not match or 'budget'
+  // runs out.
+  int MatchAllowPriority(std::string_view path, std::string_view value,
+                         int line_num, RobotsMatchBudget* budget);
+  int MatchDisallowPriority(std::string_view path, std::string_view value,
+                            int line_num, RobotsMatchBudget* budget);
+
+  // Counts the rule 'value' against the limits. Returns false if it goes past
+  // them, and the rest of the robots.txt must be ignored.
+  bool CheckRuleLimits(std::string_view value);
+
+  // Returns the result of a check that went past the limits.
+  static RobotsMatchResult LimitExceededResult(bool fallback_allowed,
+                                               bool ever_seen_specific_agent);
+
+  // Updates 'hierarchy' with a match of score 'priority' found at 'line_num',
+  // as a specific match if 'specific' and a global one otherwise.
+  static void RecordMatch(int priority, int line_num, bool specific,
+                          MatchHierarchy* hierarchy);
+
   MatchHierarchy allow_;       // Characters of 'url' matching Allow.
   MatchHierarchy disallow_;    // Characters of 'url' matching Disallow.
 
@@ -229,14 +759,273 @@ class RobotsMatcher : protected RobotsParseHandler {
   bool ever_seen_specific_agent_;  // True if we ever saw a block for our agent.
   bool seen_separator_;            // True if saw any key: value pair.
 
-  // The path we want to pattern match. Not owned and only a valid pointer
-  // during the lifetime of *AllowedByRobots calls.
-  const char* path_;
+  // The path we want to pattern match. Not owned and only valid during the
+  // lifetime of *AllowedByRobots calls.
+  std::string_view path_;
   // The User-Agents we are interested in. Not owned and only a valid
   // pointer during the lifetime of *AllowedByRobots calls.
-  const std::vector<std::string>* user_agents_;
+  const UserAgentSet* user_agents_;
+  // Holds the agents of the *AllowedByRobots calls given a vector of agents.
+  UserAgentSet user_agent_set_;
+
+  // Match state of one of the URLs of an AllowedByRobotsBatch() call.
+  struct UrlMatchState {
+    std::string_view path;
+    // Holds 'path' when it is not a part of its URL.
+    std::string path_storage;
+    MatchHierarchy allow;
+    MatchHierarchy disallow;
+    RobotsMatchBudget budget;
+  };
+  // The URLs matched instead of 'path_' during AllowedByRobotsBatch() calls.
+  // Not owned and nullptr outside of them.
+  std::vector<UrlMatchState>* batch_;
+  // Storage of 'batch_', kept between calls to reuse its allocations.
+  std::vector<UrlMatchState> batch_storage_;
+
+  // Match state of one of the agents of an AllowedByRobotsPerAgent() call.
+  struct AgentMatchState {
+    bool seen_specific_agent = false;
+    bool ever_seen_specific_agent = false;
+    MatchHierarchy allow;
+    MatchHierarchy disallow;
+  };
+  // The agents matched on their own during AllowedByRobotsPerAgent() calls,
+  // indexed by their position in 'user_agents_'. Not owned and nullptr outside
+  // of them.
+  std::vector<AgentMatchState>* per_agent_;
+
+  // See set_early_exit().
+  bool early_exit_;
+
+  // See set_limits(). The allow and disallow lines seen so far, whether the
+  // robots.txt went past the limits, and the match budget of 'path_'.
+  RobotsLimits limits_;
+  size_t num_rules_;
+  bool body_limit_exceeded_;
+  RobotsMatchBudget budget_;
+  uint64_t num_limits_exceeded_;
+
+  // Buffers reused from one call to the next, so that a long-lived matcher
+  // stops allocating memory once they are large enough: the escaped values of
+  // the parser, the path matched when it is not a part of its URL, the state
+  // of the agents of AllowedByRobotsPerAgent(), and the rewritten index.htm
+  // patterns.
+  std::string escape_scratch_;
+  std::string path_storage_;
+  std::vector<AgentMatchState> per_agent_storage_;
+  std::string index_pattern_;
+};
+
+extern template class BasicRobotsMatcher<LongestMatchRobotsMatchStrategy>;
+extern template class BasicRobotsMatcher<FirstMatchRobotsMatchStrategy>;
+
+// The matcher Google crawler uses.
+using RobotsMatcher = BasicRobotsMatcher<LongestMatchRobotsMatchStrategy>;
+// A matcher following the first-match strategy of the former internet draft.
+using FirstMatchRobotsMatcher =
+    BasicRobotsMatcher<FirstMatchRobotsMatchStrategy>;
+
+// RobotsRuleSet - a robots.txt compiled for matching many URLs.
+//
+// RobotsMatcher parses the whole robots.txt body again on every
+// *AllowedByRobots() call. A RobotsRuleSet is built once from a body, keeping
+// the Allow/Disallow rules grouped by user-agent group, and then answers any
+// number of queries by looking only at the groups relevant to the queried user
+// agents. The answers are the same as the ones of RobotsMatcher.
+//
+// A RobotsRuleSet is immutable once built, so it can be shared between threads.
+class RobotsRuleSet {
+ public:
+  // Creates an empty rule set, which allows everything.
+  RobotsRuleSet() = default;
+
+  // Parses 'robots_body' with ParseRobotsTxt() and compiles its rules.
+  explicit RobotsRuleSet(std::string_view robots_body);
+
+  // Same as above, bounding the work of compiling the robots.txt and matching
+  // URLs against it by 'limits'. If the robots.txt goes past them, nothing of
+  // it is kept, and all URLs get the fallback verdict.
+  RobotsRuleSet(std::string_view robots_body, const RobotsLimits& limits);
+
+  // Returns true iff 'url' is allowed to be fetched by any member of the
+  // "user_agents" vector. 'url' must be %-encoded according to RFC3986.
+  bool Allowed(const std::vector<std::string>* user_agents,
+               std::string_view url) const;
+
+  // Same as Allowed() when there is only one user agent.
+  bool OneAgentAllowed(std::string_view user_agent,
+                       std::string_view url) const;
+
+  // Same as Allowed(), but also reports the matching line and whether the
+  // robots.txt referred explicitly to one of the user agents.
+  RobotsMatchResult Match(const std::vector<std::string>* user_agents,
+                          std::string_view url) const;
+  RobotsMatchResult Match(const UserAgentSet& user_agents,
+                          std::string_view url) const;
+
+  // Returns the result of Match() for each agent of 'user_agents' on its own,
+  // in the same order.
+  std::vector<RobotsMatchResult> MatchPerAgent(
+      const std::vector<std::string>& user_agents,
+      std::string_view url) const;
+
+  // Gets the crawl-delay of 'user_agents', in seconds, into '*seconds'. It
+  // comes from the same groups as the rules used by Match(): the groups of
+  // these agents if the robots.txt has any, the global ones otherwise. The
+  // first valid crawl-delay of a group is its own, and the largest one of the
+  // groups is returned. Returns false if none of the groups has any.
+  bool CrawlDelay(const std::vector<std::string>* user_agents,
+                  double* seconds) const;
+  bool CrawlDelay(const UserAgentSet& user_agents, double* seconds) const;
+
+  // Returns the URLs of the sitemap lines, in file order. They are views into
+  // the rule set, valid as long as it is.
+  std::vector<std::string_view> Sitemaps() const;
+
+  // Returns true if the robots.txt went past the limits the rule set was
+  // compiled with.
+  bool limit_exceeded() const { return limit_exceeded_; }
+
+  // Approximate number of bytes of memory used by the rule set.
+  size_t SpaceUsed() const;
+
+  // Encodes the rule set in a flat, versioned binary format, that FromBytes()
+  // can query in place. The encoding is in host byte order.
+  std::string ToBytes() const;
+
+  // Loads a rule set encoded by ToBytes(), e.g. from a memory-mapped file, into
+  // 'rules'. Nothing is copied: 'rules' queries 'bytes' directly, so 'bytes'
+  // must outlive it, and must be 8-byte aligned. Returns false, leaving 'rules'
+  // unchanged, if 'bytes' is not a valid encoding from this version of the
+  // library (wrong magic, version, size or checksum, or indexes out of range).
+  static bool FromBytes(std::string_view bytes, RobotsRuleSet* rules);
+
+ private:
+  class Builder;
+  class SegmentIterator;
+  // Merges the tables of many rule sets, and matches against views of them.
+  friend class RobotsBulkIndex;
+
+  // A compiled rule set is the flat tables below, which are also, as is, its
+  // binary encoding. Their layout is fixed and free of implicit padding.
+
+  // The rules following one or more consecutive user-agent lines.
+  struct Group {
+    uint32_t global;       // Non-zero if one of the agents is '*'.
+    uint32_t first_agent;  // Specific agents of the group, in 'agents'.
+    uint32_t num_agents;
+    uint32_t trie_root;    // Index of the rules of the group in 'trie_nodes'.
+    double crawl_delay;    // In seconds, negative if the group has none.
+  };
+
+  // A specific user agent of a group, lowercased in 'literals'.
+  struct Agent {
+    uint64_t hash;  // UserAgentSet::Hash() of the agent.
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  // An Allow/Disallow pattern compiled for matching: the literal segments
+  // between its '*' wildcards, and whether it ends with a '$' anchor.
+  struct Rule {
+    int32_t line;
+    int32_t priority;        // Length of the pattern as written.
+    uint32_t first_segment;  // Segments are in 'segments', at least one.
+    uint32_t num_segments;
+    uint8_t allow;
+    uint8_t anchored;
+    uint8_t reserved[2];
+  };
+
+  // A literal piece of a pattern, located in 'literals'.
+  struct Segment {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  // A node of the byte trie indexing the rules of a group by their literal
+  // prefix, i.e. the first segment of their pattern. Walking the trie along a
+  // path visits exactly the rules whose literal prefix is a prefix of the path.
+  struct TrieNode {
+    uint32_t first_child;   // Children are contiguous in 'trie_nodes' and
+    uint32_t num_children;  // sorted by 'byte'.
+    uint32_t first_rule;    // Rules whose literal prefix ends at this node,
+    uint32_t num_rules;     // in 'trie_rules'.
+    uint8_t byte;           // Last byte of the prefix of this node.
+    uint8_t reserved[3];
+  };
+
+  // The tables of the rule set, either in the vectors below or in the bytes
+  // given to FromBytes().
+  struct Tables {
+    const Group* groups;
+    const Agent* agents;
+    const Rule* rules;
+    const Segment* segments;
+    const TrieNode* trie_nodes;
+    const uint32_t* trie_rules;  // Indexes in 'rules'.
+    const Segment* sitemaps;     // URLs of the sitemap lines.
+    const char* literals;        // Bytes of all segments, agents and sitemaps.
+    uint32_t num_groups;
+    uint32_t num_agents;
+    uint32_t num_rules;
+    uint32_t num_segments;
+    uint32_t num_trie_nodes;
+    uint32_t num_trie_rules;
+    uint32_t num_sitemaps;
+    uint32_t literals_size;
+  };
+
+  Tables tables() const;
+
+  // Creates a rule set querying 'tables', which must outlive it, in place.
+  RobotsRuleSet(const Tables& tables, uint64_t max_match_steps,
+                bool fallback_allowed, bool limit_exceeded);
+
+  // Fast non-cryptographic checksum of the binary encodings, to detect
+  // corrupted ones.
+  static uint64_t Checksum(const char* data, size_t size);
+
+  // Returns true if 'group' was written for one of 'user_agents'.
+  static bool GroupHasAgent(const Tables& tables, const Group& group,
+                            const UserAgentSet& user_agents);
+
+  // Returns true if 'path' matches the pattern of 'rule' within 'budget'.
+  static bool RuleMatches(const Tables& tables, const Rule& rule,
+                          std::string_view path, RobotsMatchBudget* budget);
+
+  // Match() against the path of the URL.
+  RobotsMatchResult MatchPath(const UserAgentSet& user_agents,
+                              std::string_view path) const;
+
+  // Updates 'allow' and 'disallow' with the rules of 'group' matching 'path',
+  // as specific or global matches. Stops early if 'budget' runs out.
+  static void MatchGroup(const Tables& tables, const Group& group,
+                         std::string_view path, bool specific,
+                         RobotsMatchBudget* budget,
+                         RobotsMatcher::MatchHierarchy* allow,
+                         RobotsMatcher::MatchHierarchy* disallow);
+
+  std::vector<Group> groups_;
+  std::vector<Agent> agents_;
+  std::vector<Rule> rules_;
+  std::vector<Segment> segments_;
+  std::vector<TrieNode> trie_nodes_;
+  std::vector<uint32_t> trie_rules_;
+  std::vector<Segment> sitemaps_;
+  std::string literals_;
+
+  // The limits the rule set was compiled with, kept in its binary encoding.
+  uint64_t max_match_steps_ = 0;
+  bool fallback_allowed_ = false;
+  bool limit_exceeded_ = false;
 
-  RobotsMatchStrategy* match_strategy_;
+  // Set by FromBytes(), when the tables are in bytes not owned by the rule set.
+  // The vectors above are then empty.
+  bool mapped_ = false;
+  size_t mapped_size_ = 0;
+  Tables mapped_tables_;
 };
 
 }  // namespace googlebot
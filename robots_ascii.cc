@@ -0,0 +1,148 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_ascii.cc
+// -----------------------------------------------------------------------------
+//
+// Implements the string functions of robots_ascii.h.
+
+#include "robots_ascii.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ROBOTS_ASCII_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define ROBOTS_ASCII_NEON
+#endif
+
+namespace googlebot {
+
+namespace {
+
+#if defined(ROBOTS_ASCII_SSE2)
+typedef __m128i Chunk;
+
+Chunk Load(const char* p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+// Sets to 0xFF the bytes of 'chunk' in [lo, lo + n), with n < 128. SSE2 only
+// compares signed bytes, so the range is first moved to start at -128.
+Chunk InRange(Chunk chunk, char lo, int n) {
+  const Chunk shifted =
+      _mm_add_epi8(chunk, _mm_set1_epi8(static_cast<char>(-128 - lo)));
+  return _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + n)));
+}
+
+Chunk ToLower(Chunk chunk) {
+  return _mm_or_si128(
+      chunk, _mm_and_si128(InRange(chunk, 'A', 26), _mm_set1_epi8(0x20)));
+}
+
+bool AllSet(Chunk mask) { return _mm_movemask_epi8(mask) == 0xFFFF; }
+
+bool Equal(Chunk a, Chunk b) { return AllSet(_mm_cmpeq_epi8(a, b)); }
+
+bool IsProductToken(Chunk chunk) {
+  // Folding to lowercase with a bit or only moves [A-Z] to [a-z], '_' and
+  // '-' are checked separately.
+  const Chunk letters =
+      InRange(_mm_or_si128(chunk, _mm_set1_epi8(0x20)), 'a', 26);
+  return AllSet(_mm_or_si128(
+      letters, _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('_')),
+                            _mm_cmpeq_epi8(chunk, _mm_set1_epi8('-')))));
+}
+
+void Store(Chunk chunk, char* p) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), chunk);
+}
+#elif defined(ROBOTS_ASCII_NEON)
+typedef uint8x16_t Chunk;
+
+Chunk Load(const char* p) {
+  return vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+}
+
+// Sets to 0xFF the bytes of 'chunk' in [lo, lo + n).
+Chunk InRange(Chunk chunk, char lo, int n) {
+  return vcltq_u8(vsubq_u8(chunk, vdupq_n_u8(static_cast<uint8_t>(lo))),
+                  vdupq_n_u8(static_cast<uint8_t>(n)));
+}
+
+Chunk ToLower(Chunk chunk) {
+  return vorrq_u8(chunk, vandq_u8(InRange(chunk, 'A', 26), vdupq_n_u8(0x20)));
+}
+
+bool AllSet(Chunk mask) { return vminvq_u8(mask) == 0xFF; }
+
+bool Equal(Chunk a, Chunk b) { return AllSet(vceqq_u8(a, b)); }
+
+bool IsProductToken(Chunk chunk) {
+  const Chunk letters = InRange(vorrq_u8(chunk, vdupq_n_u8(0x20)), 'a', 26);
+  return AllSet(vorrq_u8(letters, vorrq_u8(vceqq_u8(chunk, vdupq_n_u8('_')),
+                                           vceqq_u8(chunk, vdupq_n_u8('-')))));
+}
+
+void Store(Chunk chunk, char* p) {
+  vst1q_u8(reinterpret_cast<uint8_t*>(p), chunk);
+}
+#endif
+
+}  // namespace
+
+void AsciiToLower(std::string_view src, char* dst) {
+  size_t i = 0;
+#if defined(ROBOTS_ASCII_SSE2) || defined(ROBOTS_ASCII_NEON)
+  for (; i + 16 <= src.size(); i += 16) {
+    Store(ToLower(Load(src.data() + i)), dst + i);
+  }
+#endif
+  for (; i < src.size(); ++i) dst[i] = AsciiToLower(src[i]);
+}
+
+bool AsciiEqualsIgnoreCase(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) return false;
+  size_t i = 0;
+#if defined(ROBOTS_ASCII_SSE2) || defined(ROBOTS_ASCII_NEON)
+  for (; i + 16 <= a.size(); i += 16) {
+    if (!Equal(ToLower(Load(a.data() + i)), ToLower(Load(b.data() + i)))) {
+      return false;
+    }
+  }
+#endif
+  for (; i < a.size(); ++i) {
+    if (AsciiToLower(a[i]) != AsciiToLower(b[i])) return false;
+  }
+  return true;
+}
+
+size_t AsciiProductTokenLength(std::string_view text) {
+  size_t i = 0;
+#if defined(ROBOTS_ASCII_SSE2) || defined(ROBOTS_ASCII_NEON)
+  // Skips the chunks made only of allowed bytes, the end of the token is then
+  // found a byte at a time.
+  while (i + 16 <= text.size() && IsProductToken(Load(text.data() + i))) {
+    i += 16;
+  }
+#endif
+  while (i < text.size() &&
+         internal::AsciiIs(text[i], internal::AsciiTable::kProductToken)) {
+    ++i;
+  }
+  return i;
+}
+
+}  // namespace googlebot
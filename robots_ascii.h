@@ -0,0 +1,123 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_ascii.h
+// -----------------------------------------------------------------------------
+//
+// ASCII character classification, case folding and case-insensitive
+// comparison, independent of the locale. They behave like the <cctype>
+// functions in the "C" locale: bytes outside of ASCII are neither letters nor
+// spaces, and are never folded. Unlike them, they do not look up the locale
+// of the thread, and the functions on strings check 16 bytes at once when SSE2
+// or NEON are available.
+
+#ifndef THIRD_PARTY_ROBOTSTXT_ROBOTS_ASCII_H__
+#define THIRD_PARTY_ROBOTSTXT_ROBOTS_ASCII_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace googlebot {
+
+namespace internal {
+
+// Properties of each byte, in a table so that classifying it is one load.
+struct AsciiTable {
+  enum Class : uint8_t {
+    kAlpha = 1 << 0,
+    kSpace = 1 << 1,
+    kXDigit = 1 << 2,
+    kLower = 1 << 3,
+    // Bytes allowed in the product token of a user-agent: [a-zA-Z_-].
+    kProductToken = 1 << 4,
+  };
+
+  uint8_t classes[256];
+  char lower[256];
+  char upper[256];
+};
+
+constexpr AsciiTable MakeAsciiTable() {
+  AsciiTable table = {};
+  for (int i = 0; i < 256; ++i) {
+    const bool is_lower = i >= 'a' && i <= 'z';
+    const bool is_upper = i >= 'A' && i <= 'Z';
+    uint8_t classes = 0;
+    if (is_lower || is_upper) classes |= AsciiTable::kAlpha;
+    if (i == ' ' || (i >= '\t' && i <= '\r')) classes |= AsciiTable::kSpace;
+    if ((i >= '0' && i <= '9') || (i >= 'a' && i <= 'f') ||
+        (i >= 'A' && i <= 'F')) {
+      classes |= AsciiTable::kXDigit;
+    }
+    if (is_lower) classes |= AsciiTable::kLower;
+    if (is_lower || is_upper || i == '_' || i == '-') {
+      classes |= AsciiTable::kProductToken;
+    }
+    table.classes[i] = classes;
+    table.lower[i] = static_cast<char>(is_upper ? i + ('a' - 'A') : i);
+    table.upper[i] = static_cast<char>(is_lower ? i - ('a' - 'A') : i);
+  }
+  return table;
+}
+
+inline constexpr AsciiTable kAsciiTable = MakeAsciiTable();
+
+inline bool AsciiIs(char ch, AsciiTable::Class c) {
+  return kAsciiTable.classes[static_cast<unsigned char>(ch)] & c;
+}
+
+}  // namespace internal
+
+inline bool AsciiIsAlpha(char ch) {
+  return internal::AsciiIs(ch, internal::AsciiTable::kAlpha);
+}
+// ' ', '\t', '\n', '\v', '\f' and '\r'.
+inline bool AsciiIsSpace(char ch) {
+  return internal::AsciiIs(ch, internal::AsciiTable::kSpace);
+}
+inline bool AsciiIsXDigit(char ch) {
+  return internal::AsciiIs(ch, internal::AsciiTable::kXDigit);
+}
+inline bool AsciiIsLower(char ch) {
+  return internal::AsciiIs(ch, internal::AsciiTable::kLower);
+}
+inline char AsciiToLower(char ch) {
+  return internal::kAsciiTable.lower[static_cast<unsigned char>(ch)];
+}
+inline char AsciiToUpper(char ch) {
+  return internal::kAsciiTable.upper[static_cast<unsigned char>(ch)];
+}
+
+// Writes 'src' lowercased to the first src.size() bytes of 'dst'. They may be
+// the same, but must not overlap otherwise.
+void AsciiToLower(std::string_view src, char* dst);
+
+// Returns true if 'a' and 'b' are equal once lowercased.
+bool AsciiEqualsIgnoreCase(std::string_view a, std::string_view b);
+
+// Returns true if 'text' starts with 'prefix', ignoring the case.
+inline bool AsciiStartsWithIgnoreCase(std::string_view text,
+                                      std::string_view prefix) {
+  return text.size() >= prefix.size() &&
+         AsciiEqualsIgnoreCase(text.substr(0, prefix.size()), prefix);
+}
+
+// Returns the length of the longest prefix of 'text' made of the characters
+// allowed in the product token of a user-agent, [a-zA-Z_-].
+size_t AsciiProductTokenLength(std::string_view text);
+
+}  // namespace googlebot
+#endif  // THIRD_PARTY_ROBOTSTXT_ROBOTS_ASCII_H__
@@ -0,0 +1,121 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file tests the locale-free ASCII functions (robots_ascii.h).
+
+#include "robots_ascii.h"
+
+#include <cctype>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::googlebot::AsciiEqualsIgnoreCase;
+using ::googlebot::AsciiProductTokenLength;
+using ::googlebot::AsciiStartsWithIgnoreCase;
+
+// Strings of every length up to a few chunks, mixing cases, the bytes around
+// the letters, and non-ASCII bytes.
+std::vector<std::string> TestStrings() {
+  static const char kBytes[] = "aAzZ@[`{_-09 \t\x80\xC1\xDA\xE1\xFA";
+  std::mt19937 random(42);
+  std::vector<std::string> strings;
+  for (size_t length = 0; length <= 40; ++length) {
+    for (int i = 0; i < 50; ++i) {
+      std::string s;
+      for (size_t j = 0; j < length; ++j) {
+        s.push_back(kBytes[random() % (sizeof(kBytes) - 1)]);
+      }
+      strings.push_back(s);
+    }
+  }
+  return strings;
+}
+
+std::string CLocaleLower(std::string s) {
+  for (char& ch : s) ch = std::tolower(static_cast<unsigned char>(ch));
+  return s;
+}
+
+}  // namespace
+
+// Same as <cctype> in the "C" locale, the locale of programs that do not set
+// one.
+TEST(RobotsAsciiTest, MatchesCLocale) {
+  for (int i = 0; i < 256; ++i) {
+    const char ch = static_cast<char>(i);
+    const unsigned char uch = static_cast<unsigned char>(i);
+    EXPECT_EQ(std::isalpha(uch) != 0, googlebot::AsciiIsAlpha(ch)) << i;
+    EXPECT_EQ(std::isspace(uch) != 0, googlebot::AsciiIsSpace(ch)) << i;
+    EXPECT_EQ(std::isxdigit(uch) != 0, googlebot::AsciiIsXDigit(ch)) << i;
+    EXPECT_EQ(std::islower(uch) != 0, googlebot::AsciiIsLower(ch)) << i;
+    EXPECT_EQ(static_cast<char>(std::tolower(uch)),
+              googlebot::AsciiToLower(ch)) << i;
+    EXPECT_EQ(static_cast<char>(std::toupper(uch)),
+              googlebot::AsciiToUpper(ch)) << i;
+  }
+}
+
+TEST(RobotsAsciiTest, ToLower) {
+  for (const std::string& s : TestStrings()) {
+    std::string lower(s.size(), '?');
+    googlebot::AsciiToLower(s, &lower[0]);
+    EXPECT_EQ(CLocaleLower(s), lower);
+    // In place.
+    lower = s;
+    googlebot::AsciiToLower(lower, &lower[0]);
+    EXPECT_EQ(CLocaleLower(s), lower);
+  }
+}
+
+TEST(RobotsAsciiTest, EqualsIgnoreCase) {
+  const std::vector<std::string> strings = TestStrings();
+  for (size_t i = 0; i < strings.size(); ++i) {
+    const std::string& a = strings[i];
+    // Mostly strings of the same length, some of them equal.
+    for (const std::string& b :
+         {strings[(i * 7 + 1) % strings.size()], strings[i - i % 50],
+          strings[i ^ 1], a, CLocaleLower(a)}) {
+      EXPECT_EQ(CLocaleLower(a) == CLocaleLower(b),
+                AsciiEqualsIgnoreCase(a, b))
+          << a << " " << b;
+    }
+  }
+  EXPECT_TRUE(AsciiEqualsIgnoreCase("", ""));
+  EXPECT_TRUE(AsciiEqualsIgnoreCase("GoogleBot-Image", "googlebot-IMAGE"));
+  EXPECT_FALSE(AsciiEqualsIgnoreCase("@", "`"));
+  EXPECT_FALSE(AsciiEqualsIgnoreCase("\xC9", "\xE9"));
+
+  EXPECT_TRUE(AsciiStartsWithIgnoreCase("User-Agent: foo", "user-agent"));
+  EXPECT_FALSE(AsciiStartsWithIgnoreCase("User", "user-agent"));
+}
+
+TEST(RobotsAsciiTest, ProductTokenLength) {
+  for (const std::string& s : TestStrings()) {
+    size_t expected = 0;
+    while (expected < s.size() &&
+           (std::isalpha(static_cast<unsigned char>(s[expected])) ||
+            s[expected] == '_' || s[expected] == '-')) {
+      ++expected;
+    }
+    EXPECT_EQ(expected, AsciiProductTokenLength(s)) << s;
+  }
+  EXPECT_EQ(9, AsciiProductTokenLength("Googlebot/2.1"));
+  EXPECT_EQ(20, AsciiProductTokenLength("Abcdefghijklmnopq_-Z"));
+  EXPECT_EQ(17, AsciiProductTokenLength("Abcdefghijklmnopq[rst"));
+}
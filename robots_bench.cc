@@ -0,0 +1,380 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_bench.cc
+// -----------------------------------------------------------------------------
+//
+// Benchmarks of the robots.txt parser and matcher, on synthetic robots.txt
+// files and optionally on a directory of real ones:
+//
+//   robots-bench [--corpus_dir=<dir>] [benchmark flags]
+//
+// Every file of <dir> is read as one robots.txt body.
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "robots.h"
+#include "robots_bulk.h"
+#include "robots_cache.h"
+
+// These functions are available to the linker, but not in the header, because
+// they should only be used for testing.
+namespace googlebot {
+std::string GetPathParamsQuery(const std::string& url);
+std::string_view MaybeEscapePattern(std::string_view src,
+                                    std::string* scratch);
+}  // namespace googlebot
+
+namespace {
+
+using ::googlebot::RobotsMatcher;
+using ::googlebot::RobotsRuleSet;
+
+// Ignores all the directives, to measure the parser alone.
+class NullHandler : public googlebot::RobotsParseHandler {
+ public:
+  void HandleRobotsStart() override {}
+  void HandleRobotsEnd() override {}
+  void HandleUserAgent(int line_num, std::string_view value) override {}
+  void HandleAllow(int line_num, std::string_view value) override {}
+  void HandleDisallow(int line_num, std::string_view value) override {}
+  void HandleCrawlDelay(int line_num, std::string_view value) override {}
+  void HandleSitemap(int line_num, std::string_view value) override {}
+  void HandleUnknownAction(int line_num, std::string_view action,
+                           std::string_view value) override {}
+};
+
+// Synthetic robots.txt bodies.
+enum BodyKind { kManyRules, kLongLines, kWildcards };
+
+// A random path of 'length' characters below '/'.
+std::string RandomPath(std::mt19937* rng, size_t length) {
+  static const char kChars[] = "abcdefghij/-_.";
+  std::string path = "/";
+  while (path.size() < length) path += kChars[(*rng)() % (sizeof(kChars) - 1)];
+  return path;
+}
+
+std::string SyntheticBody(BodyKind kind, int num_rules) {
+  std::mt19937 rng(42);
+  std::string body;
+  for (int i = 0; i < num_rules; ++i) {
+    if (i % 50 == 0) {
+      body += "\nuser-agent: bot" + std::to_string(i) + "\n";
+      if (i % 200 == 0) body += "user-agent: *\n";
+      if (i % 100 == 0) body += "user-agent: FooBot\n";
+    }
+    body += (i % 3 == 0) ? "allow: " : "disallow: ";
+    switch (kind) {
+      case kManyRules:
+        body += RandomPath(&rng, 8 + rng() % 32);
+        break;
+      case kLongLines:
+        body += RandomPath(&rng, 2000 + rng() % 4000);
+        break;
+      case kWildcards:
+        for (int j = 0; j < 8; ++j) body += RandomPath(&rng, 2 + rng() % 4) + "*";
+        if (i % 2 == 0) body += "$";
+        break;
+    }
+    body += (i % 7 == 0) ? "  # comment\r\n" : "\n";
+  }
+  return body;
+}
+
+const char* BodyKindName(BodyKind kind) {
+  switch (kind) {
+    case kManyRules:
+      return "many_rules";
+    case kLongLines:
+      return "long_lines";
+    case kWildcards:
+      return "wildcards";
+  }
+  return "";
+}
+
+// URLs to match against the synthetic bodies.
+std::vector<std::string> SyntheticUrls(int num_urls) {
+  std::mt19937 rng(7);
+  std::vector<std::string> urls;
+  for (int i = 0; i < num_urls; ++i) {
+    urls.push_back("http://foo.bar" + RandomPath(&rng, 10 + rng() % 60) +
+                   (i % 4 == 0 ? "?q=1" : ""));
+  }
+  return urls;
+}
+
+void BM_ParseRobotsTxt(benchmark::State& state) {
+  const BodyKind kind = static_cast<BodyKind>(state.range(0));
+  const std::string body = SyntheticBody(kind, state.range(1));
+  NullHandler handler;
+  for (auto _ : state) {
+    googlebot::ParseRobotsTxt(body, &handler);
+  }
+  state.SetLabel(BodyKindName(kind));
+  state.SetBytesProcessed(state.iterations() * body.size());
+}
+BENCHMARK(BM_ParseRobotsTxt)
+    ->ArgsProduct({{kManyRules, kLongLines, kWildcards}, {100, 10000}});
+
+void BM_AllowedByRobots(benchmark::State& state) {
+  const BodyKind kind = static_cast<BodyKind>(state.range(0));
+  const std::string body = SyntheticBody(kind, state.range(1));
+  const std::vector<std::string> urls = SyntheticUrls(64);
+  RobotsMatcher matcher;
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(matcher.OneAgentAllowedByRobots(
+        body, "FooBot", urls[i++ % urls.size()]));
+  }
+  state.SetLabel(BodyKindName(kind));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AllowedByRobots)
+    ->ArgsProduct({{kManyRules, kLongLines, kWildcards}, {100, 10000}});
+
+void BM_RuleSetMatch(benchmark::State& state) {
+  const BodyKind kind = static_cast<BodyKind>(state.range(0));
+  const RobotsRuleSet rules(SyntheticBody(kind, state.range(1)));
+  const std::vector<std::string> urls = SyntheticUrls(64);
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        rules.OneAgentAllowed("FooBot", urls[i++ % urls.size()]));
+  }
+  state.SetLabel(BodyKindName(kind));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RuleSetMatch)
+    ->ArgsProduct({{kManyRules, kLongLines, kWildcards}, {100, 10000}});
+
+// Worst cases of the pattern matcher: a wildcard followed by a long segment
+// that almost matches at every position of the path, or by many short
+// segments that all match, each one leftmost. Measured through a robots.txt
+// of a single rule, whose parsing is negligible next to the matching.
+void BM_MatchesWorstCase(benchmark::State& state) {
+  const int length = state.range(0);
+  std::string pattern = "/";
+  if (state.range(1)) {
+    for (int i = 0; i < 256; ++i) pattern += "*a";
+    pattern += "$";
+  } else {
+    pattern += "*" + std::string(64, 'a') + "b";
+  }
+  const std::string body = "user-agent: *\ndisallow: " + pattern + "\n";
+  const std::string url = "http://foo.bar/" + std::string(length, 'a');
+  RobotsMatcher matcher;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        matcher.OneAgentAllowedByRobots(body, "FooBot", url));
+  }
+  state.SetLabel(state.range(1) ? "many_wildcards" : "near_misses");
+  state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_MatchesWorstCase)->ArgsProduct({{64, 1024, 16 << 10}, {0, 1}});
+
+void BM_GetPathParamsQuery(benchmark::State& state) {
+  const std::vector<std::string> urls = {
+      "http://www.example.com/a/b/c/d.html?q=1&r=2#fragment",
+      "https://example.com:8080",
+      "//example.com/path;params?query",
+      "example.com/" + std::string(200, 'p'),
+  };
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        googlebot::GetPathParamsQuery(urls[i++ % urls.size()]));
+  }
+}
+BENCHMARK(BM_GetPathParamsQuery);
+
+void BM_MaybeEscapePattern(benchmark::State& state) {
+  const std::string pattern =
+      state.range(0) ? "/caf\xc3\xa9/%aa/%Bc/\xe4\xb8\xad\xe6\x96\x87/path"
+                     : "/plain/ascii/path/that/needs/no/escaping.html";
+  std::string scratch;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(googlebot::MaybeEscapePattern(pattern, &scratch));
+  }
+  state.SetLabel(state.range(0) ? "escaped" : "unchanged");
+  state.SetBytesProcessed(state.iterations() * pattern.size());
+}
+BENCHMARK(BM_MaybeEscapePattern)->Arg(0)->Arg(1);
+
+// Lookups of a few hot origins from many threads, with a reference count
+// (Get()) or under an epoch guard (Find()).
+void BM_CacheLookup(benchmark::State& state) {
+  static googlebot::RobotsCache* cache = [] {
+    auto* cache = new googlebot::RobotsCache();
+    for (int i = 0; i < 16; ++i) {
+      cache->Insert("http://" + std::to_string(i) + ".com",
+                    SyntheticBody(kManyRules, 100));
+    }
+    return cache;
+  }();
+  std::vector<std::string> origins;
+  for (int i = 0; i < 16; ++i) {
+    origins.push_back("http://" + std::to_string(i) + ".com");
+  }
+  const bool guarded = state.range(0);
+  size_t i = 0;
+  for (auto _ : state) {
+    const std::string& origin = origins[i++ % origins.size()];
+    if (guarded) {
+      googlebot::RobotsCache::ReadGuard guard(*cache);
+      benchmark::DoNotOptimize(cache->Find(guard, origin));
+    } else {
+      benchmark::DoNotOptimize(cache->Get(origin));
+    }
+  }
+  state.SetLabel(guarded ? "find" : "get");
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CacheLookup)->Arg(0)->Arg(1)->ThreadRange(1, 8);
+
+// Rows of many hosts checked against a bulk index, in random order or sorted
+// by the hash of their host.
+void BM_BulkIndexBatch(benchmark::State& state) {
+  constexpr int kNumHosts = 100000;
+  static const googlebot::RobotsBulkIndex* index = [] {
+    googlebot::RobotsBulkIndex::Builder builder;
+    std::vector<std::string> bodies;
+    for (int i = 0; i < 16; ++i) bodies.push_back(SyntheticBody(kManyRules, i));
+    for (int i = 0; i < kNumHosts; ++i) {
+      builder.AddHost("host" + std::to_string(i) + ".com", bodies[i % 16]);
+    }
+    auto* index = new googlebot::RobotsBulkIndex();
+    builder.Build(index);
+    return index;
+  }();
+  std::mt19937 rng(3);
+  std::vector<std::string> hosts;
+  for (int i = 0; i < 4096; ++i) {
+    hosts.push_back("host" + std::to_string(rng() % kNumHosts) + ".com");
+  }
+  if (state.range(0)) {
+    std::sort(hosts.begin(), hosts.end(),
+              [](const std::string& a, const std::string& b) {
+                return googlebot::RobotsBulkIndex::HostHash(a) <
+                       googlebot::RobotsBulkIndex::HostHash(b);
+              });
+  }
+  const std::vector<std::string> urls = SyntheticUrls(hosts.size());
+  std::vector<googlebot::RobotsBulkQuery> rows;
+  for (size_t i = 0; i < hosts.size(); ++i) rows.push_back({hosts[i], urls[i]});
+  const std::vector<std::string> agents = {"FooBot"};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index->MatchBatch(&agents, rows));
+  }
+  state.SetLabel(state.range(0) ? "sorted" : "random");
+  state.SetItemsProcessed(state.iterations() * rows.size());
+}
+BENCHMARK(BM_BulkIndexBatch)->Arg(0)->Arg(1);
+
+// Benchmarks on the robots.txt files of --corpus_dir.
+std::vector<std::string>* corpus = new std::vector<std::string>();
+
+size_t CorpusBytes() {
+  size_t bytes = 0;
+  for (const std::string& body : *corpus) bytes += body.size();
+  return bytes;
+}
+
+void BM_ParseCorpus(benchmark::State& state) {
+  NullHandler handler;
+  for (auto _ : state) {
+    for (const std::string& body : *corpus) {
+      googlebot::ParseRobotsTxt(body, &handler);
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * CorpusBytes());
+}
+
+void BM_AllowedByRobotsCorpus(benchmark::State& state) {
+  const std::vector<std::string> urls = SyntheticUrls(16);
+  RobotsMatcher matcher;
+  size_t i = 0;
+  for (auto _ : state) {
+    for (const std::string& body : *corpus) {
+      benchmark::DoNotOptimize(matcher.OneAgentAllowedByRobots(
+          body, "Googlebot", urls[i++ % urls.size()]));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * corpus->size());
+}
+
+void BM_RuleSetCompileCorpus(benchmark::State& state) {
+  for (auto _ : state) {
+    for (const std::string& body : *corpus) {
+      RobotsRuleSet rules(body);
+      benchmark::DoNotOptimize(rules);
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * CorpusBytes());
+}
+
+// Reads every regular file of 'dir' into 'corpus'. Returns false on error.
+bool LoadCorpus(const std::string& dir) {
+  std::error_code error;
+  for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+    if (!entry.is_regular_file()) continue;
+    std::ifstream file(entry.path(), std::ios::binary);
+    corpus->emplace_back(std::istreambuf_iterator<char>(file),
+                         std::istreambuf_iterator<char>());
+  }
+  return !error;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  static const char kCorpusFlag[] = "--corpus_dir=";
+  int new_argc = 0;
+  for (int i = 0; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg.compare(0, sizeof(kCorpusFlag) - 1, kCorpusFlag) == 0) {
+      if (!LoadCorpus(arg.substr(sizeof(kCorpusFlag) - 1))) {
+        fprintf(stderr, "Failed to read corpus directory %s\n", argv[i]);
+        return 1;
+      }
+      continue;
+    }
+    argv[new_argc++] = argv[i];
+  }
+  argc = new_argc;
+
+  if (!corpus->empty()) {
+    benchmark::RegisterBenchmark("BM_ParseCorpus", BM_ParseCorpus);
+    benchmark::RegisterBenchmark("BM_AllowedByRobotsCorpus",
+                                 BM_AllowedByRobotsCorpus);
+    benchmark::RegisterBenchmark("BM_RuleSetCompileCorpus",
+                                 BM_RuleSetCompileCorpus);
+  }
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
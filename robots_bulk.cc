@@ -0,0 +1,572 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_bulk.cc
+// -----------------------------------------------------------------------------
+//
+// Implements RobotsBulkIndex, see robots_bulk.h.
+
+#include "robots_bulk.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include "robots_ascii.h"
+
+namespace googlebot {
+
+namespace {
+
+// Header of the binary encoding of a RobotsBulkIndex. The columns follow in
+// the order below, each one 8-byte aligned:
+//   uint64_t host_hashes[num_hosts];
+//   RobotsRuleSet::Segment host_names[num_hosts];
+//   uint32_t host_rule_sets[num_hosts];
+//   uint32_t first_groups[num_rule_sets];
+//   uint32_t num_groups[num_rule_sets];
+//   uint32_t first_sitemaps[num_rule_sets];
+//   uint32_t num_sitemaps[num_rule_sets];
+//   uint64_t max_match_steps[num_rule_sets];
+//   uint8_t flags[num_rule_sets];
+//   char host_chars[host_chars_size];
+// followed by the RobotsRuleSet::ToBytes() of the merged rule sets, of
+// 'rules_size' bytes.
+struct BulkIndexHeader {
+  uint32_t magic;
+  // Changes whenever the columns or RobotsBulkIndex::HostHash() change. The
+  // rule sets have a version of their own.
+  uint32_t version;
+  // Checksum of the encoding from 'partition' up to the rule sets, which have
+  // a checksum of their own.
+  uint64_t checksum;
+  uint32_t partition;
+  uint32_t num_partitions;
+  uint32_t num_hosts;
+  uint32_t num_rule_sets;
+  uint32_t host_chars_size;
+  uint32_t reserved;
+  uint64_t rules_size;
+};
+
+// "RBTI" when read in the byte order it was written in.
+const uint32_t kBulkIndexMagic = 0x49544252;
+const uint32_t kBulkIndexVersion = 1;
+const size_t kBulkIndexChecksumStart = offsetof(BulkIndexHeader, partition);
+
+// Offsets of the columns in the encoding of a RobotsBulkIndex.
+struct BulkIndexLayout {
+  uint64_t host_hashes;
+  uint64_t host_names;
+  uint64_t host_rule_sets;
+  uint64_t first_groups;
+  uint64_t num_groups;
+  uint64_t first_sitemaps;
+  uint64_t num_sitemaps;
+  uint64_t max_match_steps;
+  uint64_t flags;
+  uint64_t host_chars;
+  uint64_t rules;
+  uint64_t size;  // Of the whole encoding.
+};
+
+uint64_t RoundUpTo8(uint64_t n) { return (n + 7) & ~uint64_t{7}; }
+
+BulkIndexLayout GetBulkIndexLayout(const BulkIndexHeader& header,
+                                   size_t segment_size) {
+  BulkIndexLayout layout;
+  uint64_t offset = sizeof(BulkIndexHeader);
+  auto place = [&offset](uint64_t count, size_t size) {
+    offset = RoundUpTo8(offset);
+    const uint64_t start = offset;
+    offset += count * size;
+    return start;
+  };
+  layout.host_hashes = place(header.num_hosts, sizeof(uint64_t));
+  layout.host_names = place(header.num_hosts, segment_size);
+  layout.host_rule_sets = place(header.num_hosts, sizeof(uint32_t));
+  layout.first_groups = place(header.num_rule_sets, sizeof(uint32_t));
+  layout.num_groups = place(header.num_rule_sets, sizeof(uint32_t));
+  layout.first_sitemaps = place(header.num_rule_sets, sizeof(uint32_t));
+  layout.num_sitemaps = place(header.num_rule_sets, sizeof(uint32_t));
+  layout.max_match_steps = place(header.num_rule_sets, sizeof(uint64_t));
+  layout.flags = place(header.num_rule_sets, sizeof(uint8_t));
+  layout.host_chars = place(header.host_chars_size, 1);
+  layout.rules = place(header.rules_size, 1);
+  layout.size = RoundUpTo8(offset);
+  return layout;
+}
+
+// Returns true if [first, first + count) is within [0, size).
+bool InRange(uint64_t first, uint64_t count, uint64_t size) {
+  return first <= size && count <= size - first;
+}
+
+// Returns true if 'count' more entries fit after the first 'size' ones of a
+// table indexed by 32-bit offsets.
+bool Fits(size_t size, size_t count) {
+  const size_t kMax = std::numeric_limits<uint32_t>::max();
+  return size <= kMax && count <= kMax - size;
+}
+
+}  // namespace
+
+/* static */ uint64_t RobotsBulkIndex::HostHash(std::string_view host) {
+  // FNV-1a of the lowercased host, then the finalizer of MurmurHash3 so that
+  // all the bits, the low ones of PartitionOf() included, depend on each byte.
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char ch : host) {
+    hash = (hash ^ static_cast<unsigned char>(AsciiToLower(ch))) *
+           0x100000001b3ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/* static */ uint32_t RobotsBulkIndex::PartitionOf(std::string_view host,
+                                                   uint32_t num_partitions) {
+  assert(num_partitions > 0);
+  return HostHash(host) % num_partitions;
+}
+
+RobotsBulkIndex::Columns RobotsBulkIndex::columns() const {
+  if (mapped_) return mapped_columns_;
+  Columns columns;
+  columns.host_hashes = host_hashes_.data();
+  columns.host_names = host_names_.data();
+  columns.host_rule_sets = host_rule_sets_.data();
+  columns.host_chars = host_chars_.data();
+  columns.first_groups = first_groups_.data();
+  columns.num_groups = num_groups_.data();
+  columns.first_sitemaps = first_sitemaps_.data();
+  columns.num_sitemaps = num_sitemaps_.data();
+  columns.max_match_steps = max_match_steps_.data();
+  columns.flags = flags_.data();
+  columns.num_hosts = host_hashes_.size();
+  columns.num_rule_sets = first_groups_.size();
+  columns.host_chars_size = host_chars_.size();
+  return columns;
+}
+
+int64_t RobotsBulkIndex::FindHost(const Columns& columns,
+                                  std::string_view host, uint64_t hash,
+                                  size_t* hint) const {
+  const size_t num_hosts = columns.num_hosts;
+  if (num_hosts == 0) return -1;
+  const uint64_t* const hashes = columns.host_hashes;
+  const uint64_t* first = hashes;
+  const uint64_t* last = hashes + num_hosts;
+  const size_t start = *hint;
+  if (start < num_hosts && hashes[start] < hash) {
+    // Gallops from the hint, so that sorted rows only look a few hosts ahead.
+    // Not from a hint on 'hash' itself, which may be past the first host with
+    // that hash.
+    size_t step = 1;
+    while (start + step < num_hosts && hashes[start + step] < hash) step *= 2;
+    first = hashes + start + step / 2;
+    last = hashes + std::min(start + step + 1, num_hosts);
+  }
+  const uint64_t* it = std::lower_bound(first, last, hash);
+  *hint = std::min<size_t>(it - hashes, num_hosts - 1);
+  for (; it != hashes + num_hosts && *it == hash; ++it) {
+    const RobotsRuleSet::Segment& name = columns.host_names[it - hashes];
+    if (std::string_view(columns.host_chars + name.offset, name.length) ==
+        host) {
+      *hint = it - hashes;
+      return it - hashes;
+    }
+  }
+  return -1;
+}
+
+RobotsRuleSet RobotsBulkIndex::RuleSet(const Columns& columns,
+                                       uint32_t rule_set) const {
+  RobotsRuleSet::Tables tables = rules_.tables();
+  tables.groups += columns.first_groups[rule_set];
+  tables.num_groups = columns.num_groups[rule_set];
+  tables.sitemaps += columns.first_sitemaps[rule_set];
+  tables.num_sitemaps = columns.num_sitemaps[rule_set];
+  const uint8_t flags = columns.flags[rule_set];
+  return RobotsRuleSet(tables, columns.max_match_steps[rule_set],
+                       (flags & kFallbackAllowed) != 0,
+                       (flags & kLimitExceeded) != 0);
+}
+
+bool RobotsBulkIndex::Find(std::string_view host, RobotsRuleSet* rules) const {
+  const Columns columns = this->columns();
+  std::string lowercase(host);
+  AsciiToLower(lowercase, &lowercase[0]);
+  size_t hint = 0;
+  const int64_t i = FindHost(columns, lowercase, HostHash(host), &hint);
+  if (i < 0) return false;
+  *rules = RuleSet(columns, columns.host_rule_sets[i]);
+  return true;
+}
+
+RobotsMatchResult RobotsBulkIndex::Match(const UserAgentSet& user_agents,
+                                         std::string_view host,
+                                         std::string_view url) const {
+  RobotsRuleSet rules;
+  if (!Find(host, &rules)) return RobotsMatchResult();
+  return rules.Match(user_agents, url);
+}
+
+std::vector<RobotsMatchResult> RobotsBulkIndex::MatchBatch(
+    const std::vector<std::string>* user_agents,
+    const std::vector<RobotsBulkQuery>& rows) const {
+  return MatchBatch(UserAgentSet(*user_agents), rows);
+}
+
+std::vector<RobotsMatchResult> RobotsBulkIndex::MatchBatch(
+    const UserAgentSet& user_agents,
+    const std::vector<RobotsBulkQuery>& rows) const {
+  const Columns columns = this->columns();
+  std::vector<RobotsMatchResult> results(rows.size());
+  // The rule set of the host of the previous row, if it is in the index.
+  RobotsRuleSet rules;
+  bool found = false;
+  std::string host;
+  size_t hint = 0;
+  for (size_t i = 0; i < rows.size(); ++i) {
+    const RobotsBulkQuery& row = rows[i];
+    if (i == 0 || !AsciiEqualsIgnoreCase(row.host, host)) {
+      host.assign(row.host.data(), row.host.size());
+      AsciiToLower(host, &host[0]);
+      const int64_t position =
+          FindHost(columns, host, HostHash(host), &hint);
+      found = position >= 0;
+      if (found) rules = RuleSet(columns, columns.host_rule_sets[position]);
+    }
+    if (found) results[i] = rules.Match(user_agents, row.url);
+  }
+  return results;
+}
+
+size_t RobotsBulkIndex::SpaceUsed() const {
+  if (mapped_) return sizeof(*this) + mapped_size_;
+  return sizeof(*this) + host_hashes_.capacity() * sizeof(uint64_t) +
+         host_names_.capacity() * sizeof(RobotsRuleSet::Segment) +
+         host_rule_sets_.capacity() * sizeof(uint32_t) +
+         host_chars_.capacity() +
+         (first_groups_.capacity() + num_groups_.capacity() +
+          first_sitemaps_.capacity() + num_sitemaps_.capacity()) *
+             sizeof(uint32_t) +
+         max_match_steps_.capacity() * sizeof(uint64_t) + flags_.capacity() +
+         rules_.SpaceUsed() - sizeof(rules_);
+}
+
+std::string RobotsBulkIndex::ToBytes() const {
+  const Columns columns = this->columns();
+  const std::string rules = rules_.ToBytes();
+  BulkIndexHeader header = {};
+  header.magic = kBulkIndexMagic;
+  header.version = kBulkIndexVersion;
+  header.partition = partition_;
+  header.num_partitions = num_partitions_;
+  header.num_hosts = columns.num_hosts;
+  header.num_rule_sets = columns.num_rule_sets;
+  header.host_chars_size = columns.host_chars_size;
+  header.rules_size = rules.size();
+  const BulkIndexLayout layout =
+      GetBulkIndexLayout(header, sizeof(RobotsRuleSet::Segment));
+
+  std::string bytes(layout.size, '\0');
+  auto copy = [&bytes](uint64_t offset, const void* data, size_t size) {
+    if (size > 0) memcpy(&bytes[offset], data, size);
+  };
+  const size_t num_hosts = columns.num_hosts;
+  const size_t num_rule_sets = columns.num_rule_sets;
+  copy(layout.host_hashes, columns.host_hashes, num_hosts * sizeof(uint64_t));
+  copy(layout.host_names, columns.host_names,
+       num_hosts * sizeof(RobotsRuleSet::Segment));
+  copy(layout.host_rule_sets, columns.host_rule_sets,
+       num_hosts * sizeof(uint32_t));
+  copy(layout.first_groups, columns.first_groups,
+       num_rule_sets * sizeof(uint32_t));
+  copy(layout.num_groups, columns.num_groups,
+       num_rule_sets * sizeof(uint32_t));
+  copy(layout.first_sitemaps, columns.first_sitemaps,
+       num_rule_sets * sizeof(uint32_t));
+  copy(layout.num_sitemaps, columns.num_sitemaps,
+       num_rule_sets * sizeof(uint32_t));
+  copy(layout.max_match_steps, columns.max_match_steps,
+       num_rule_sets * sizeof(uint64_t));
+  copy(layout.flags, columns.flags, num_rule_sets);
+  copy(layout.host_chars, columns.host_chars, columns.host_chars_size);
+  copy(layout.rules, rules.data(), rules.size());
+  copy(0, &header, sizeof(header));
+  header.checksum =
+      RobotsRuleSet::Checksum(bytes.data() + kBulkIndexChecksumStart,
+                              layout.rules - kBulkIndexChecksumStart);
+  copy(0, &header, sizeof(header));
+  return bytes;
+}
+
+/* static */ bool RobotsBulkIndex::FromBytes(std::string_view bytes,
+                                             RobotsBulkIndex* index) {
+  if (bytes.size() < sizeof(BulkIndexHeader) ||
+      reinterpret_cast<uintptr_t>(bytes.data()) % 8 != 0) {
+    return false;
+  }
+  BulkIndexHeader header;
+  memcpy(&header, bytes.data(), sizeof(header));
+  if (header.magic != kBulkIndexMagic || header.version != kBulkIndexVersion ||
+      header.num_partitions == 0 || header.partition >= header.num_partitions ||
+      header.rules_size > bytes.size()) {
+    return false;
+  }
+  // The other counts are 32-bit, so only 'rules_size' could make the layout
+  // wrap around.
+  const BulkIndexLayout layout =
+      GetBulkIndexLayout(header, sizeof(RobotsRuleSet::Segment));
+  if (layout.size != bytes.size() || layout.rules > bytes.size() ||
+      header.checksum !=
+          RobotsRuleSet::Checksum(bytes.data() + kBulkIndexChecksumStart,
+                                  layout.rules - kBulkIndexChecksumStart)) {
+    return false;
+  }
+  RobotsRuleSet rules;
+  if (!RobotsRuleSet::FromBytes(bytes.substr(layout.rules, header.rules_size),
+                                &rules)) {
+    return false;
+  }
+
+  Columns columns;
+  const char* const data = bytes.data();
+  columns.host_hashes =
+      reinterpret_cast<const uint64_t*>(data + layout.host_hashes);
+  columns.host_names =
+      reinterpret_cast<const RobotsRuleSet::Segment*>(data + layout.host_names);
+  columns.host_rule_sets =
+      reinterpret_cast<const uint32_t*>(data + layout.host_rule_sets);
+  columns.first_groups =
+      reinterpret_cast<const uint32_t*>(data + layout.first_groups);
+  columns.num_groups =
+      reinterpret_cast<const uint32_t*>(data + layout.num_groups);
+  columns.first_sitemaps =
+      reinterpret_cast<const uint32_t*>(data + layout.first_sitemaps);
+  columns.num_sitemaps =
+      reinterpret_cast<const uint32_t*>(data + layout.num_sitemaps);
+  columns.max_match_steps =
+      reinterpret_cast<const uint64_t*>(data + layout.max_match_steps);
+  columns.flags = reinterpret_cast<const uint8_t*>(data + layout.flags);
+  columns.host_chars = data + layout.host_chars;
+  columns.num_hosts = header.num_hosts;
+  columns.num_rule_sets = header.num_rule_sets;
+  columns.host_chars_size = header.host_chars_size;
+
+  // Lookups rely on the hosts being lowercased, sorted, in the partition and
+  // with the right hash, and on the rule sets being within the merged tables.
+  const RobotsRuleSet::Tables tables = rules.tables();
+  std::string_view previous;
+  for (uint32_t i = 0; i < columns.num_hosts; ++i) {
+    const RobotsRuleSet::Segment& name = columns.host_names[i];
+    if (!InRange(name.offset, name.length, columns.host_chars_size) ||
+        columns.host_rule_sets[i] >= columns.num_rule_sets) {
+      return false;
+    }
+    const std::string_view host(columns.host_chars + name.offset, name.length);
+    const uint64_t hash = columns.host_hashes[i];
+    if (HostHash(host) != hash ||
+        hash % header.num_partitions != header.partition ||
+        (i > 0 && (hash < columns.host_hashes[i - 1] ||
+                   (hash == columns.host_hashes[i - 1] && host <= previous)))) {
+      return false;
+    }
+    for (char ch : host) {
+      if (AsciiToLower(ch) != ch) return false;
+    }
+    previous = host;
+  }
+  for (uint32_t i = 0; i < columns.num_rule_sets; ++i) {
+    if (!InRange(columns.first_groups[i], columns.num_groups[i],
+                 tables.num_groups) ||
+        !InRange(columns.first_sitemaps[i], columns.num_sitemaps[i],
+                 tables.num_sitemaps) ||
+        columns.flags[i] > (kFallbackAllowed | kLimitExceeded)) {
+      return false;
+    }
+  }
+
+  *index = RobotsBulkIndex();
+  index->rules_ = std::move(rules);
+  index->partition_ = header.partition;
+  index->num_partitions_ = header.num_partitions;
+  index->mapped_ = true;
+  index->mapped_size_ = bytes.size();
+  index->mapped_columns_ = columns;
+  return true;
+}
+
+void RobotsBulkIndex::Builder::SetPartition(uint32_t partition,
+                                            uint32_t num_partitions) {
+  assert(num_partitions > 0 && partition < num_partitions);
+  partition_ = partition;
+  num_partitions_ = num_partitions;
+}
+
+bool RobotsBulkIndex::Builder::AddHost(std::string_view host,
+                                       std::string_view robots_body) {
+  // Skips compiling the robots.txt of the hosts of other partitions.
+  if (PartitionOf(host, num_partitions_) != partition_) return false;
+  return AddHost(host, RobotsRuleSet(robots_body, limits_));
+}
+
+bool RobotsBulkIndex::Builder::AddHost(std::string_view host,
+                                       const RobotsRuleSet& rules) {
+  const uint64_t hash = HostHash(host);
+  if (hash % num_partitions_ != partition_ || !Fits(hosts_.size(), 1) ||
+      !Fits(host_chars_size_, host.size())) {
+    return false;
+  }
+  const int64_t rule_set = AddRuleSet(rules);
+  if (rule_set < 0) return false;
+  Host entry;
+  entry.hash = hash;
+  entry.name.assign(host.data(), host.size());
+  AsciiToLower(entry.name, &entry.name[0]);
+  entry.rule_set = rule_set;
+  hosts_.push_back(std::move(entry));
+  host_chars_size_ += host.size();
+  return true;
+}
+
+int64_t RobotsBulkIndex::Builder::AddRuleSet(const RobotsRuleSet& rules) {
+  std::string encoding = rules.ToBytes();
+  const auto it = rule_sets_.find(encoding);
+  if (it != rule_sets_.end()) return it->second;
+
+  const RobotsRuleSet::Tables tables = rules.tables();
+  RobotsRuleSet& merged = index_.rules_;
+  if (!Fits(index_.first_groups_.size(), 1) ||
+      !Fits(merged.groups_.size(), tables.num_groups) ||
+      !Fits(merged.agents_.size(), tables.num_agents) ||
+      !Fits(merged.rules_.size(), tables.num_rules) ||
+      !Fits(merged.segments_.size(), tables.num_segments) ||
+      !Fits(merged.trie_nodes_.size(), tables.num_trie_nodes) ||
+      !Fits(merged.trie_rules_.size(), tables.num_trie_rules) ||
+      !Fits(merged.sitemaps_.size(), tables.num_sitemaps) ||
+      !Fits(merged.literals_.size(), tables.literals_size)) {
+    return -1;
+  }
+
+  const uint32_t first_group = merged.groups_.size();
+  const uint32_t first_agent = merged.agents_.size();
+  const uint32_t first_rule = merged.rules_.size();
+  const uint32_t first_segment = merged.segments_.size();
+  const uint32_t first_trie_node = merged.trie_nodes_.size();
+  const uint32_t first_trie_rule = merged.trie_rules_.size();
+  const uint32_t first_sitemap = merged.sitemaps_.size();
+  auto literal = [&tables](const RobotsRuleSet::Segment& segment) {
+    return std::string_view(tables.literals + segment.offset, segment.length);
+  };
+
+  for (uint32_t i = 0; i < tables.num_groups; ++i) {
+    RobotsRuleSet::Group group = tables.groups[i];
+    group.first_agent += first_agent;
+    group.trie_root += first_trie_node;
+    merged.groups_.push_back(group);
+  }
+  for (uint32_t i = 0; i < tables.num_agents; ++i) {
+    RobotsRuleSet::Agent agent = tables.agents[i];
+    agent.offset = Intern(std::string_view(tables.literals + agent.offset,
+                                           agent.length));
+    merged.agents_.push_back(agent);
+  }
+  for (uint32_t i = 0; i < tables.num_rules; ++i) {
+    RobotsRuleSet::Rule rule = tables.rules[i];
+    rule.first_segment += first_segment;
+    merged.rules_.push_back(rule);
+  }
+  for (uint32_t i = 0; i < tables.num_segments; ++i) {
+    RobotsRuleSet::Segment segment = tables.segments[i];
+    segment.offset = Intern(literal(segment));
+    merged.segments_.push_back(segment);
+  }
+  for (uint32_t i = 0; i < tables.num_trie_nodes; ++i) {
+    RobotsRuleSet::TrieNode node = tables.trie_nodes[i];
+    node.first_child += first_trie_node;
+    node.first_rule += first_trie_rule;
+    merged.trie_nodes_.push_back(node);
+  }
+  for (uint32_t i = 0; i < tables.num_trie_rules; ++i) {
+    merged.trie_rules_.push_back(tables.trie_rules[i] + first_rule);
+  }
+  for (uint32_t i = 0; i < tables.num_sitemaps; ++i) {
+    RobotsRuleSet::Segment sitemap = tables.sitemaps[i];
+    sitemap.offset = Intern(literal(sitemap));
+    merged.sitemaps_.push_back(sitemap);
+  }
+
+  const uint32_t rule_set = index_.first_groups_.size();
+  index_.first_groups_.push_back(first_group);
+  index_.num_groups_.push_back(tables.num_groups);
+  index_.first_sitemaps_.push_back(first_sitemap);
+  index_.num_sitemaps_.push_back(tables.num_sitemaps);
+  index_.max_match_steps_.push_back(rules.max_match_steps_);
+  index_.flags_.push_back((rules.fallback_allowed_ ? kFallbackAllowed : 0) |
+                          (rules.limit_exceeded_ ? kLimitExceeded : 0));
+  rule_sets_.emplace(std::move(encoding), rule_set);
+  return rule_set;
+}
+
+uint32_t RobotsBulkIndex::Builder::Intern(std::string_view literal) {
+  std::string& literals = index_.rules_.literals_;
+  const auto inserted =
+      literals_.emplace(std::string(literal), literals.size());
+  if (inserted.second) literals.append(literal.data(), literal.size());
+  return inserted.first->second;
+}
+
+void RobotsBulkIndex::Builder::Build(RobotsBulkIndex* index) {
+  // Stable, so that the last rules added for a host come last among its own.
+  std::stable_sort(hosts_.begin(), hosts_.end(),
+                   [](const Host& a, const Host& b) {
+                     return a.hash < b.hash ||
+                            (a.hash == b.hash && a.name < b.name);
+                   });
+  for (size_t i = 0; i < hosts_.size(); ++i) {
+    const Host& host = hosts_[i];
+    if (i + 1 < hosts_.size() && hosts_[i + 1].hash == host.hash &&
+        hosts_[i + 1].name == host.name) {
+      continue;
+    }
+    RobotsRuleSet::Segment name;
+    name.offset = index_.host_chars_.size();
+    name.length = host.name.size();
+    index_.host_hashes_.push_back(host.hash);
+    index_.host_names_.push_back(name);
+    index_.host_rule_sets_.push_back(host.rule_set);
+    index_.host_chars_ += host.name;
+  }
+  index_.partition_ = partition_;
+  index_.num_partitions_ = num_partitions_;
+
+  *index = std::move(index_);
+  index_ = RobotsBulkIndex();
+  hosts_.clear();
+  host_chars_size_ = 0;
+  rule_sets_.clear();
+  literals_.clear();
+}
+
+}  // namespace googlebot
@@ -0,0 +1,257 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_bulk.h
+// -----------------------------------------------------------------------------
+//
+// An index of the robots.txt rules of many hosts, for offline pipelines
+// filtering (host, url) rows by the thousands or billions.
+//
+// Example:
+//
+//   RobotsBulkIndex::Builder builder;
+//   builder.SetPartition(node, num_nodes);
+//   for (const auto& [host, body] : robots_files) {
+//     if (RobotsBulkIndex::PartitionOf(host, num_nodes) == node) {
+//       builder.AddHost(host, body);
+//     }
+//   }
+//   RobotsBulkIndex index;
+//   builder.Build(&index);
+//   std::vector<RobotsMatchResult> verdicts =
+//       index.MatchBatch(UserAgentSet({"FooBot"}), rows);
+//
+// The index is built from the bodies once, and can be saved with ToBytes()
+// and loaded back, e.g. memory-mapped, with FromBytes().
+
+#ifndef THIRD_PARTY_ROBOTSTXT_ROBOTS_BULK_H__
+#define THIRD_PARTY_ROBOTSTXT_ROBOTS_BULK_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "robots.h"
+
+namespace googlebot {
+
+// A URL to check against the robots.txt of its host.
+struct RobotsBulkQuery {
+  std::string_view host;
+  std::string_view url;
+};
+
+// RobotsBulkIndex maps hosts to the compiled rules of their robots.txt, like a
+// RobotsRuleSet per host, stored once for all of them:
+//
+//  - Hosts whose robots.txt compile to the same rules share them. Most hosts
+//    have one of a few common robots.txt files, or none. The rules keep the
+//    line numbers reported as 'matching_line', so bodies only differing in
+//    trailing comments or in the case of their user agents share them, but
+//    not ones where a comment or blank line moves the other lines.
+//  - The distinct rule sets are merged into the tables of a single
+//    RobotsRuleSet, where the literals of the patterns, the user agents and
+//    the sitemaps are each stored once.
+//  - The hosts and the group offsets of their rule set are columns of their
+//    own, with the hosts sorted by HostHash().
+//
+// Hosts are compared ignoring case, so "example.com" is the same host as
+// "Example.COM". Any string naming a site consistently can be used, e.g.
+// RobotsCache::OriginOf() of the URLs.
+//
+// The hosts can be split between several indexes, e.g. one per node, by their
+// PartitionOf(). Rows sorted by the HostHash() of their host, as after a
+// shuffle keyed on it, are matched with mostly sequential accesses to the
+// index.
+//
+// An index is immutable once built, so it can be shared between threads.
+class RobotsBulkIndex {
+ public:
+  class Builder;
+
+  // Creates an empty index, without any host.
+  RobotsBulkIndex() = default;
+
+  // Hash of 'host' ignoring case. It only depends on the bytes of 'host', so
+  // that all the nodes of a pipeline agree on it.
+  static uint64_t HostHash(std::string_view host);
+
+  // Returns the partition of 'host' among 'num_partitions', in
+  // [0, num_partitions).
+  static uint32_t PartitionOf(std::string_view host, uint32_t num_partitions);
+
+  // Gets the rule set of 'host' into '*rules', as a view valid as long as the
+  // index is. Returns false if 'host' is not in the index.
+  bool Find(std::string_view host, RobotsRuleSet* rules) const;
+
+  // Same as RobotsRuleSet::Match() on the rule set of 'host'. URLs of hosts
+  // not in the index are allowed, as if their robots.txt was empty.
+  RobotsMatchResult Match(const UserAgentSet& user_agents,
+                          std::string_view host, std::string_view url) const;
+
+  // Returns the result of Match() for each row, in the same order. Rows of the
+  // same host next to each other only look it up once.
+  std::vector<RobotsMatchResult> MatchBatch(
+      const std::vector<std::string>* user_agents,
+      const std::vector<RobotsBulkQuery>& rows) const;
+  std::vector<RobotsMatchResult> MatchBatch(
+      const UserAgentSet& user_agents,
+      const std::vector<RobotsBulkQuery>& rows) const;
+
+  // Number of hosts, and of distinct rule sets they use.
+  size_t num_hosts() const { return columns().num_hosts; }
+  size_t num_rule_sets() const { return columns().num_rule_sets; }
+
+  // The partition the index was built for, see Builder::SetPartition().
+  uint32_t partition() const { return partition_; }
+  uint32_t num_partitions() const { return num_partitions_; }
+
+  // Approximate number of bytes of memory used by the index.
+  size_t SpaceUsed() const;
+
+  // Encodes the index in a flat, versioned binary format, that FromBytes() can
+  // query in place. The encoding is in host byte order.
+  std::string ToBytes() const;
+
+  // Loads an index encoded by ToBytes() into 'index'. Nothing is copied:
+  // 'bytes' must outlive 'index', and must be 8-byte aligned. Returns false,
+  // leaving 'index' unchanged, if 'bytes' is not a valid encoding from this
+  // version of the library.
+  static bool FromBytes(std::string_view bytes, RobotsBulkIndex* index);
+
+ private:
+  // The columns of the index, either in the vectors below or in the bytes
+  // given to FromBytes().
+  struct Columns {
+    // The hosts, sorted by hash then name.
+    const uint64_t* host_hashes;
+    const RobotsRuleSet::Segment* host_names;  // In 'host_chars', lowercased.
+    const uint32_t* host_rule_sets;
+    const char* host_chars;
+    // The rule sets, as ranges of the groups and sitemaps of 'rules_', and
+    // the limits they were compiled with.
+    const uint32_t* first_groups;
+    const uint32_t* num_groups;
+    const uint32_t* first_sitemaps;
+    const uint32_t* num_sitemaps;
+    const uint64_t* max_match_steps;
+    const uint8_t* flags;  // RuleSetFlags.
+    uint32_t num_hosts;
+    uint32_t num_rule_sets;
+    uint32_t host_chars_size;
+  };
+
+  enum RuleSetFlags : uint8_t {
+    kFallbackAllowed = 1 << 0,
+    kLimitExceeded = 1 << 1,
+  };
+
+  Columns columns() const;
+
+  // Returns the position in 'columns' of 'host', already lowercased, or -1.
+  // Looks forward from '*hint' first if 'hash' is past it, and leaves it on
+  // the host found.
+  int64_t FindHost(const Columns& columns, std::string_view host,
+                   uint64_t hash, size_t* hint) const;
+
+  // Returns a view of the rule set 'rule_set' of 'columns'.
+  RobotsRuleSet RuleSet(const Columns& columns, uint32_t rule_set) const;
+
+  std::vector<uint64_t> host_hashes_;
+  std::vector<RobotsRuleSet::Segment> host_names_;
+  std::vector<uint32_t> host_rule_sets_;
+  std::string host_chars_;
+  std::vector<uint32_t> first_groups_;
+  std::vector<uint32_t> num_groups_;
+  std::vector<uint32_t> first_sitemaps_;
+  std::vector<uint32_t> num_sitemaps_;
+  std::vector<uint64_t> max_match_steps_;
+  std::vector<uint8_t> flags_;
+  // The tables of all the distinct rule sets.
+  RobotsRuleSet rules_;
+
+  uint32_t partition_ = 0;
+  uint32_t num_partitions_ = 1;
+
+  // Set by FromBytes(), when the columns are in bytes not owned by the index.
+  // The vectors above are then empty.
+  bool mapped_ = false;
+  size_t mapped_size_ = 0;
+  Columns mapped_columns_;
+};
+
+// Compiles the robots.txt of hosts into a RobotsBulkIndex.
+class RobotsBulkIndex::Builder {
+ public:
+  Builder() : Builder(RobotsLimits()) {}
+  // Compiles the robots.txt bodies within 'limits'.
+  explicit Builder(const RobotsLimits& limits) : limits_(limits) {}
+
+  Builder(const Builder&) = delete;
+  Builder& operator=(const Builder&) = delete;
+
+  // Only accepts the hosts of 'partition' among 'num_partitions', see
+  // PartitionOf(). By default, the index has a single partition.
+  void SetPartition(uint32_t partition, uint32_t num_partitions);
+
+  // Adds 'host' with the rules of 'robots_body'. If 'host' is added again, the
+  // last rules added win. Returns false, without adding it, if 'host' is not
+  // in the partition of the builder, or if the index would not fit its 32-bit
+  // offsets anymore, in which case the hosts should be split between more
+  // partitions.
+  bool AddHost(std::string_view host, std::string_view robots_body);
+  // Same as above, with the rules already compiled, e.g. loaded with
+  // RobotsRuleSet::FromBytes().
+  bool AddHost(std::string_view host, const RobotsRuleSet& rules);
+
+  size_t num_hosts() const { return hosts_.size(); }
+  size_t num_rule_sets() const { return index_.first_groups_.size(); }
+
+  // Moves the hosts added so far into '*index', leaving the builder empty.
+  void Build(RobotsBulkIndex* index);
+
+ private:
+  struct Host {
+    uint64_t hash;
+    std::string name;  // Lowercased.
+    uint32_t rule_set;
+  };
+
+  // Returns the rule set of 'rules' in 'index_', adding it if it is new, or
+  // -1 if it does not fit.
+  int64_t AddRuleSet(const RobotsRuleSet& rules);
+  // Returns the offset of 'literal' in the literals of 'index_', adding it if
+  // it is new.
+  uint32_t Intern(std::string_view literal);
+
+  const RobotsLimits limits_;
+  uint32_t partition_ = 0;
+  uint32_t num_partitions_ = 1;
+  std::vector<Host> hosts_;
+  // Bytes of the names of 'hosts_'.
+  size_t host_chars_size_ = 0;
+  // The index being built, without its hosts until Build().
+  RobotsBulkIndex index_;
+  // Rule sets of 'index_' by their RobotsRuleSet::ToBytes().
+  std::unordered_map<std::string, uint32_t> rule_sets_;
+  // Offsets of the literals of 'index_'.
+  std::unordered_map<std::string, uint32_t> literals_;
+};
+
+}  // namespace googlebot
+#endif  // THIRD_PARTY_ROBOTSTXT_ROBOTS_BULK_H__
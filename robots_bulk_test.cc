@@ -0,0 +1,336 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file tests the index of the robots.txt of many hosts (RobotsBulkIndex).
+
+#include "robots_bulk.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::googlebot::RobotsBulkIndex;
+using ::googlebot::RobotsBulkQuery;
+using ::googlebot::RobotsMatchResult;
+using ::googlebot::RobotsRuleSet;
+using ::googlebot::UserAgentSet;
+
+const char* const kBodies[] = {
+    "",
+    "user-agent: *\n"
+    "disallow: /\n",
+    "user-agent: FooBot\n"
+    "allow: /a/index.html\n"
+    "disallow: /a\n"
+    "disallow: /*.gif$\n"
+    "crawl-delay: 2\n"
+    "user-agent: *\n"
+    "disallow: /private\n"
+    "sitemap: http://h/sitemap.xml\n",
+    "user-agent: BarBot\n"
+    "user-agent: foobot\n"
+    "disallow: /a*b\n"
+    "allow: /ab$\n",
+    "user-agent: *\n"
+    "allow: /$\n"
+    "disallow: /\n",
+};
+const char* const kUrls[] = {
+    "http://h/",        "http://h/a",     "http://h/a/index.html",
+    "http://h/ab",      "http://h/axb/c", "http://h/x.gif",
+    "http://h/private", "http://h/b",
+};
+
+std::string Host(int i) { return "host" + std::to_string(i) + ".example"; }
+
+void ExpectSame(const RobotsMatchResult& expected,
+                const RobotsMatchResult& actual) {
+  EXPECT_EQ(expected.allowed, actual.allowed);
+  EXPECT_EQ(expected.matching_line, actual.matching_line);
+  EXPECT_EQ(expected.ever_seen_specific_agent,
+            actual.ever_seen_specific_agent);
+  EXPECT_EQ(expected.limit_exceeded, actual.limit_exceeded);
+}
+
+}  // namespace
+
+// The index answers like the rule set of each host, for rows in any order.
+TEST(RobotsBulkTest, MatchesRuleSets) {
+  constexpr int kNumHosts = 200;
+  constexpr int kNumBodies = sizeof(kBodies) / sizeof(kBodies[0]);
+  RobotsBulkIndex::Builder builder;
+  for (int i = 0; i < kNumHosts; ++i) {
+    ASSERT_TRUE(builder.AddHost(Host(i), kBodies[i % kNumBodies]));
+  }
+  RobotsBulkIndex index;
+  builder.Build(&index);
+  EXPECT_EQ(kNumHosts, index.num_hosts());
+  EXPECT_EQ(0, builder.num_hosts());
+
+  std::vector<RobotsRuleSet> rules;
+  for (const char* body : kBodies) rules.emplace_back(body);
+
+  // Unknown hosts, hosts in another case, and runs of the same host.
+  std::mt19937 random(42);
+  std::vector<std::string> hosts;
+  std::vector<RobotsBulkQuery> rows;
+  for (int i = 0; i < 2000; ++i) {
+    const int host = random() % (kNumHosts + 10);
+    hosts.push_back(random() % 4 == 0 ? "HOST" + std::to_string(host) +
+                                            ".Example"
+                                      : Host(host));
+  }
+  for (int i = 0; i < 2000; ++i) {
+    const std::string& host = hosts[random() % 4 == 0 ? i : i / 8];
+    rows.push_back({host, kUrls[random() % (sizeof(kUrls) / sizeof(char*))]});
+  }
+
+  for (const std::vector<std::string>& agents :
+       std::vector<std::vector<std::string>>{
+           {"FooBot"}, {"BazBot"}, {"barbot", "BazBot"}}) {
+    const std::vector<RobotsMatchResult> results =
+        index.MatchBatch(&agents, rows);
+    ASSERT_EQ(rows.size(), results.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+      int host = -1;
+      sscanf(std::string(rows[i].host).c_str(), "%*4s%d", &host);
+      const RobotsMatchResult expected =
+          host < kNumHosts
+              ? rules[host % kNumBodies].Match(&agents, rows[i].url)
+              : RobotsMatchResult();
+      SCOPED_TRACE(std::string(rows[i].host) + " " +
+                   std::string(rows[i].url));
+      ExpectSame(expected, results[i]);
+      ExpectSame(expected,
+                 index.Match(UserAgentSet(agents), rows[i].host, rows[i].url));
+    }
+  }
+
+  RobotsRuleSet host_rules;
+  ASSERT_TRUE(index.Find("Host2.example", &host_rules));
+  double delay = 0;
+  EXPECT_TRUE(host_rules.CrawlDelay(UserAgentSet({"FooBot"}), &delay));
+  EXPECT_EQ(2, delay);
+  ASSERT_EQ(1, host_rules.Sitemaps().size());
+  EXPECT_EQ("http://h/sitemap.xml", host_rules.Sitemaps()[0]);
+  EXPECT_FALSE(index.Find("host2.example.com", &host_rules));
+}
+
+// Hosts share the rules their robots.txt compile to, and the rule sets share
+// their literals.
+TEST(RobotsBulkTest, Deduplicates) {
+  RobotsBulkIndex::Builder builder;
+  size_t separate_bytes = 0;
+  for (int i = 0; i < 1000; ++i) {
+    // The same rules, written differently.
+    const std::string body = i % 2 == 0
+                                 ? "user-agent: *\ndisallow: /cgi-bin/\n"
+                                 : "User-Agent: * # Host " + std::to_string(i) +
+                                       "\nDisallow: /cgi-bin/";
+    separate_bytes += RobotsRuleSet(body).SpaceUsed();
+    ASSERT_TRUE(builder.AddHost(Host(i), body));
+  }
+  ASSERT_TRUE(builder.AddHost(Host(1000),
+                              "user-agent: FooBot\ndisallow: /cgi-bin/\n"));
+  EXPECT_EQ(2, builder.num_rule_sets());
+
+  RobotsBulkIndex index;
+  builder.Build(&index);
+  EXPECT_EQ(1001, index.num_hosts());
+  EXPECT_EQ(2, index.num_rule_sets());
+  EXPECT_LT(index.SpaceUsed(), separate_bytes / 10);
+  EXPECT_FALSE(
+      index.Match(UserAgentSet({"FooBot"}), Host(1000), "http://h/cgi-bin/x")
+          .allowed);
+  EXPECT_TRUE(
+      index.Match(UserAgentSet({"BarBot"}), Host(1000), "http://h/cgi-bin/x")
+          .allowed);
+
+  // The last robots.txt added for a host wins.
+  builder.AddHost(Host(1), "user-agent: *\ndisallow: /\n");
+  builder.AddHost(Host(2), "user-agent: *\ndisallow: /\n");
+  builder.AddHost(Host(1), "");
+  builder.Build(&index);
+  EXPECT_EQ(2, index.num_hosts());
+  EXPECT_TRUE(index.Match(UserAgentSet({"FooBot"}), Host(1), "http://h/")
+                  .allowed);
+  EXPECT_FALSE(index.Match(UserAgentSet({"FooBot"}), Host(2), "http://h/")
+                   .allowed);
+}
+
+// Hosts with the same HostHash() are told apart by their name, in batches
+// looking them up in either order.
+TEST(RobotsBulkTest, HashCollisions) {
+  const std::string first = "nyoauba2amahd";
+  const std::string second = "uh5rb5qwvfzof";
+  ASSERT_EQ(RobotsBulkIndex::HostHash(first),
+            RobotsBulkIndex::HostHash(second));
+  RobotsBulkIndex::Builder builder;
+  ASSERT_TRUE(builder.AddHost(first, "user-agent: *\ndisallow: /first\n"));
+  ASSERT_TRUE(builder.AddHost(second, "user-agent: *\ndisallow: /second\n"));
+  for (int i = 0; i < 10; ++i) ASSERT_TRUE(builder.AddHost(Host(i), ""));
+  RobotsBulkIndex built;
+  builder.Build(&built);
+  const std::string bytes = built.ToBytes();
+  RobotsBulkIndex loaded;
+  ASSERT_TRUE(RobotsBulkIndex::FromBytes(bytes, &loaded));
+
+  for (const RobotsBulkIndex* index : {&built, &loaded}) {
+    for (const std::vector<RobotsBulkQuery>& rows :
+         std::vector<std::vector<RobotsBulkQuery>>{
+             {{first, "http://h/first"}, {second, "http://h/second"}},
+             {{second, "http://h/second"}, {first, "http://h/first"}}}) {
+      const std::vector<RobotsMatchResult> results =
+          index->MatchBatch(UserAgentSet({"FooBot"}), rows);
+      ASSERT_EQ(2, results.size());
+      for (const RobotsMatchResult& result : results) {
+        EXPECT_FALSE(result.allowed);
+        EXPECT_EQ(2, result.matching_line);
+      }
+    }
+  }
+}
+
+// Each host is in the index of exactly one partition.
+TEST(RobotsBulkTest, Partitions) {
+  constexpr uint32_t kNumPartitions = 4;
+  std::vector<RobotsBulkIndex> indexes(kNumPartitions);
+  size_t num_hosts = 0;
+  for (uint32_t partition = 0; partition < kNumPartitions; ++partition) {
+    RobotsBulkIndex::Builder builder;
+    builder.SetPartition(partition, kNumPartitions);
+    for (int i = 0; i < 100; ++i) {
+      EXPECT_EQ(RobotsBulkIndex::PartitionOf(Host(i), kNumPartitions) ==
+                    partition,
+                builder.AddHost(Host(i), "user-agent: *\ndisallow: /\n"));
+    }
+    builder.Build(&indexes[partition]);
+    EXPECT_EQ(partition, indexes[partition].partition());
+    EXPECT_EQ(kNumPartitions, indexes[partition].num_partitions());
+    num_hosts += indexes[partition].num_hosts();
+    // Hosts are rarely all in the same partition.
+    EXPECT_LT(indexes[partition].num_hosts(), 50);
+  }
+  EXPECT_EQ(100, num_hosts);
+
+  RobotsRuleSet rules;
+  for (int i = 0; i < 100; ++i) {
+    const uint32_t partition =
+        RobotsBulkIndex::PartitionOf(Host(i), kNumPartitions);
+    EXPECT_EQ(partition, RobotsBulkIndex::PartitionOf(
+                             "HOST" + std::to_string(i) + ".EXAMPLE",
+                             kNumPartitions));
+    for (uint32_t j = 0; j < kNumPartitions; ++j) {
+      EXPECT_EQ(j == partition, indexes[j].Find(Host(i), &rules)) << i;
+    }
+  }
+}
+
+TEST(RobotsBulkTest, Bytes) {
+  // Past the limits, the verdict is the fallback one.
+  googlebot::RobotsLimits limits;
+  limits.max_rules = 3;
+  limits.fallback_allowed = false;
+  RobotsBulkIndex::Builder builder(limits);
+  builder.SetPartition(1, 2);
+  int num_hosts = 0;
+  for (int i = 0; i < 100; ++i) {
+    num_hosts += builder.AddHost(
+        Host(i), kBodies[i % (sizeof(kBodies) / sizeof(kBodies[0]))]);
+  }
+  RobotsBulkIndex index;
+  builder.Build(&index);
+  const std::string bytes = index.ToBytes();
+  EXPECT_EQ(0, bytes.size() % 8);
+
+  RobotsBulkIndex loaded;
+  ASSERT_TRUE(RobotsBulkIndex::FromBytes(bytes, &loaded));
+  EXPECT_EQ(bytes, loaded.ToBytes());
+  EXPECT_EQ(num_hosts, loaded.num_hosts());
+  EXPECT_EQ(1, loaded.partition());
+  EXPECT_EQ(2, loaded.num_partitions());
+  std::vector<RobotsBulkQuery> rows;
+  std::vector<std::string> hosts = {"unknown"};
+  for (int i = 0; i < 100; ++i) hosts.push_back(Host(i));
+  for (const std::string& host : hosts) {
+    for (const char* url : kUrls) rows.push_back({host, url});
+  }
+  const std::vector<std::string> agents = {"FooBot"};
+  const std::vector<RobotsMatchResult> expected =
+      index.MatchBatch(&agents, rows);
+  const std::vector<RobotsMatchResult> actual =
+      loaded.MatchBatch(&agents, rows);
+  bool limit_exceeded = false;
+  for (size_t i = 0; i < rows.size(); ++i) {
+    SCOPED_TRACE(std::string(rows[i].host) + " " + std::string(rows[i].url));
+    ExpectSame(expected[i], actual[i]);
+    limit_exceeded |= actual[i].limit_exceeded;
+  }
+  // The limits of the rule sets are kept.
+  EXPECT_TRUE(limit_exceeded);
+
+  RobotsBulkIndex empty;
+  ASSERT_TRUE(RobotsBulkIndex::FromBytes(RobotsBulkIndex().ToBytes(), &empty));
+  EXPECT_EQ(0, empty.num_hosts());
+  EXPECT_TRUE(empty.Match(UserAgentSet({"FooBot"}), Host(0), "http://h/")
+                  .allowed);
+
+  // Invalid encodings are rejected and leave the index untouched.
+  for (size_t i = 8; i < bytes.size(); i += 37) {
+    std::string corrupted = bytes;
+    corrupted[i] ^= 1;
+    EXPECT_FALSE(RobotsBulkIndex::FromBytes(corrupted, &loaded)) << i;
+  }
+  EXPECT_FALSE(RobotsBulkIndex::FromBytes(
+      std::string_view(bytes).substr(0, bytes.size() - 8), &loaded));
+  EXPECT_FALSE(RobotsBulkIndex::FromBytes(std::string_view(), &loaded));
+  std::string other_version = bytes;
+  other_version[4] ^= 1;
+  EXPECT_FALSE(RobotsBulkIndex::FromBytes(other_version, &loaded));
+  std::string misaligned = "x" + bytes;
+  EXPECT_FALSE(RobotsBulkIndex::FromBytes(
+      std::string_view(misaligned).substr(1), &loaded));
+  EXPECT_EQ(num_hosts, loaded.num_hosts());
+
+  // Counts placing the rule sets far past the end, with a size of the rule
+  // sets wrapping the total size around to the size of the encoding.
+  const std::string one_host = [] {
+    RobotsBulkIndex::Builder builder;
+    builder.AddHost(Host(0), "user-agent: *\ndisallow: /\n");
+    RobotsBulkIndex index;
+    builder.Build(&index);
+    return index.ToBytes();
+  }();
+  std::string wrapped = one_host;
+  const uint32_t kNumHostsOffset = 24;
+  const uint32_t kRulesSizeOffset = 40;
+  const uint32_t huge_num_hosts = 1 << 28;
+  const uint32_t zero = 0;
+  // With no rule set and no host name, the rule sets start right after the
+  // 48-byte header and 20 bytes of columns per host.
+  const uint64_t rules_offset = 48 + uint64_t{20} * huge_num_hosts;
+  const uint64_t rules_size = one_host.size() - rules_offset;
+  memcpy(&wrapped[kNumHostsOffset], &huge_num_hosts, sizeof(huge_num_hosts));
+  memcpy(&wrapped[kNumHostsOffset + 4], &zero, sizeof(zero));
+  memcpy(&wrapped[kNumHostsOffset + 8], &zero, sizeof(zero));
+  memcpy(&wrapped[kRulesSizeOffset], &rules_size, sizeof(rules_size));
+  EXPECT_FALSE(RobotsBulkIndex::FromBytes(wrapped, &loaded));
+  EXPECT_EQ(num_hosts, loaded.num_hosts());
+}
@@ -0,0 +1,330 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_cache.cc
+// -----------------------------------------------------------------------------
+//
+// Implements RobotsCache, see robots_cache.h.
+
+#include "robots_cache.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "robots_ascii.h"
+
+namespace googlebot {
+
+namespace {
+
+// Initial number of buckets of the index of a shard.
+constexpr size_t kMinBuckets = 16;
+
+}  // namespace
+
+RobotsCache::Index::Index(size_t num_buckets)
+    : mask(num_buckets - 1), buckets(new std::atomic<Link*>[num_buckets]) {
+  for (size_t i = 0; i < num_buckets; ++i) {
+    buckets[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+RobotsCache::Index::~Index() {
+  for (size_t i = 0; i <= mask; ++i) {
+    Link* link = buckets[i].load(std::memory_order_relaxed);
+    while (link != nullptr) {
+      Link* next = link->next.load(std::memory_order_relaxed);
+      delete link;
+      link = next;
+    }
+  }
+}
+
+RobotsCache::RobotsCache(Options options)
+    : options_(std::move(options)),
+      shard_max_bytes_(options_.max_bytes /
+                       std::max<size_t>(options_.num_shards, 1)),
+      shards_(std::max<size_t>(options_.num_shards, 1)) {
+  for (Shard& shard : shards_) {
+    shard.index.store(new Index(kMinBuckets), std::memory_order_release);
+  }
+}
+
+RobotsCache::~RobotsCache() {
+  for (Shard& shard : shards_) {
+    delete shard.index.load(std::memory_order_relaxed);
+    for (const auto& entry : shard.entries) delete entry.second.record;
+  }
+}
+
+std::shared_ptr<const RobotsRuleSet> RobotsCache::Get(
+    const std::string& origin) {
+  ReadGuard guard(*this);
+  const Record* record = FindRecord(origin, options_.now());
+  return record != nullptr ? record->rules : nullptr;
+}
+
+const RobotsRuleSet* RobotsCache::Find(const ReadGuard& /*guard*/,
+                                       const std::string& origin) const {
+  const Record* record = FindRecord(origin, options_.now());
+  return record != nullptr ? record->rules.get() : nullptr;
+}
+
+std::shared_ptr<const RobotsRuleSet> RobotsCache::GetOrCompile(
+    const std::string& origin, const Fetcher& fetch) {
+  std::shared_ptr<const RobotsRuleSet> cached = Get(origin);
+  if (cached != nullptr) return cached;
+
+  Shard& shard = ShardFor(HashOf(origin));
+  std::shared_ptr<Flight> flight;
+  {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    // Another thread may have stored it meanwhile.
+    const Entry* entry = Lookup(&shard, origin, options_.now());
+    if (entry != nullptr) return entry->record->rules;
+
+    auto it = shard.flights.find(origin);
+    if (it != shard.flights.end()) {
+      // Another thread is compiling this origin, wait for its result.
+      flight = it->second;
+      lock.unlock();
+      std::unique_lock<std::mutex> flight_lock(flight->mutex);
+      flight->done_cv.wait(flight_lock, [&flight] { return flight->done; });
+      return flight->rules;
+    }
+    flight = std::make_shared<Flight>();
+    shard.flights.emplace(origin, flight);
+  }
+
+  // Fetch and compile without holding the shard lock, so that the other
+  // origins of the shard stay available meanwhile.
+  auto rules = std::make_shared<const RobotsRuleSet>(fetch(origin),
+                                                     options_.limits);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Store(&shard, origin, rules, options_.now());
+    shard.flights.erase(origin);
+  }
+  {
+    std::lock_guard<std::mutex> flight_lock(flight->mutex);
+    flight->rules = rules;
+    flight->done = true;
+  }
+  flight->done_cv.notify_all();
+  return rules;
+}
+
+std::shared_ptr<const RobotsRuleSet> RobotsCache::Insert(
+    const std::string& origin, std::string_view robots_body) {
+  auto rules =
+      std::make_shared<const RobotsRuleSet>(robots_body, options_.limits);
+  Shard& shard = ShardFor(HashOf(origin));
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  Store(&shard, origin, rules, options_.now());
+  return rules;
+}
+
+void RobotsCache::Erase(const std::string& origin) {
+  Shard& shard = ShardFor(HashOf(origin));
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.entries.find(origin);
+  if (it != shard.entries.end()) Remove(&shard, it);
+}
+
+size_t RobotsCache::size() const {
+  size_t size = 0;
+  for (const Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size += shard.entries.size();
+  }
+  return size;
+}
+
+size_t RobotsCache::bytes() const {
+  size_t bytes = 0;
+  for (const Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    bytes += shard.bytes;
+  }
+  return bytes;
+}
+
+const RobotsCache::Record* RobotsCache::FindRecord(
+    const std::string& origin, Clock::time_point now) const {
+  const size_t hash = HashOf(origin);
+  const Shard& shard = shards_[hash % shards_.size()];
+  const Index* index = shard.index.load(std::memory_order_acquire);
+  for (const Link* link =
+           BucketFor(*index, hash).load(std::memory_order_acquire);
+       link != nullptr; link = link->next.load(std::memory_order_acquire)) {
+    const Record* record = link->record;
+    if (record->hash != hash || record->origin != origin) continue;
+    if (record->expires <= now) return nullptr;
+    // Only write when needed, to keep the cache line of the record shared
+    // between the cores reading it.
+    const uint64_t clock = shard.clock.load(std::memory_order_relaxed);
+    if (record->last_used.load(std::memory_order_relaxed) != clock) {
+      record->last_used.store(clock, std::memory_order_relaxed);
+    }
+    return record;
+  }
+  return nullptr;
+}
+
+const RobotsCache::Entry* RobotsCache::Lookup(Shard* shard,
+                                              const std::string& origin,
+                                              Clock::time_point now) {
+  auto it = shard->entries.find(origin);
+  if (it == shard->entries.end()) return nullptr;
+  if (it->second.record->expires <= now) {
+    Remove(shard, it);
+    return nullptr;
+  }
+  shard->lru.splice(shard->lru.begin(), shard->lru, it->second.lru);
+  it->second.stamp = shard->clock.load(std::memory_order_relaxed);
+  return &it->second;
+}
+
+void RobotsCache::Store(Shard* shard, const std::string& origin,
+                        std::shared_ptr<const RobotsRuleSet> rules,
+                        Clock::time_point now) {
+  auto it = shard->entries.find(origin);
+  const size_t bytes = rules->SpaceUsed() + origin.capacity();
+  // An entry larger than the whole shard budget would only evict everything
+  // else and then itself, don't cache it.
+  if (bytes > shard_max_bytes_) {
+    if (it != shard->entries.end()) Remove(shard, it);
+    return;
+  }
+
+  const uint64_t clock = shard->clock.load(std::memory_order_relaxed) + 1;
+  shard->clock.store(clock, std::memory_order_relaxed);
+  Record* record = new Record(origin, HashOf(origin), std::move(rules),
+                              now + options_.ttl, clock);
+  if (it != shard->entries.end()) {
+    Entry& entry = it->second;
+    Publish(shard, record, entry.record);
+    shard->bytes -= entry.bytes;
+    shard->lru.splice(shard->lru.begin(), shard->lru, entry.lru);
+  } else {
+    Publish(shard, record, nullptr);
+    it = shard->entries.emplace(origin, Entry()).first;
+    it->second.lru = shard->lru.insert(shard->lru.begin(), &it->first);
+  }
+  Entry& entry = it->second;
+  entry.record = record;
+  entry.bytes = bytes;
+  entry.stamp = clock;
+  shard->bytes += bytes;
+
+  while (shard->bytes > shard_max_bytes_) {
+    auto victim = shard->entries.find(*shard->lru.back());
+    Entry& candidate = victim->second;
+    // Looked up without the lock since it took its place: second chance.
+    // Its new stamp is at least its 'last_used', so this terminates. The
+    // entry being stored fits the budget on its own, so there is always
+    // another one to evict instead.
+    if (victim == it ||
+        candidate.record->last_used.load(std::memory_order_relaxed) >
+            candidate.stamp) {
+      shard->lru.splice(shard->lru.begin(), shard->lru, candidate.lru);
+      candidate.stamp = clock;
+      continue;
+    }
+    Remove(shard, victim);
+  }
+}
+
+void RobotsCache::Remove(Shard* shard,
+                         std::unordered_map<std::string, Entry>::iterator it) {
+  Unpublish(shard, it->second.record);
+  shard->bytes -= it->second.bytes;
+  shard->lru.erase(it->second.lru);
+  shard->entries.erase(it);
+}
+
+void RobotsCache::Publish(Shard* shard, const Record* record,
+                          const Record* replaced) {
+  const Index* index = shard->index.load(std::memory_order_relaxed);
+  // Keeps about one record per bucket, the entry of 'record' is not counted
+  // yet when it is new.
+  if (shard->entries.size() + (replaced == nullptr) > index->mask + 1) {
+    Index* grown = new Index(2 * (index->mask + 1));
+    for (const auto& entry : shard->entries) {
+      const Record* old = entry.second.record;
+      std::atomic<Link*>& bucket = BucketFor(*grown, old->hash);
+      bucket.store(new Link{old, {bucket.load(std::memory_order_relaxed)}},
+                   std::memory_order_relaxed);
+    }
+    shard->index.store(grown, std::memory_order_release);
+    epochs_.Retire(index);
+    index = grown;
+  }
+  if (replaced == nullptr) {
+    std::atomic<Link*>& bucket = BucketFor(*index, record->hash);
+    bucket.store(new Link{record, {bucket.load(std::memory_order_relaxed)}},
+                 std::memory_order_release);
+    return;
+  }
+  // Replaced in place: a lookup walking the bucket meanwhile finds either
+  // record, whereas it could miss both if the new one went to the front.
+  std::atomic<Link*>* prev = FindLink(*index, replaced);
+  Link* link = prev->load(std::memory_order_relaxed);
+  prev->store(new Link{record, {link->next.load(std::memory_order_relaxed)}},
+              std::memory_order_release);
+  epochs_.Retire(link);
+  epochs_.Retire(replaced);
+}
+
+void RobotsCache::Unpublish(Shard* shard, const Record* record) {
+  std::atomic<Link*>* prev =
+      FindLink(*shard->index.load(std::memory_order_relaxed), record);
+  Link* link = prev->load(std::memory_order_relaxed);
+  // Lookups walking past 'link' still find the rest of the bucket through it
+  // until it is freed.
+  prev->store(link->next.load(std::memory_order_relaxed),
+              std::memory_order_release);
+  epochs_.Retire(link);
+  epochs_.Retire(record);
+}
+
+std::atomic<RobotsCache::Link*>* RobotsCache::FindLink(
+    const Index& index, const Record* record) const {
+  std::atomic<Link*>* prev = &BucketFor(index, record->hash);
+  for (Link* link = prev->load(std::memory_order_relaxed);
+       link->record != record; link = prev->load(std::memory_order_relaxed)) {
+    prev = &link->next;
+  }
+  return prev;
+}
+
+/* static */ std::string RobotsCache::OriginOf(std::string_view url) {
+  size_t host_start = 0;
+  const size_t scheme_end = url.find("://");
+  const size_t first_path_char = url.find_first_of("/?#");
+  if (scheme_end != std::string_view::npos && scheme_end < first_path_char) {
+    host_start = scheme_end + 3;
+  } else if (url.substr(0, 2) == "//") {
+    host_start = 2;
+  }
+  size_t host_end = url.find_first_of("/?#", host_start);
+  if (host_end == std::string_view::npos) host_end = url.size();
+
+  std::string origin(url.substr(0, host_end));
+  AsciiToLower(origin, &origin[0]);
+  return origin;
+}
+
+}  // namespace googlebot
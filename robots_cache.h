@@ -0,0 +1,262 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_cache.h
+// -----------------------------------------------------------------------------
+//
+// A thread-safe cache of compiled robots.txt rule sets (RobotsRuleSet), keyed
+// by origin, for crawlers checking many URLs of the same hosts from many
+// threads.
+//
+// Example:
+//
+//   RobotsCache cache;
+//   std::shared_ptr<const RobotsRuleSet> rules = cache.GetOrCompile(
+//       RobotsCache::OriginOf(url),
+//       [](const std::string& origin) { return FetchRobotsTxt(origin); });
+//   if (rules->OneAgentAllowed("FooBot", url)) ...
+//
+// Hot paths can avoid the reference count of the rule sets:
+//
+//   RobotsCache::ReadGuard guard(cache);
+//   const RobotsRuleSet* rules = cache.Find(guard, RobotsCache::OriginOf(url));
+//   if (rules != nullptr && rules->OneAgentAllowed("FooBot", url)) ...
+
+#ifndef THIRD_PARTY_ROBOTSTXT_ROBOTS_CACHE_H__
+#define THIRD_PARTY_ROBOTSTXT_ROBOTS_CACHE_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "robots.h"
+#include "robots_epoch.h"
+
+namespace googlebot {
+
+// RobotsCache maps origins (e.g. "https://example.com") to the compiled
+// rule set of their robots.txt.
+//
+// Entries expire 'ttl' after they were compiled. The cache is split into
+// shards, each one with its own lock, to keep contention low, and each one
+// evicting its least recently used entries once above its share of
+// 'max_bytes'. When several threads ask for an origin missing from the cache,
+// only one of them fetches and compiles its robots.txt, and the others wait
+// for its result.
+//
+// Lookups of cached origins take no lock: each shard publishes a hash index of
+// its entries that readers walk under an epoch guard (see RobotsEpochDomain),
+// and writers only free the rule sets they replace or evict once no lookup
+// can see them anymore. Since lookups cannot reorder the eviction list, an
+// entry looked up without a lock only counts as used once per write to its
+// shard: eviction gives it a second chance rather than moving it to the front
+// at each lookup.
+class RobotsCache {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Returns the robots.txt body of 'origin'. How to handle fetch failures
+  // (e.g. an empty body to allow everything, or "user-agent: *\ndisallow: /"
+  // to allow nothing) is up to the fetcher. It must not throw.
+  using Fetcher = std::function<std::string(const std::string& origin)>;
+
+  struct Options {
+    size_t num_shards = 16;
+    // Memory budget of the cache, as reported by RobotsRuleSet::SpaceUsed().
+    size_t max_bytes = 64 << 20;
+    Clock::duration ttl = std::chrono::hours(24);
+    // Limits of the rule sets compiled, so that a hostile robots.txt cannot
+    // stall the threads checking URLs against it.
+    RobotsLimits limits;
+    // Returns the current time. Tests can replace it to control expiry.
+    std::function<Clock::time_point()> now = Clock::now;
+  };
+
+  // Keeps the rule sets returned by Find() alive while it exists, even if they
+  // are replaced or evicted meanwhile. Like RobotsEpochDomain::Guard, it should
+  // be short-lived and stay on the thread that created it.
+  class ReadGuard {
+   public:
+    explicit ReadGuard(const RobotsCache& cache) : guard_(&cache.epochs_) {}
+
+   private:
+    RobotsEpochDomain::Guard guard_;
+  };
+
+  RobotsCache() : RobotsCache(Options()) {}
+  explicit RobotsCache(Options options);
+  // No ReadGuard of the cache may be left.
+  ~RobotsCache();
+
+  RobotsCache(const RobotsCache&) = delete;
+  RobotsCache& operator=(const RobotsCache&) = delete;
+
+  // Returns the cached rule set of 'origin' if it has not expired, nullptr
+  // otherwise. Never blocks.
+  std::shared_ptr<const RobotsRuleSet> Get(const std::string& origin);
+
+  // Like Get(), without taking a reference: the rule set returned stays valid
+  // until 'guard' is destroyed.
+  const RobotsRuleSet* Find(const ReadGuard& guard,
+                            const std::string& origin) const;
+
+  // Returns the cached rule set of 'origin'. If it is missing or has expired,
+  // compiles the body returned by 'fetch' and caches the result. The rule set
+  // returned stays valid after it is evicted from the cache.
+  std::shared_ptr<const RobotsRuleSet> GetOrCompile(const std::string& origin,
+                                                    const Fetcher& fetch);
+
+  // Compiles 'robots_body' and caches it as the rule set of 'origin',
+  // replacing any previous one. Concurrent lookups see either rule set, and
+  // never miss the origin.
+  std::shared_ptr<const RobotsRuleSet> Insert(const std::string& origin,
+                                              std::string_view robots_body);
+
+  // Removes the rule set of 'origin' from the cache.
+  void Erase(const std::string& origin);
+
+  // Number of entries and bytes used by the cache, expired entries included.
+  size_t size() const;
+  size_t bytes() const;
+
+  // Returns the origin of 'url', that is its lowercased scheme, host and port
+  // (e.g. "https://example.com:8080" for "HTTPS://Example.com:8080/a?b").
+  static std::string OriginOf(std::string_view url);
+
+ private:
+  // What lookups see of an entry. Immutable once published, but for
+  // 'last_used'.
+  struct Record {
+    Record(const std::string& origin, size_t hash,
+           std::shared_ptr<const RobotsRuleSet> rules,
+           Clock::time_point expires, uint64_t last_used)
+        : origin(origin),
+          hash(hash),
+          rules(std::move(rules)),
+          expires(expires),
+          last_used(last_used) {}
+
+    const std::string origin;
+    const size_t hash;
+    const std::shared_ptr<const RobotsRuleSet> rules;
+    const Clock::time_point expires;
+    // Value of Shard::clock when the record was last looked up.
+    mutable std::atomic<uint64_t> last_used;
+  };
+
+  // A link of a bucket of an Index.
+  struct Link {
+    const Record* record;
+    std::atomic<Link*> next;
+  };
+
+  // The hash index of the records of a shard. Writers, with the shard locked,
+  // push links at the front of the buckets and unlink them in place; they
+  // replace the whole index to grow it.
+  struct Index {
+    explicit Index(size_t num_buckets);
+    // Deletes the links still in its buckets, not their records.
+    ~Index();
+
+    const size_t mask;
+    const std::unique_ptr<std::atomic<Link*>[]> buckets;
+  };
+
+  struct Entry {
+    Record* record;
+    size_t bytes;
+    // Shard::clock when the entry took its place in Shard::lru.
+    uint64_t stamp;
+    std::list<const std::string*>::iterator lru;  // Position in Shard::lru.
+  };
+
+  // A compilation in progress, waited for by the other threads asking for the
+  // same origin.
+  struct Flight {
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    bool done = false;
+    std::shared_ptr<const RobotsRuleSet> rules;
+  };
+
+  struct Shard {
+    // Held by writers, lookups of cached origins do not need it.
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    // Keys of 'entries', most recently used first, as far as writers know.
+    std::list<const std::string*> lru;
+    size_t bytes = 0;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights;
+    std::atomic<const Index*> index{nullptr};
+    // Number of entries stored so far.
+    std::atomic<uint64_t> clock{0};
+  };
+
+  static size_t HashOf(const std::string& origin) {
+    return std::hash<std::string>()(origin);
+  }
+  Shard& ShardFor(size_t hash) { return shards_[hash % shards_.size()]; }
+  // Bucket of 'hash' in 'index'. The low bits of the hash chose the shard.
+  std::atomic<Link*>& BucketFor(const Index& index, size_t hash) const {
+    return index.buckets[(hash / shards_.size()) & index.mask];
+  }
+
+  // Returns the published record of 'origin' if it has not expired, and marks
+  // it as used. An epoch guard must be held.
+  const Record* FindRecord(const std::string& origin,
+                           Clock::time_point now) const;
+
+  // Returns the entry of 'origin' if it has not expired, and marks it as the
+  // most recently used. The shard must be locked.
+  const Entry* Lookup(Shard* shard, const std::string& origin,
+                      Clock::time_point now);
+
+  // Caches 'rules' for 'origin', then evicts entries until the shard is within
+  // budget. The shard must be locked.
+  void Store(Shard* shard, const std::string& origin,
+             std::shared_ptr<const RobotsRuleSet> rules,
+             Clock::time_point now);
+
+  // Removes 'it' from the shard. The shard must be locked.
+  void Remove(Shard* shard,
+              std::unordered_map<std::string, Entry>::iterator it);
+
+  // Adds 'record' to the index of 'shard', growing it if needed, in place of
+  // 'replaced' if not null, which is then retired. The shard must be locked.
+  void Publish(Shard* shard, const Record* record, const Record* replaced);
+  // Unlinks 'record' from the index of 'shard' and retires it. The shard must
+  // be locked.
+  void Unpublish(Shard* shard, const Record* record);
+  // Returns the pointer to the link of 'record' in 'index'.
+  std::atomic<Link*>* FindLink(const Index& index, const Record* record) const;
+
+  const Options options_;
+  const size_t shard_max_bytes_;
+  // Declared before the shards, which retire their records into it.
+  mutable RobotsEpochDomain epochs_;
+  std::vector<Shard> shards_;
+};
+
+}  // namespace googlebot
+#endif  // THIRD_PARTY_ROBOTSTXT_ROBOTS_CACHE_H__
@@ -0,0 +1,252 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file tests the robots.txt rule set cache (RobotsCache).
+
+#include "robots_cache.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::googlebot::RobotsCache;
+using ::googlebot::RobotsRuleSet;
+
+// Options with an adjustable clock.
+struct TestClock {
+  RobotsCache::Clock::time_point now;
+
+  RobotsCache::Options Options() {
+    RobotsCache::Options options;
+    options.num_shards = 1;
+    options.now = [this] { return now; };
+    return options;
+  }
+};
+
+}  // namespace
+
+TEST(RobotsCacheTest, OriginOf) {
+  EXPECT_EQ("http://example.com", RobotsCache::OriginOf("http://example.com"));
+  EXPECT_EQ("https://example.com:8080",
+            RobotsCache::OriginOf("HTTPS://Example.COM:8080/a/b?c#d"));
+  EXPECT_EQ("example.com", RobotsCache::OriginOf("example.com/a"));
+  EXPECT_EQ("//example.com", RobotsCache::OriginOf("//example.com?a"));
+  EXPECT_EQ("example.com", RobotsCache::OriginOf("example.com/http://a"));
+}
+
+TEST(RobotsCacheTest, CompilesOnce) {
+  RobotsCache cache;
+  int fetches = 0;
+  auto fetch = [&fetches](const std::string& origin) {
+    ++fetches;
+    return "user-agent: *\ndisallow: /private\n";
+  };
+  EXPECT_EQ(nullptr, cache.Get("http://a.com"));
+  auto rules = cache.GetOrCompile("http://a.com", fetch);
+  ASSERT_NE(nullptr, rules);
+  EXPECT_FALSE(rules->OneAgentAllowed("FooBot", "http://a.com/private"));
+  EXPECT_TRUE(rules->OneAgentAllowed("FooBot", "http://a.com/public"));
+  EXPECT_EQ(rules, cache.GetOrCompile("http://a.com", fetch));
+  EXPECT_EQ(rules, cache.Get("http://a.com"));
+  EXPECT_EQ(1, fetches);
+  EXPECT_EQ(1, cache.size());
+
+  cache.Erase("http://a.com");
+  EXPECT_EQ(nullptr, cache.Get("http://a.com"));
+  EXPECT_EQ(0, cache.size());
+  EXPECT_EQ(0, cache.bytes());
+  // Erased rule sets stay usable.
+  EXPECT_FALSE(rules->OneAgentAllowed("FooBot", "http://a.com/private"));
+}
+
+TEST(RobotsCacheTest, Expiry) {
+  TestClock clock;
+  RobotsCache::Options options = clock.Options();
+  options.ttl = std::chrono::minutes(10);
+  RobotsCache cache(options);
+
+  auto first = cache.Insert("http://a.com", "user-agent: *\ndisallow: /\n");
+  clock.now += std::chrono::minutes(9);
+  EXPECT_EQ(first, cache.Get("http://a.com"));
+  clock.now += std::chrono::minutes(1);
+  EXPECT_EQ(nullptr, cache.Get("http://a.com"));
+
+  auto second = cache.GetOrCompile(
+      "http://a.com", [](const std::string&) { return std::string(); });
+  EXPECT_NE(first, second);
+  EXPECT_TRUE(second->OneAgentAllowed("FooBot", "http://a.com/"));
+}
+
+TEST(RobotsCacheTest, EvictsLeastRecentlyUsed) {
+  const std::string body = "user-agent: *\ndisallow: /x\n";
+  const size_t entry_bytes =
+      RobotsRuleSet(body).SpaceUsed() + std::string("http://0.com").capacity();
+  TestClock clock;
+  RobotsCache::Options options = clock.Options();
+  options.max_bytes = 3 * entry_bytes;
+  RobotsCache cache(options);
+
+  cache.Insert("http://0.com", body);
+  cache.Insert("http://1.com", body);
+  cache.Insert("http://2.com", body);
+  EXPECT_EQ(3, cache.size());
+  EXPECT_EQ(3 * entry_bytes, cache.bytes());
+
+  // 0 is now more recent than 1, which gets evicted first.
+  EXPECT_NE(nullptr, cache.Get("http://0.com"));
+  cache.Insert("http://3.com", body);
+  EXPECT_EQ(3, cache.size());
+  EXPECT_EQ(nullptr, cache.Get("http://1.com"));
+  EXPECT_NE(nullptr, cache.Get("http://0.com"));
+  EXPECT_NE(nullptr, cache.Get("http://2.com"));
+  EXPECT_NE(nullptr, cache.Get("http://3.com"));
+
+  // Rule sets larger than the budget are returned but not cached.
+  std::string large = "user-agent: *\n";
+  for (int i = 0; i < 100; ++i) large += "disallow: /" + std::to_string(i) + "\n";
+  EXPECT_NE(nullptr, cache.Insert("http://large.com", large));
+  EXPECT_EQ(nullptr, cache.Get("http://large.com"));
+  EXPECT_EQ(3, cache.size());
+}
+
+TEST(RobotsCacheTest, NeverEvictsTheEntryStored) {
+  const std::string body = "user-agent: *\ndisallow: /x\n";
+  const size_t entry_bytes =
+      RobotsRuleSet(body).SpaceUsed() + std::string("http://a.com").capacity();
+  TestClock clock;
+  RobotsCache::Options options = clock.Options();
+  options.num_shards = 1;
+  options.max_bytes = 3 * entry_bytes;
+  RobotsCache cache(options);
+
+  cache.Insert("http://a.com", body);
+  cache.Insert("http://b.com", body);
+  cache.Insert("http://c.com", body);
+  cache.Erase("http://c.com");
+  // a and b get a second chance, which puts the new entry last.
+  EXPECT_NE(nullptr, cache.Get("http://a.com"));
+  EXPECT_NE(nullptr, cache.Get("http://b.com"));
+  const std::string larger = body + "disallow: /y\n";
+  EXPECT_NE(nullptr, cache.Insert("http://d.com", larger));
+  EXPECT_NE(nullptr, cache.Get("http://d.com"));
+  EXPECT_LE(cache.bytes(), options.max_bytes);
+}
+
+TEST(RobotsCacheTest, SingleFlight) {
+  RobotsCache cache;
+  std::atomic<int> fetches(0);
+  std::atomic<bool> release(false);
+  auto fetch = [&](const std::string& origin) {
+    ++fetches;
+    while (!release) std::this_thread::yield();
+    return "user-agent: *\ndisallow: /\n";
+  };
+
+  constexpr int kNumThreads = 16;
+  std::vector<std::shared_ptr<const RobotsRuleSet>> results(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&, i] {
+      results[i] = cache.GetOrCompile("http://a.com", fetch);
+    });
+  }
+  // Other origins are not blocked by the compilation in progress.
+  EXPECT_NE(nullptr, cache.GetOrCompile("http://b.com", [](const std::string&) {
+    return std::string();
+  }));
+  release = true;
+  for (auto& thread : threads) thread.join();
+
+  EXPECT_EQ(1, fetches);
+  for (const auto& result : results) {
+    ASSERT_NE(nullptr, result);
+    EXPECT_EQ(results[0], result);
+  }
+}
+
+TEST(RobotsCacheTest, FindUnderGuard) {
+  TestClock clock;
+  RobotsCache cache(clock.Options());
+  {
+    RobotsCache::ReadGuard guard(cache);
+    EXPECT_EQ(nullptr, cache.Find(guard, "http://a.com"));
+  }
+  cache.Insert("http://a.com", "user-agent: *\ndisallow: /\n");
+
+  RobotsCache::ReadGuard guard(cache);
+  const RobotsRuleSet* old_rules = cache.Find(guard, "http://a.com");
+  ASSERT_NE(nullptr, old_rules);
+  // Replaced and erased rule sets stay valid while the guard lives.
+  cache.Insert("http://a.com", "user-agent: *\nallow: /\n");
+  const RobotsRuleSet* new_rules = cache.Find(guard, "http://a.com");
+  ASSERT_NE(nullptr, new_rules);
+  EXPECT_NE(old_rules, new_rules);
+  cache.Erase("http://a.com");
+  EXPECT_EQ(nullptr, cache.Find(guard, "http://a.com"));
+  EXPECT_FALSE(old_rules->OneAgentAllowed("FooBot", "http://a.com/"));
+  EXPECT_TRUE(new_rules->OneAgentAllowed("FooBot", "http://a.com/"));
+}
+
+// Lookups never miss an origin being refreshed, nor see a freed rule set,
+// while writers replace and evict entries.
+TEST(RobotsCacheTest, ConcurrentRefresh) {
+  RobotsCache::Options options;
+  options.num_shards = 4;
+  RobotsCache cache(options);
+  constexpr int kNumOrigins = 200;
+  auto origin = [](int i) { return "http://" + std::to_string(i) + ".com"; };
+  auto body = [](int i) {
+    return "user-agent: *\ndisallow: /" + std::to_string(i) + "\n";
+  };
+  for (int i = 0; i < kNumOrigins; ++i) cache.Insert(origin(i), body(i));
+
+  std::atomic<bool> done(false);
+  std::atomic<int> misses(0), wrong(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&, t] {
+      for (int n = t; !done; ++n) {
+        const int i = n % kNumOrigins;
+        const std::string url = origin(i) + "/" + std::to_string(i);
+        RobotsCache::ReadGuard guard(cache);
+        const RobotsRuleSet* rules = cache.Find(guard, origin(i));
+        if (rules == nullptr) {
+          ++misses;
+        } else if (rules->OneAgentAllowed("FooBot", url)) {
+          ++wrong;
+        }
+      }
+    });
+  }
+  // Refreshes every origin a few times, and adds new ones to grow the
+  // indexes while they are read.
+  for (int round = 0; round < 5; ++round) {
+    for (int i = 0; i < kNumOrigins; ++i) cache.Insert(origin(i), body(i));
+    for (int i = 0; i < 100; ++i) {
+      cache.Insert(origin(kNumOrigins * (round + 1) + i), body(i));
+    }
+  }
+  done = true;
+  for (std::thread& reader : readers) reader.join();
+
+  EXPECT_EQ(0, misses);
+  EXPECT_EQ(0, wrong);
+  EXPECT_EQ(kNumOrigins + 500, cache.size());
+}
@@ -0,0 +1,123 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_corpus.cc
+// -----------------------------------------------------------------------------
+//
+// Implements RobotsCorpusEvaluator, see robots_corpus.h.
+
+#include "robots_corpus.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace googlebot {
+
+namespace {
+
+// The jobs [next, end) left to a worker. Its owner takes them from the front,
+// and thieves take the back half.
+struct JobRange {
+  std::mutex mutex;
+  size_t next = 0;
+  size_t end = 0;
+};
+
+// Takes the next job of 'range' into 'job'. Returns false if it is empty.
+bool TakeJob(JobRange* range, size_t* job) {
+  std::lock_guard<std::mutex> lock(range->mutex);
+  if (range->next == range->end) return false;
+  *job = range->next++;
+  return true;
+}
+
+// Moves the back half of the largest of 'ranges' to 'ranges[thief]', which is
+// empty. Returns false if there was nothing left to steal.
+bool StealJobs(std::vector<std::unique_ptr<JobRange>>* ranges, size_t thief) {
+  for (;;) {
+    // The sizes may change before the victim is locked again, and are only
+    // a hint.
+    size_t victim = thief;
+    size_t victim_size = 0;
+    for (size_t i = 0; i < ranges->size(); ++i) {
+      JobRange& range = *(*ranges)[i];
+      std::lock_guard<std::mutex> lock(range.mutex);
+      if (range.end - range.next > victim_size) {
+        victim = i;
+        victim_size = range.end - range.next;
+      }
+    }
+    if (victim_size == 0) return false;
+
+    size_t begin, end;
+    {
+      JobRange& range = *(*ranges)[victim];
+      std::lock_guard<std::mutex> lock(range.mutex);
+      // The victim may have taken its last jobs meanwhile, or been robbed.
+      if (range.next == range.end) continue;
+      // A single job left goes to the thief, which is idle.
+      end = range.end;
+      begin = range.next + (range.end - range.next) / 2;
+      range.end = begin;
+    }
+    JobRange& range = *(*ranges)[thief];
+    std::lock_guard<std::mutex> lock(range.mutex);
+    range.next = begin;
+    range.end = end;
+    return true;
+  }
+}
+
+}  // namespace
+
+RobotsCorpusEvaluator::RobotsCorpusEvaluator(Options options)
+    : num_threads_(options.num_threads != 0
+                       ? options.num_threads
+                       : std::max(1u, std::thread::hardware_concurrency())) {}
+
+void RobotsCorpusEvaluator::Run(const std::vector<RobotsCorpusJob>& jobs,
+                                const Callback& callback) const {
+  const size_t num_threads =
+      std::max<size_t>(1, std::min(num_threads_, jobs.size()));
+  std::vector<std::unique_ptr<JobRange>> ranges;
+  const size_t per_thread = (jobs.size() + num_threads - 1) / num_threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    ranges.emplace_back(new JobRange);
+    ranges.back()->next = std::min(jobs.size(), t * per_thread);
+    ranges.back()->end = std::min(jobs.size(), (t + 1) * per_thread);
+  }
+
+  auto work = [&](size_t t) {
+    RobotsMatcher matcher;
+    size_t job;
+    do {
+      while (TakeJob(ranges[t].get(), &job)) {
+        const RobotsCorpusJob& corpus_job = jobs[job];
+        callback(job, matcher.AllowedByRobotsBatch(corpus_job.robots_body,
+                                                   &corpus_job.user_agents,
+                                                   corpus_job.urls));
+      }
+    } while (StealJobs(&ranges, t));
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < num_threads; ++t) threads.emplace_back(work, t);
+  work(0);
+  for (std::thread& thread : threads) thread.join();
+}
+
+}  // namespace googlebot
@@ -0,0 +1,93 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_corpus.h
+// -----------------------------------------------------------------------------
+//
+// Evaluates URLs against a large corpus of robots.txt files in parallel, e.g. to
+// audit the effect of a rule change on every host crawled.
+//
+// Example:
+//
+//   std::vector<RobotsCorpusJob> jobs = ...;
+//   RobotsCorpusEvaluator evaluator;
+//   std::atomic<size_t> disallowed(0);
+//   evaluator.Run(jobs, [&](size_t job,
+//                           const std::vector<RobotsMatchResult>& results) {
+//     for (const RobotsMatchResult& result : results) {
+//       if (!result.allowed) ++disallowed;
+//     }
+//   });
+
+#ifndef THIRD_PARTY_ROBOTSTXT_ROBOTS_CORPUS_H__
+#define THIRD_PARTY_ROBOTSTXT_ROBOTS_CORPUS_H__
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "robots.h"
+
+namespace googlebot {
+
+// URLs to check against one robots.txt body.
+struct RobotsCorpusJob {
+  // Not owned, must stay valid during RobotsCorpusEvaluator::Run().
+  std::string_view robots_body;
+  std::vector<std::string> user_agents;
+  std::vector<std::string> urls;
+};
+
+// RobotsCorpusEvaluator runs jobs on a pool of threads, each one with its own
+// RobotsMatcher whose parsing and matching buffers are reused from one job to
+// the next. Each job is parsed once, for all its URLs at the same time (see
+// RobotsMatcher::AllowedByRobotsBatch()).
+//
+// The jobs are split into one contiguous range per thread. A thread that runs
+// out of jobs steals the second half of the remaining range of another one, so
+// that a few large robots.txt files do not leave the other threads idle.
+class RobotsCorpusEvaluator {
+ public:
+  struct Options {
+    // Number of threads, 0 for one per core.
+    size_t num_threads = 0;
+  };
+
+  // Called with the index of a job in the jobs given to Run(), and the results
+  // of its URLs in the same order. It is called from the thread that evaluated
+  // the job, so concurrently with other jobs, and must be thread-safe.
+  using Callback = std::function<void(
+      size_t job, const std::vector<RobotsMatchResult>& results)>;
+
+  RobotsCorpusEvaluator() : RobotsCorpusEvaluator(Options()) {}
+  explicit RobotsCorpusEvaluator(Options options);
+
+  RobotsCorpusEvaluator(const RobotsCorpusEvaluator&) = delete;
+  RobotsCorpusEvaluator& operator=(const RobotsCorpusEvaluator&) = delete;
+
+  // Evaluates all 'jobs', calling 'callback' once for each of them, in no
+  // particular order. Returns once all of them are done.
+  void Run(const std::vector<RobotsCorpusJob>& jobs,
+           const Callback& callback) const;
+
+  size_t num_threads() const { return num_threads_; }
+
+ private:
+  const size_t num_threads_;
+};
+
+}  // namespace googlebot
+#endif  // THIRD_PARTY_ROBOTSTXT_ROBOTS_CORPUS_H__
@@ -0,0 +1,95 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file tests the parallel corpus evaluator (RobotsCorpusEvaluator).
+
+#include "robots_corpus.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::googlebot::RobotsCorpusEvaluator;
+using ::googlebot::RobotsCorpusJob;
+using ::googlebot::RobotsMatcher;
+using ::googlebot::RobotsMatchResult;
+
+}  // namespace
+
+TEST(RobotsCorpusTest, MatchesLikeRobotsMatcher) {
+  std::vector<std::string> bodies;
+  for (int i = 0; i < 100; ++i) {
+    std::string body = "user-agent: FooBot\n";
+    // A few much larger bodies, for work to be stolen.
+    const int num_rules = i % 17 == 0 ? 2000 : 3;
+    for (int j = 0; j < num_rules; ++j) {
+      body += (j % 2 ? "allow: /" : "disallow: /") + std::to_string(i + j) +
+              "\n";
+    }
+    bodies.push_back(body);
+  }
+  std::vector<RobotsCorpusJob> jobs;
+  for (int i = 0; i < 1000; ++i) {
+    RobotsCorpusJob job;
+    job.robots_body = bodies[i % bodies.size()];
+    job.user_agents = {i % 2 ? "FooBot" : "BarBot"};
+    for (int j = 0; j < 5; ++j) {
+      job.urls.push_back("http://foo.bar/" + std::to_string(i % 100 + j));
+    }
+    jobs.push_back(job);
+  }
+
+  for (size_t num_threads : {1, 4, 16}) {
+    RobotsCorpusEvaluator::Options options;
+    options.num_threads = num_threads;
+    RobotsCorpusEvaluator evaluator(options);
+    EXPECT_EQ(num_threads, evaluator.num_threads());
+
+    std::mutex mutex;
+    std::vector<std::vector<RobotsMatchResult>> results(jobs.size());
+    std::vector<int> calls(jobs.size());
+    evaluator.Run(jobs, [&](size_t job,
+                            const std::vector<RobotsMatchResult>& result) {
+      std::lock_guard<std::mutex> lock(mutex);
+      results[job] = result;
+      ++calls[job];
+    });
+
+    RobotsMatcher matcher;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+      ASSERT_EQ(1, calls[i]) << i;
+      ASSERT_EQ(jobs[i].urls.size(), results[i].size()) << i;
+      for (size_t j = 0; j < jobs[i].urls.size(); ++j) {
+        EXPECT_EQ(matcher.AllowedByRobots(jobs[i].robots_body,
+                                          &jobs[i].user_agents,
+                                          jobs[i].urls[j]),
+                  results[i][j].allowed)
+            << i << " " << jobs[i].urls[j];
+        EXPECT_EQ(matcher.matching_line(), results[i][j].matching_line);
+      }
+    }
+  }
+}
+
+TEST(RobotsCorpusTest, NoJobs) {
+  std::atomic<int> calls(0);
+  RobotsCorpusEvaluator().Run(
+      {}, [&](size_t, const std::vector<RobotsMatchResult>&) { ++calls; });
+  EXPECT_EQ(0, calls);
+}
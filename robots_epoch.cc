@@ -0,0 +1,140 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_epoch.cc
+// -----------------------------------------------------------------------------
+//
+// Implements RobotsEpochDomain, see robots_epoch.h.
+
+#include "robots_epoch.h"
+
+#include <algorithm>
+
+namespace googlebot {
+
+namespace {
+
+std::atomic<uint64_t> next_domain_id(1);
+
+// The slot the thread used last, and its domain. Trying it first keeps the
+// usual read to a single uncontended compare-and-swap.
+struct LastReader {
+  uint64_t domain_id = 0;
+  void* reader = nullptr;
+};
+thread_local LastReader last_reader;
+
+}  // namespace
+
+RobotsEpochDomain::RobotsEpochDomain() : id_(next_domain_id++) {}
+
+RobotsEpochDomain::~RobotsEpochDomain() {
+  for (const Retired& retired : retired_) retired.deleter(retired.object);
+  Reader* reader = readers_.load(std::memory_order_relaxed);
+  while (reader != nullptr) {
+    Reader* next = reader->next;
+    delete reader;
+    reader = next;
+  }
+}
+
+RobotsEpochDomain::Reader* RobotsEpochDomain::Enter() {
+  // Reading the epoch before claiming the slot may only make the reader look
+  // older than it is, which delays reclamation but is safe.
+  const uint64_t state = epoch_.load(std::memory_order_acquire) << 1 | 1;
+  auto claim = [state](Reader* reader) {
+    uint64_t expected = kIdle;
+    return reader->state.compare_exchange_strong(expected, state,
+                                                 std::memory_order_seq_cst);
+  };
+
+  Reader* reader = nullptr;
+  if (last_reader.domain_id == id_ &&
+      claim(static_cast<Reader*>(last_reader.reader))) {
+    reader = static_cast<Reader*>(last_reader.reader);
+  } else {
+    for (Reader* r = readers_.load(std::memory_order_acquire); r != nullptr;
+         r = r->next) {
+      if (claim(r)) {
+        reader = r;
+        break;
+      }
+    }
+    if (reader == nullptr) {
+      // All slots are busy: more threads read than ever before.
+      reader = new Reader;
+      reader->state.store(state, std::memory_order_relaxed);
+      std::lock_guard<std::mutex> lock(mutex_);
+      reader->next = readers_.load(std::memory_order_relaxed);
+      readers_.store(reader, std::memory_order_seq_cst);
+    }
+    last_reader.domain_id = id_;
+    last_reader.reader = reader;
+  }
+  // Writers must see the slot claimed before the reader loads any pointer.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return reader;
+}
+
+void RobotsEpochDomain::Retire(void* object, void (*deleter)(void*)) {
+  std::vector<Retired> freeable;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    retired_.push_back({epoch_.load(std::memory_order_relaxed), object,
+                        deleter});
+    CollectLocked(&freeable);
+  }
+  for (const Retired& retired : freeable) retired.deleter(retired.object);
+}
+
+void RobotsEpochDomain::Reclaim() {
+  std::vector<Retired> freeable;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CollectLocked(&freeable);
+  }
+  for (const Retired& retired : freeable) retired.deleter(retired.object);
+}
+
+size_t RobotsEpochDomain::num_retired() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return retired_.size();
+}
+
+void RobotsEpochDomain::CollectLocked(std::vector<Retired>* freeable) {
+  if (retired_.empty()) return;
+  // Only written with 'mutex_' held.
+  uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+  // Two steps are enough to free everything retired so far.
+  for (int step = 0; step < 2 && retired_.back().epoch + 2 > epoch; ++step) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool all_current = true;
+    for (Reader* reader = readers_.load(std::memory_order_acquire);
+         reader != nullptr && all_current; reader = reader->next) {
+      const uint64_t state = reader->state.load(std::memory_order_seq_cst);
+      all_current = state == kIdle || state >> 1 == epoch;
+    }
+    if (!all_current) break;
+    epoch_.store(++epoch, std::memory_order_release);
+  }
+
+  auto end = std::find_if(
+      retired_.begin(), retired_.end(),
+      [epoch](const Retired& retired) { return retired.epoch + 2 > epoch; });
+  freeable->assign(retired_.begin(), end);
+  retired_.erase(retired_.begin(), end);
+}
+
+}  // namespace googlebot
@@ -0,0 +1,146 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_epoch.h
+// -----------------------------------------------------------------------------
+//
+// Epoch-based reclamation, so that readers can use objects shared with writers
+// (e.g. compiled rule sets) without locks or reference counts, and writers can
+// replace them and free the old ones once they are no longer read.
+//
+// Example:
+//
+//   RobotsEpochDomain domain;
+//   std::atomic<const RobotsRuleSet*> rules = ...;
+//
+//   // Readers.
+//   {
+//     RobotsEpochDomain::Guard guard(&domain);
+//     const RobotsRuleSet* current = rules.load(std::memory_order_acquire);
+//     ... // 'current' stays valid until 'guard' is destroyed.
+//   }
+//
+//   // Writers.
+//   const RobotsRuleSet* old = rules.exchange(new RobotsRuleSet(body));
+//   domain.Retire(old);
+
+#ifndef THIRD_PARTY_ROBOTSTXT_ROBOTS_EPOCH_H__
+#define THIRD_PARTY_ROBOTSTXT_ROBOTS_EPOCH_H__
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace googlebot {
+
+// RobotsEpochDomain tracks the readers of a set of shared objects, and frees
+// the objects retired by writers once no reader that could still see them is
+// left.
+//
+// The domain has a global epoch. A reader records the epoch it starts in, and
+// an object retired in epoch 'e' is freed once the global epoch reaches e + 2.
+// The epoch only moves forward when all the readers in progress started in the
+// current epoch, so none of them can have seen an object retired two epochs
+// ago: it had been unlinked before they started.
+//
+// Starting and ending a read never blocks nor allocates, once the thread used
+// the domain before. Writers are serialized by a mutex of the domain, and are
+// expected to be much less frequent than readers. A reader that never ends
+// delays the reclamation of everything retired after it started, so guards
+// should be short-lived.
+class RobotsEpochDomain {
+ private:
+  struct Reader;
+
+ public:
+  // A read in progress: objects reachable from the shared structures when it
+  // starts, or later, stay valid until it is destroyed. Guards may be nested,
+  // and must be destroyed by the thread that created them, before the domain.
+  class Guard {
+   public:
+    explicit Guard(RobotsEpochDomain* domain) : reader_(domain->Enter()) {}
+    ~Guard() { reader_->state.store(kIdle, std::memory_order_release); }
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+   private:
+    Reader* const reader_;
+  };
+
+  RobotsEpochDomain();
+  // Frees all the objects still retired. No guard may be left.
+  ~RobotsEpochDomain();
+
+  RobotsEpochDomain(const RobotsEpochDomain&) = delete;
+  RobotsEpochDomain& operator=(const RobotsEpochDomain&) = delete;
+
+  // Frees 'object' with 'deleter' once no guard can see it anymore, which may
+  // be before Retire() returns. 'object' must be unreachable from the shared
+  // structures already.
+  void Retire(void* object, void (*deleter)(void*));
+
+  template <typename T>
+  void Retire(T* object) {
+    Retire(const_cast<void*>(static_cast<const void*>(object)),
+           [](void* p) { delete static_cast<T*>(p); });
+  }
+
+  // Frees the retired objects that no guard can see anymore. Retire() already
+  // does it, this is for writers that stopped retiring objects.
+  void Reclaim();
+
+  // Number of objects retired and not freed yet.
+  size_t num_retired() const;
+
+ private:
+  // State of a reader: idle, or reading since epoch 'state >> 1'.
+  static constexpr uint64_t kIdle = 0;
+
+  // A slot for a read in progress. Slots are claimed by threads as they start
+  // reading, and only freed with the domain. Each one has its own cache line,
+  // as it is written by its reader and read by writers.
+  struct alignas(64) Reader {
+    std::atomic<uint64_t> state{kIdle};
+    Reader* next = nullptr;
+  };
+
+  struct Retired {
+    uint64_t epoch;
+    void* object;
+    void (*deleter)(void*);
+  };
+
+  // Claims a slot for a read starting now.
+  Reader* Enter();
+
+  // Moves the epoch forward as far as the readers allow it, up to twice, and
+  // moves the objects that can be freed to 'freeable'. 'mutex_' must be held.
+  void CollectLocked(std::vector<Retired>* freeable);
+
+  // Never reused, so that threads can remember their slot of each domain.
+  const uint64_t id_;
+  std::atomic<uint64_t> epoch_{1};
+  // All the slots, newest first. New ones are pushed with 'mutex_' held.
+  std::atomic<Reader*> readers_{nullptr};
+
+  mutable std::mutex mutex_;
+  // In increasing epoch order.
+  std::vector<Retired> retired_;
+};
+
+}  // namespace googlebot
+#endif  // THIRD_PARTY_ROBOTSTXT_ROBOTS_EPOCH_H__
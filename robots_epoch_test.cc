@@ -0,0 +1,133 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file tests the epoch-based reclamation (RobotsEpochDomain).
+
+#include "robots_epoch.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::googlebot::RobotsEpochDomain;
+
+// Counts its live instances.
+struct Counted {
+  explicit Counted(std::atomic<int>* live, int value = 0)
+      : live(live), value(value) {
+    ++*live;
+  }
+  ~Counted() {
+    --*live;
+    value = -1;
+  }
+
+  std::atomic<int>* const live;
+  int value;
+};
+
+}  // namespace
+
+TEST(RobotsEpochTest, FreesWithoutReaders) {
+  std::atomic<int> live(0);
+  RobotsEpochDomain domain;
+  domain.Retire(new Counted(&live));
+  EXPECT_EQ(0, live);
+  EXPECT_EQ(0, domain.num_retired());
+}
+
+TEST(RobotsEpochTest, GuardDelaysReclamation) {
+  std::atomic<int> live(0);
+  RobotsEpochDomain domain;
+  {
+    RobotsEpochDomain::Guard guard(&domain);
+    domain.Retire(new Counted(&live));
+    {
+      // Nested guards, and guards started after the retirement, are fine.
+      RobotsEpochDomain::Guard nested(&domain);
+      domain.Retire(new Counted(&live));
+    }
+    EXPECT_EQ(2, live);
+    domain.Reclaim();
+    EXPECT_EQ(2, live);
+  }
+  domain.Reclaim();
+  EXPECT_EQ(0, live);
+
+  // A reader on another thread delays reclamation too.
+  std::atomic<bool> reading(false), release(false);
+  std::thread reader([&] {
+    RobotsEpochDomain::Guard guard(&domain);
+    reading = true;
+    while (!release) std::this_thread::yield();
+  });
+  while (!reading) std::this_thread::yield();
+  domain.Retire(new Counted(&live));
+  EXPECT_EQ(1, live);
+  release = true;
+  reader.join();
+  domain.Reclaim();
+  EXPECT_EQ(0, live);
+}
+
+TEST(RobotsEpochTest, DestructorFreesRetired) {
+  std::atomic<int> live(0);
+  {
+    RobotsEpochDomain domain;
+    {
+      RobotsEpochDomain::Guard guard(&domain);
+      domain.Retire(new Counted(&live));
+    }
+    EXPECT_EQ(1, live);
+  }
+  EXPECT_EQ(0, live);
+}
+
+// Readers never see a freed object while a writer keeps replacing it.
+TEST(RobotsEpochTest, ConcurrentReplacement) {
+  std::atomic<int> live(0);
+  RobotsEpochDomain domain;
+  std::atomic<Counted*> current(new Counted(&live, 0));
+  std::atomic<bool> done(false);
+
+  constexpr int kNumReaders = 8;
+  std::vector<std::thread> readers;
+  std::atomic<int> failures(0);
+  for (int i = 0; i < kNumReaders; ++i) {
+    readers.emplace_back([&] {
+      int last = 0;
+      while (!done) {
+        RobotsEpochDomain::Guard guard(&domain);
+        const Counted* counted = current.load(std::memory_order_acquire);
+        // Values only grow, and freed objects have a value of -1.
+        if (counted->value < last) ++failures;
+        last = counted->value;
+      }
+    });
+  }
+  for (int i = 1; i <= 20000; ++i) {
+    domain.Retire(current.exchange(new Counted(&live, i)));
+  }
+  done = true;
+  for (std::thread& reader : readers) reader.join();
+
+  EXPECT_EQ(0, failures);
+  domain.Reclaim();
+  EXPECT_EQ(1, live);
+  delete current.load();
+}
@@ -0,0 +1,514 @@
+// Copyright 2020 Hubert Gruniaux
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// -----------------------------------------------------------------------------
+// File: robots_fuzz.cc
+// -----------------------------------------------------------------------------
+//
+// Differential fuzz target. Each input is a robots.txt body and some URLs,
+// checked with a fresh RobotsMatcher per URL, the oracle, and with every faster
+// way of getting the same verdicts: RobotsRuleSet, also once encoded and
+// loaded back, AllowedByRobotsBatch(), AllowedByRobotsPerAgent(), an
+// early-exit matcher, and RobotsStreamParser fed in chunks. The vectorized
+// functions of robots_ascii.h are checked against <cctype>. Any difference
+// aborts, with the input, the URL and both verdicts on stderr.
+//
+// An input is laid out as:
+//
+//   <robots.txt body> [ "\0\0agents:" <agent>[,<agent>]... ('\n' <url>)... ]
+//
+// The body ends at the last "\0\0agents:", so that it can contain any byte,
+// NULs included. Without that trailer, the agent is "FooBot" and the URLs are
+// made from the patterns of the body, so that mutating the body alone is
+// enough to hit its rules.
+//
+// Built with -fsanitize=fuzzer, this is a libFuzzer target, which AFL++ also
+// runs through its libFuzzer driver. Built with ROBOTS_FUZZ_REPLAY defined, it
+// has its own main() instead, replaying files and directories of inputs such
+// as a fuzzing corpus:
+//
+//   robots-fuzz-replay [--repeat=<n>] [--slow_ratio=<r>] [--compile_ratio=<c>]
+//                      [--min_us=<us>] <file or dir>...
+//
+// The replay also times every path on each input, keeping the fastest of <n>
+// runs, and prints one tab-separated line per input. An input is flagged as
+// SLOW when matching its URLs against the rule set or as a batch takes more
+// than <r> times the oracle, when the streaming parse takes more than <r> times
+// parsing the whole body, or when compiling the rule set takes more than <c>
+// times parsing it. Runs shorter than <min_us> are too noisy to be flagged. The
+// exit status is 1 if any input was flagged.
+
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "robots.h"
+#include "robots_ascii.h"
+
+#ifdef ROBOTS_FUZZ_REPLAY
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#endif
+
+namespace {
+
+using ::googlebot::RobotsMatcher;
+using ::googlebot::RobotsMatchResult;
+using ::googlebot::RobotsRuleSet;
+
+// Nanoseconds spent by each path on one input.
+struct FuzzTimings {
+  int64_t oracle = 0;
+  int64_t compile = 0;
+  int64_t rule_set = 0;
+  int64_t batch = 0;
+  int64_t parse = 0;
+  int64_t stream = 0;
+};
+
+class Stopwatch {
+ public:
+  Stopwatch() : start_(std::chrono::steady_clock::now()) {}
+  int64_t ElapsedNanos() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start_)
+        .count();
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+struct FuzzInput {
+  std::string_view body;
+  std::vector<std::string> agents;
+  std::vector<std::string> urls;
+};
+
+std::vector<std::string_view> Split(std::string_view text, char separator) {
+  std::vector<std::string_view> parts;
+  size_t start = 0;
+  for (size_t end; (end = text.find(separator, start)) != text.npos;
+       start = end + 1) {
+    parts.push_back(text.substr(start, end - start));
+  }
+  parts.push_back(text.substr(start));
+  return parts;
+}
+
+// Returns a URL matched by 'pattern', if it is a path: wildcards match "x",
+// and the end anchor nothing.
+bool UrlForPattern(std::string_view pattern, std::string* url) {
+  while (!pattern.empty() && googlebot::AsciiIsSpace(pattern.front())) {
+    pattern.remove_prefix(1);
+  }
+  if (pattern.empty() || pattern.front() != '/') return false;
+  *url = "http://example.com";
+  for (char ch : pattern.substr(0, 256)) {
+    if (ch == '$' || googlebot::AsciiIsSpace(ch) || ch == '#') break;
+    url->push_back(ch == '*' ? 'x' : ch);
+  }
+  return true;
+}
+
+FuzzInput DecodeInput(std::string_view data) {
+  constexpr size_t kMaxDerivedUrls = 8;
+  constexpr std::string_view kTrailer("\0\0agents:", 9);
+  FuzzInput input;
+  const size_t separator = data.rfind(kTrailer);
+  input.body = data.substr(0, separator);
+  if (separator != data.npos) {
+    std::vector<std::string_view> lines =
+        Split(data.substr(separator + kTrailer.size()), '\n');
+    for (std::string_view agent : Split(lines[0], ',')) {
+      input.agents.emplace_back(agent);
+    }
+    input.urls.assign(lines.begin() + 1, lines.end());
+  } else {
+    input.agents.push_back("FooBot");
+    input.urls = {"http://example.com/", "http://example.com/index.html"};
+    std::string url;
+    for (std::string_view line : Split(input.body, '\n')) {
+      const size_t colon = line.find(':');
+      if (colon != line.npos && UrlForPattern(line.substr(colon + 1), &url)) {
+        input.urls.push_back(url);
+        if (input.urls.size() == kMaxDerivedUrls) break;
+      }
+    }
+  }
+  return input;
+}
+
+// Records the callbacks of the parser, to compare parses of the same body.
+class RecordingHandler final : public googlebot::RobotsParseHandler {
+ public:
+  void HandleRobotsStart() override { log_ += "start\n"; }
+  void HandleRobotsEnd() override { log_ += "end\n"; }
+  void HandleUserAgent(int line_num, std::string_view value) override {
+    Record("user-agent", line_num, value);
+  }
+  void HandleAllow(int line_num, std::string_view value) override {
+    Record("allow", line_num, value);
+  }
+  void HandleDisallow(int line_num, std::string_view value) override {
+    Record("disallow", line_num, value);
+  }
+  void HandleCrawlDelay(int line_num, std::string_view value) override {
+    Record("crawl-delay", line_num, value);
+  }
+  void HandleSitemap(int line_num, std::string_view value) override {
+    Record("sitemap", line_num, value);
+  }
+  void HandleUnknownAction(int line_num, std::string_view action,
+                           std::string_view value) override {
+    Record(action, line_num, value);
+  }
+
+  const std::string& log() const { return log_; }
+
+ private:
+  void Record(std::string_view directive, int line_num,
+              std::string_view value) {
+    log_ += std::to_string(line_num);
+    log_ += ' ';
+    log_ += directive;
+    log_ += ": ";
+    log_ += value;
+    log_ += '\n';
+  }
+
+  std::string log_;
+};
+
+[[noreturn]] void Mismatch(const FuzzInput& input, std::string_view path,
+                           std::string_view url,
+                           const RobotsMatchResult& expected,
+                           const RobotsMatchResult& actual) {
+  std::fprintf(stderr,
+               "%.*s differs from RobotsMatcher for url '%.*s':\n"
+               "  expected allowed=%d matching_line=%d specific_agent=%d\n"
+               "  actual   allowed=%d matching_line=%d specific_agent=%d\n"
+               "robots.txt:\n%.*s\n",
+               static_cast<int>(path.size()), path.data(),
+               static_cast<int>(url.size()), url.data(), expected.allowed,
+               expected.matching_line, expected.ever_seen_specific_agent,
+               actual.allowed, actual.matching_line,
+               actual.ever_seen_specific_agent,
+               static_cast<int>(input.body.size()), input.body.data());
+  std::abort();
+}
+
+void CheckSame(const FuzzInput& input, std::string_view path,
+               std::string_view url, const RobotsMatchResult& expected,
+               const RobotsMatchResult& actual) {
+  // The early-exit path does not report on the specific agents.
+  if (expected.allowed != actual.allowed ||
+      expected.matching_line != actual.matching_line) {
+    Mismatch(input, path, url, expected, actual);
+  }
+}
+
+void CheckSameWithAgent(const FuzzInput& input, std::string_view path,
+                        std::string_view url,
+                        const RobotsMatchResult& expected,
+                        const RobotsMatchResult& actual) {
+  CheckSame(input, path, url, expected, actual);
+  if (expected.ever_seen_specific_agent != actual.ever_seen_specific_agent) {
+    Mismatch(input, path, url, expected, actual);
+  }
+}
+
+void CheckMatchers(const FuzzInput& input, FuzzTimings* timings) {
+  std::vector<RobotsMatchResult> expected;
+  {
+    Stopwatch stopwatch;
+    for (const std::string& url : input.urls) {
+      RobotsMatcher matcher;
+      RobotsMatchResult result;
+      result.allowed = matcher.AllowedByRobots(input.body, &input.agents, url);
+      result.matching_line = matcher.matching_line();
+      result.ever_seen_specific_agent = matcher.ever_seen_specific_agent();
+      expected.push_back(result);
+    }
+    timings->oracle = stopwatch.ElapsedNanos();
+  }
+
+  {
+    Stopwatch compile_stopwatch;
+    const RobotsRuleSet rules(input.body);
+    timings->compile = compile_stopwatch.ElapsedNanos();
+    Stopwatch stopwatch;
+    std::vector<RobotsMatchResult> results;
+    for (const std::string& url : input.urls) {
+      results.push_back(rules.Match(&input.agents, url));
+    }
+    timings->rule_set = stopwatch.ElapsedNanos();
+    for (size_t i = 0; i < input.urls.size(); ++i) {
+      CheckSameWithAgent(input, "RobotsRuleSet", input.urls[i], expected[i],
+                         results[i]);
+    }
+
+    // FromBytes() needs 8-byte aligned bytes.
+    const std::string bytes = rules.ToBytes();
+    std::vector<uint64_t> aligned((bytes.size() + 7) / 8);
+    bytes.copy(reinterpret_cast<char*>(aligned.data()), bytes.size());
+    RobotsRuleSet loaded;
+    if (!RobotsRuleSet::FromBytes(
+            std::string_view(reinterpret_cast<const char*>(aligned.data()),
+                             bytes.size()),
+            &loaded)) {
+      std::fprintf(stderr, "FromBytes() rejected ToBytes()\n");
+      std::abort();
+    }
+    for (size_t i = 0; i < input.urls.size(); ++i) {
+      CheckSameWithAgent(input, "RobotsRuleSet::FromBytes()", input.urls[i],
+                         expected[i],
+                         loaded.Match(&input.agents, input.urls[i]));
+    }
+
+    const std::vector<RobotsMatchResult> per_agent =
+        rules.MatchPerAgent(input.agents, input.urls[0]);
+    RobotsMatcher matcher;
+    const std::vector<RobotsMatchResult> matcher_per_agent =
+        matcher.AllowedByRobotsPerAgent(input.body, input.agents,
+                                        input.urls[0]);
+    for (size_t i = 0; i < input.agents.size(); ++i) {
+      RobotsMatcher one_agent;
+      RobotsMatchResult result;
+      result.allowed = one_agent.OneAgentAllowedByRobots(
+          input.body, input.agents[i], input.urls[0]);
+      result.matching_line = one_agent.matching_line();
+      result.ever_seen_specific_agent = one_agent.ever_seen_specific_agent();
+      CheckSameWithAgent(input, "RobotsRuleSet::MatchPerAgent()",
+                         input.urls[0], result, per_agent[i]);
+      CheckSameWithAgent(input, "AllowedByRobotsPerAgent()", input.urls[0],
+                         result, matcher_per_agent[i]);
+    }
+  }
+
+  {
+    Stopwatch stopwatch;
+    RobotsMatcher matcher;
+    const std::vector<RobotsMatchResult> results =
+        matcher.AllowedByRobotsBatch(input.body, &input.agents, input.urls);
+    timings->batch = stopwatch.ElapsedNanos();
+    for (size_t i = 0; i < input.urls.size(); ++i) {
+      CheckSameWithAgent(input, "AllowedByRobotsBatch()", input.urls[i],
+                         expected[i], results[i]);
+    }
+  }
+
+  for (size_t i = 0; i < input.urls.size(); ++i) {
+    RobotsMatcher matcher;
+    matcher.set_early_exit(true);
+    RobotsMatchResult result;
+    result.allowed =
+        matcher.AllowedByRobots(input.body, &input.agents, input.urls[i]);
+    result.matching_line = matcher.matching_line();
+    CheckSame(input, "early exit", input.urls[i], expected[i], result);
+  }
+}
+
+void CheckParsers(const FuzzInput& input, FuzzTimings* timings) {
+  RecordingHandler whole;
+  {
+    Stopwatch stopwatch;
+    googlebot::ParseRobotsTxt(input.body, &whole);
+    timings->parse = stopwatch.ElapsedNanos();
+  }
+  RecordingHandler inlined;
+  googlebot::ParseRobotsTxt(input.body, inlined);
+  if (inlined.log() != whole.log()) {
+    std::fprintf(stderr, "ParseRobotsTxt(Handler&) differs:\n%s---\n%s",
+                 whole.log().c_str(), inlined.log().c_str());
+    std::abort();
+  }
+
+  // Timed with the first chunk size, on the lines of the usual reads. The
+  // sizes of a few bytes split the line breaks and the byte order mark.
+  const size_t chunk_sizes[] = {4096, 1, 2, 3,
+                                1 + input.body.size() % 61};
+  for (size_t chunk_size : chunk_sizes) {
+    Stopwatch stopwatch;
+    RecordingHandler streamed;
+    googlebot::RobotsStreamParser parser(&streamed);
+    for (size_t pos = 0; pos < input.body.size(); pos += chunk_size) {
+      parser.Feed(input.body.substr(pos, chunk_size));
+    }
+    parser.Finish();
+    if (chunk_size == chunk_sizes[0]) {
+      timings->stream = stopwatch.ElapsedNanos();
+    }
+    if (streamed.log() != whole.log()) {
+      std::fprintf(stderr,
+                   "RobotsStreamParser with %zu-byte chunks differs:\n%s---\n"
+                   "%s",
+                   chunk_size, whole.log().c_str(), streamed.log().c_str());
+      std::abort();
+    }
+  }
+}
+
+void CheckAscii(std::string_view text) {
+  std::string lower(text.size(), '\0');
+  googlebot::AsciiToLower(text, &lower[0]);
+  size_t token_length = 0;
+  while (token_length < text.size() &&
+         (googlebot::AsciiIsAlpha(text[token_length]) ||
+          text[token_length] == '_' || text[token_length] == '-')) {
+    ++token_length;
+  }
+  bool failed = googlebot::AsciiProductTokenLength(text) != token_length;
+  for (size_t i = 0; i < text.size(); ++i) {
+    failed |= lower[i] != static_cast<char>(std::tolower(
+                              static_cast<unsigned char>(text[i])));
+  }
+  // Both halves, the same length when 'text' has an even one.
+  const std::string_view a = text.substr(0, text.size() / 2);
+  const std::string_view b = text.substr(a.size(), a.size());
+  const std::string_view lower_a = std::string_view(lower).substr(0, a.size());
+  const std::string_view lower_b =
+      std::string_view(lower).substr(a.size(), b.size());
+  failed |= googlebot::AsciiEqualsIgnoreCase(a, b) != (lower_a == lower_b);
+  failed |= !googlebot::AsciiEqualsIgnoreCase(text, lower);
+  if (failed) {
+    std::fprintf(stderr, "robots_ascii.h differs from <cctype> on:\n%.*s\n",
+                 static_cast<int>(text.size()), text.data());
+    std::abort();
+  }
+}
+
+void CheckInput(std::string_view data, FuzzTimings* timings) {
+  FuzzInput input = DecodeInput(data);
+  if (input.urls.empty()) input.urls.push_back("http://example.com/");
+  CheckMatchers(input, timings);
+  CheckParsers(input, timings);
+  CheckAscii(input.body);
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  FuzzTimings timings;
+  CheckInput(std::string_view(reinterpret_cast<const char*>(data), size),
+             &timings);
+  return 0;
+}
+
+#ifdef ROBOTS_FUZZ_REPLAY
+namespace {
+
+bool ParseFlag(std::string_view arg, std::string_view name, double* value) {
+  if (arg.substr(0, name.size()) != name) return false;
+  *value = std::atof(std::string(arg.substr(name.size())).c_str());
+  return true;
+}
+
+void ShowHelp(const char* name) {
+  std::fprintf(stderr,
+               "Replays fuzz inputs, checking and timing every path.\n"
+               "Usage: %s [--repeat=<n>] [--slow_ratio=<r>] "
+               "[--compile_ratio=<c>] [--min_us=<us>] <file or dir>...\n",
+               name);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  double repeat = 3;
+  double slow_ratio = 2;
+  double compile_ratio = 10;
+  double min_us = 50;
+  std::vector<std::filesystem::path> files;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (ParseFlag(arg, "--repeat=", &repeat) ||
+        ParseFlag(arg, "--slow_ratio=", &slow_ratio) ||
+        ParseFlag(arg, "--compile_ratio=", &compile_ratio) ||
+        ParseFlag(arg, "--min_us=", &min_us)) {
+      continue;
+    }
+    if (arg == "-h" || arg == "-help" || arg == "--help") {
+      ShowHelp(argv[0]);
+      return 0;
+    }
+    std::error_code error;
+    if (std::filesystem::is_directory(arg, error)) {
+      for (const auto& entry :
+           std::filesystem::recursive_directory_iterator(arg)) {
+        if (entry.is_regular_file()) files.push_back(entry.path());
+      }
+    } else {
+      files.emplace_back(arg);
+    }
+  }
+  if (files.empty() || repeat < 1) {
+    ShowHelp(argv[0]);
+    return 2;
+  }
+  std::sort(files.begin(), files.end());
+
+  std::printf("input\tbytes\toracle_us\tcompile_us\trule_set_us\tbatch_us\t"
+              "parse_us\tstream_us\n");
+  auto is_slow = [min_us](int64_t fast, int64_t reference, double ratio) {
+    return fast > min_us * 1000 && fast > ratio * reference;
+  };
+  int num_slow = 0;
+  for (const std::filesystem::path& file : files) {
+    std::ifstream stream(file, std::ios::binary);
+    if (!stream) {
+      std::fprintf(stderr, "Failed to read file \"%s\"\n", file.c_str());
+      return 2;
+    }
+    const std::string data((std::istreambuf_iterator<char>(stream)),
+                           std::istreambuf_iterator<char>());
+
+    FuzzTimings best;
+    for (int run = 0; run < repeat; ++run) {
+      FuzzTimings timings;
+      CheckInput(data, &timings);
+      if (run == 0) best = timings;
+      best.oracle = std::min(best.oracle, timings.oracle);
+      best.compile = std::min(best.compile, timings.compile);
+      best.rule_set = std::min(best.rule_set, timings.rule_set);
+      best.batch = std::min(best.batch, timings.batch);
+      best.parse = std::min(best.parse, timings.parse);
+      best.stream = std::min(best.stream, timings.stream);
+    }
+    const bool slow = is_slow(best.rule_set, best.oracle, slow_ratio) ||
+                      is_slow(best.batch, best.oracle, slow_ratio) ||
+                      is_slow(best.stream, best.parse, slow_ratio) ||
+                      is_slow(best.compile, best.parse, compile_ratio);
+    num_slow += slow;
+    std::printf("%s\t%zu\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f%s\n",
+                file.c_str(), data.size(), best.oracle / 1e3,
+                best.compile / 1e3, best.rule_set / 1e3,
+                best.batch / 1e3, best.parse / 1e3, best.stream / 1e3,
+                slow ? "\tSLOW" : "");
+  }
+  if (num_slow > 0) {
+    std::fprintf(stderr, "%d of %zu inputs are slower than expected\n",
+                 num_slow, files.size());
+    return 1;
+  }
+  return 0;
+}
+#endif  // ROBOTS_FUZZ_REPLAY
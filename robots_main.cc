@@ -21,6 +21,9 @@
 // parsing and matching algorithms.
 // Usage:
 //     robots_main <local_path_to_robotstxt> <user_agent> <url>
+//     robots_main [--threads=<n>] --batch <local_path_to_robotstxt> <user_agent>
+//     robots_main [--threads=<n>] --batch_tsv
+//     robots_main [--threads=<n>] --serve <socket_path> <robots_dir>
 // Arguments:
 // local_path_to_robotstxt: local path to a file containing robots.txt records.
 //   For example: /home/users/username/robots.txt
@@ -37,25 +40,137 @@
 //   2 when --help is requested or if there is something invalid in the flags
 //   passed.
 //
+// Batch modes, for checking many URLs at once. The robots.txt files are
+// compiled once, and the URLs checked in parallel on <n> threads (by default
+// one per core). The verdicts are written in the order of the input, one line
+// each:
+//   --batch: reads one URL per line on stdin, and prints
+//     <url> TAB <ALLOWED|DISALLOWED> TAB <matching line>
+//   --batch_tsv: reads lines of
+//     <host> TAB <local_path_to_robotstxt> TAB <user_agent> TAB <url>
+//   on stdin, the <host> column being ignored, and prints each of them
+//   followed by
+//     TAB <ALLOWED|DISALLOWED> TAB <matching line>
+//   The matching line is 0 when no rule matched. Return code: 0, or 2 on error.
+//
+// Server mode, to answer queries of long-running processes without starting
+// one per URL (not available on Windows):
+//   --serve: listens on the Unix socket <socket_path>, and answers queries on
+//   <n> threads. The robots.txt of host <host> is the file <robots_dir>/<host>,
+//   a missing one allowing everything. Each one is compiled once, then cached
+//   for a day. Clients may send several queries without waiting for the
+//   answers, which come back in the same order. All integers are unsigned, big
+//   endian, and each message is prefixed by the 32 bits length of the rest:
+//     query:  <length:32> <host length:32> <host> <agent length:32> <agent>
+//             <url>
+//     answer: <length:32 = 5> <verdict:8> <matching line:32>
+//   with a verdict of 0 for DISALLOWED, 1 for ALLOWED, and 2 for an invalid
+//   query. Queries longer than 1 MiB close the connection. Runs until killed,
+//   or returns 2 if the socket cannot be set up.
+//
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 #include "robots.h"
+#include "robots_cache.h"
 
-bool LoadFile(const std::string& filename, std::string* result) {
-  std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-  if (file.is_open()) {
-    size_t size = file.tellg();
-    std::vector<char> buffer(size);
-    file.seekg(0, std::ios::beg);
-    file.read(buffer.data(), size);
-    file.close();
-    if (!file) return false;  // file reading error (failbit or badbit).
-    result->assign(buffer.begin(), buffer.end());
-    return true;
-  }
-  return false;
-}
+// The contents of a file, memory-mapped when possible.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile() {
+#ifndef _WIN32
+    if (mapped_ != nullptr) munmap(mapped_, contents_.size());
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Loads the file 'filename', or stdin. Returns false on error.
+  bool Load(const std::string& filename) {
+#ifndef _WIN32
+    const int fd = open(filename.c_str(), O_RDONLY);
+    return fd >= 0 && Load(fd);
+#else
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    return file.is_open() && Read(file);
+#endif
+  }
+
+  bool LoadStdin() {
+#ifndef _WIN32
+    return Load(STDIN_FILENO);
+#else
+    return Read(std::cin);
+#endif
+  }
+
+  std::string_view contents() const { return contents_; }
+
+ private:
+#ifndef _WIN32
+  // Loads the file 'fd' is open on, and closes it unless it is stdin.
+  bool Load(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED) {
+        if (fd != STDIN_FILENO) close(fd);
+        mapped_ = mapped;
+        contents_ = std::string_view(static_cast<const char*>(mapped),
+                                     st.st_size);
+        return true;
+      }
+    }
+    // Empty files, pipes and the like are read instead.
+    char buffer[1 << 16];
+    ssize_t size;
+    while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+      buffer_.append(buffer, size);
+    }
+    if (fd != STDIN_FILENO) close(fd);
+    contents_ = buffer_;
+    return size == 0;
+  }
+#else
+  bool Read(std::istream& stream) {
+    buffer_.assign(std::istreambuf_iterator<char>(stream),
+                   std::istreambuf_iterator<char>());
+    contents_ = buffer_;
+    return !stream.bad();
+  }
+#endif
+
+  void* mapped_ = nullptr;
+  std::string buffer_;
+  std::string_view contents_;
+};
 
 void ShowHelp(int argc, char** argv) {
   std::cerr << "Shows whether the given user_agent and URI combination"
@@ -65,6 +180,15 @@ void ShowHelp(int argc, char** argv) {
   std::cerr << "Usage: " << std::endl
             << "  " << argv[0] << " <robots.txt filename> <user_agent> <URI>"
             << std::endl
+            << "  " << argv[0]
+            << " [--threads=<n>] --batch <robots.txt filename> <user_agent>"
+            << " < URIs" << std::endl
+            << "  " << argv[0] << " [--threads=<n>] --batch_tsv"
+            << " < host<TAB>robots.txt filename<TAB>user_agent<TAB>URI lines"
+            << std::endl
+            << "  " << argv[0]
+            << " [--threads=<n>] --serve <socket path> <robots.txt directory>"
+            << std::endl
             << std::endl;
   std::cerr << "The URI must be %-encoded according to RFC3986." << std::endl
             << std::endl;
@@ -73,23 +197,488 @@ void ShowHelp(int argc, char** argv) {
             << std::endl;
 }
 
+// Splits 'text' into its lines, without their line ending. A last line without
+// line ending is kept, empty lines are skipped.
+std::vector<std::string_view> SplitLines(std::string_view text) {
+  std::vector<std::string_view> lines;
+  while (!text.empty()) {
+    size_t end = text.find('\n');
+    if (end == std::string_view::npos) end = text.size();
+    std::string_view line = text.substr(0, end);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (!line.empty()) lines.push_back(line);
+    text.remove_prefix(std::min(end + 1, text.size()));
+  }
+  return lines;
+}
+
+// Splits 'line' at its tabs into exactly 'n' fields. Returns false if it does
+// not have as many.
+bool SplitFields(std::string_view line, size_t n,
+                 std::vector<std::string_view>* fields) {
+  fields->clear();
+  for (size_t i = 0; i + 1 < n; ++i) {
+    const size_t tab = line.find('\t');
+    if (tab == std::string_view::npos) return false;
+    fields->push_back(line.substr(0, tab));
+    line.remove_prefix(tab + 1);
+  }
+  if (line.find('\t') != std::string_view::npos) return false;
+  fields->push_back(line);
+  return true;
+}
+
+// Calls 'check(line, output)' on each line of 'lines' on 'num_threads' threads,
+// each thread on a contiguous range of lines, then writes all the outputs to
+// stdout in the order of the lines.
+template <typename CheckFn>
+void CheckInParallel(const std::vector<std::string_view>& lines,
+                     size_t num_threads, const CheckFn& check) {
+  num_threads = std::max<size_t>(1, std::min(num_threads, lines.size()));
+  std::vector<std::string> outputs(num_threads);
+  std::vector<std::thread> threads;
+  const size_t per_thread = (lines.size() + num_threads - 1) / num_threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t] {
+      const size_t begin = std::min(lines.size(), t * per_thread);
+      const size_t end = std::min(lines.size(), begin + per_thread);
+      for (size_t i = begin; i < end; ++i) check(lines[i], &outputs[t]);
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  for (const std::string& output : outputs) {
+    fwrite(output.data(), 1, output.size(), stdout);
+  }
+  fflush(stdout);
+}
+
+// Appends the verdict columns of 'result' to 'output'.
+void AppendVerdict(const googlebot::RobotsMatchResult& result,
+                   std::string* output) {
+  output->append(result.allowed ? "\tALLOWED\t" : "\tDISALLOWED\t");
+  output->append(std::to_string(result.matching_line));
+  output->push_back('\n');
+}
+
+// --batch: checks the URLs on stdin against one robots.txt.
+int RunBatch(const std::string& filename, const std::string& user_agent,
+             size_t num_threads) {
+  MappedFile robots_file;
+  if (!robots_file.Load(filename)) {
+    std::cerr << "failed to read file \"" << filename << "\"" << std::endl;
+    return 2;
+  }
+  MappedFile input;
+  if (!input.LoadStdin()) {
+    std::cerr << "failed to read stdin" << std::endl;
+    return 2;
+  }
+  const googlebot::RobotsRuleSet rules(robots_file.contents());
+  const googlebot::UserAgentSet user_agents(
+      std::vector<std::string>(1, user_agent));
+  CheckInParallel(SplitLines(input.contents()), num_threads,
+                  [&](std::string_view line, std::string* output) {
+                    output->append(line.data(), line.size());
+                    AppendVerdict(rules.Match(user_agents, line), output);
+                  });
+  return 0;
+}
+
+// --batch_tsv: checks the host, robots.txt, agent and URL lines on stdin.
+// The host is only copied to the output.
+int RunBatchTsv(size_t num_threads) {
+  MappedFile input;
+  if (!input.LoadStdin()) {
+    std::cerr << "failed to read stdin" << std::endl;
+    return 2;
+  }
+  const std::vector<std::string_view> lines = SplitLines(input.contents());
+
+  // Compile each robots.txt file once.
+  std::map<std::string_view, std::unique_ptr<googlebot::RobotsRuleSet>> rules;
+  std::vector<std::string_view> fields;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (!SplitFields(lines[i], 4, &fields)) {
+      std::cerr << "line " << i + 1 << ": expected 4 tab-separated fields"
+                << std::endl;
+      return 2;
+    }
+    auto& rule_set = rules[fields[1]];
+    if (rule_set != nullptr) continue;
+    MappedFile robots_file;
+    const std::string filename(fields[1]);
+    if (!robots_file.Load(filename)) {
+      std::cerr << "failed to read file \"" << filename << "\"" << std::endl;
+      return 2;
+    }
+    rule_set.reset(new googlebot::RobotsRuleSet(robots_file.contents()));
+  }
+
+  CheckInParallel(
+      lines, num_threads, [&](std::string_view line, std::string* output) {
+        // Each thread remembers the last agent it saw, most inputs being
+        // sorted or having few agents.
+        thread_local std::string last_agent;
+        thread_local googlebot::UserAgentSet user_agents;
+        thread_local std::vector<std::string_view> fields;
+        SplitFields(line, 4, &fields);
+        if (user_agents.empty() || fields[2] != last_agent) {
+          last_agent.assign(fields[2].data(), fields[2].size());
+          user_agents.Clear();
+          user_agents.Insert(last_agent);
+        }
+        output->append(line.data(), line.size());
+        AppendVerdict(rules.at(fields[1])->Match(user_agents, fields[3]),
+                      output);
+      });
+  return 0;
+}
+
+#ifndef _WIN32
+// Longest query accepted by --serve.
+constexpr uint32_t kMaxQueryBytes = 1 << 20;
+// A connection is not read from while this many answer bytes wait to be sent,
+// so that a client not reading its answers cannot exhaust the memory.
+constexpr size_t kMaxPendingAnswerBytes = 1 << 20;
+// How long a thread stops accepting clients when out of file descriptors,
+// instead of being woken up again right away by the same pending client.
+constexpr int kAcceptBackoffMillis = 100;
+
+enum ServeVerdict : uint8_t {
+  kServeDisallowed = 0,
+  kServeAllowed = 1,
+  kServeInvalidQuery = 2,
+};
+
+uint32_t ReadUint32(const char* bytes) {
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(bytes);
+  return uint32_t{b[0]} << 24 | uint32_t{b[1]} << 16 | uint32_t{b[2]} << 8 |
+         uint32_t{b[3]};
+}
+
+void AppendUint32(uint32_t value, std::string* output) {
+  output->push_back(static_cast<char>(value >> 24));
+  output->push_back(static_cast<char>(value >> 16));
+  output->push_back(static_cast<char>(value >> 8));
+  output->push_back(static_cast<char>(value));
+}
+
+// Takes a 32 bits length followed by as many bytes from the front of 'bytes'
+// into 'field'. Returns false if 'bytes' is too short.
+bool TakeField(std::string_view* bytes, std::string_view* field) {
+  if (bytes->size() < 4) return false;
+  const uint32_t length = ReadUint32(bytes->data());
+  if (bytes->size() - 4 < length) return false;
+  *field = bytes->substr(4, length);
+  bytes->remove_prefix(4 + length);
+  return true;
+}
+
+// A client of --serve, owned by the thread that accepted it.
+struct ServeConnection {
+  explicit ServeConnection(int fd) : fd(fd) {}
+  ~ServeConnection() { close(fd); }
+
+  // Returns the length of the query at the front of 'input', 0 if it is not
+  // complete yet.
+  size_t CompleteQueryBytes() const {
+    if (input.size() < 4) return 0;
+    const size_t length = 4 + size_t{ReadUint32(input.data())};
+    return input.size() >= length ? length : 0;
+  }
+  size_t pending_answer_bytes() const { return output.size() - output_pos; }
+
+  const int fd;
+  // Bytes read and not answered yet.
+  std::string input;
+  // Answers, sent up to 'output_pos'.
+  std::string output;
+  size_t output_pos = 0;
+  // The client will not send more queries.
+  bool eof = false;
+};
+
+// State of --serve shared by its threads.
+class RobotsServer {
+ public:
+  explicit RobotsServer(std::string robots_dir)
+      : robots_dir_(std::move(robots_dir)) {}
+
+  // Answers the queries of the clients accepting on 'listen_fd'. Only returns
+  // on error.
+  void Run(int listen_fd);
+
+ private:
+  // The agent of the previous query of a thread, most clients asking for few
+  // agents.
+  struct AgentCache {
+    std::string agent;
+    googlebot::UserAgentSet user_agents;
+  };
+
+  // Appends the answer to 'query', without its length, to 'output'.
+  void Answer(std::string_view query, AgentCache* agent_cache,
+              std::string* output);
+
+  // Reads what 'connection' sent, then answers its complete queries and sends
+  // the answers. Returns false once it should be closed.
+  bool Serve(ServeConnection* connection, bool readable,
+             AgentCache* agent_cache);
+
+  // Returns the robots.txt of 'host', an empty one if there is none.
+  std::string Fetch(const std::string& host) const {
+    MappedFile robots_file;
+    if (!robots_file.Load(robots_dir_ + "/" + host)) return std::string();
+    return std::string(robots_file.contents());
+  }
+
+  const std::string robots_dir_;
+  googlebot::RobotsCache cache_;
+};
+
+void RobotsServer::Answer(std::string_view query, AgentCache* agent_cache,
+                          std::string* output) {
+  std::string_view host, agent;
+  // Hosts name files of 'robots_dir_', which they must not escape.
+  if (!TakeField(&query, &host) || !TakeField(&query, &agent) ||
+      host.empty() || host == "." || host == ".." ||
+      host.find_first_of(std::string_view("/\0", 2)) != host.npos) {
+    AppendUint32(5, output);
+    output->push_back(static_cast<char>(kServeInvalidQuery));
+    AppendUint32(0, output);
+    return;
+  }
+  if (agent_cache->user_agents.empty() || agent != agent_cache->agent) {
+    agent_cache->agent.assign(agent.data(), agent.size());
+    agent_cache->user_agents.Clear();
+    agent_cache->user_agents.Insert(agent_cache->agent);
+  }
+  const std::string origin(host);
+  const std::string_view url = query;
+
+  googlebot::RobotsMatchResult result;
+  bool cached;
+  {
+    googlebot::RobotsCache::ReadGuard guard(cache_);
+    const googlebot::RobotsRuleSet* rules = cache_.Find(guard, origin);
+    cached = rules != nullptr;
+    if (cached) result = rules->Match(agent_cache->user_agents, url);
+  }
+  if (!cached) {
+    auto fetch = [this](const std::string& host) { return Fetch(host); };
+    result = cache_.GetOrCompile(origin, fetch)
+                 ->Match(agent_cache->user_agents, url);
+  }
+  AppendUint32(5, output);
+  output->push_back(
+      static_cast<char>(result.allowed ? kServeAllowed : kServeDisallowed));
+  AppendUint32(result.matching_line, output);
+}
+
+bool RobotsServer::Serve(ServeConnection* connection, bool readable,
+                         AgentCache* agent_cache) {
+  while (readable) {
+    char buffer[1 << 16];
+    const ssize_t size = read(connection->fd, buffer, sizeof(buffer));
+    if (size > 0) {
+      connection->input.append(buffer, size);
+      if (connection->input.size() >= 4 &&
+          ReadUint32(connection->input.data()) > kMaxQueryBytes) {
+        return false;
+      }
+      // Enough to answer, the rest is read once the answers are sent.
+      if (connection->input.size() >= kMaxPendingAnswerBytes) break;
+      continue;
+    }
+    if (size == 0) {
+      connection->eof = true;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      return false;
+    }
+    break;
+  }
+
+  size_t query_bytes;
+  for (;;) {
+    // Answers the queries read so far, in order.
+    size_t consumed = 0;
+    while (connection->pending_answer_bytes() < kMaxPendingAnswerBytes) {
+      std::string_view input(connection->input);
+      input.remove_prefix(consumed);
+      if (input.size() < 4) break;
+      const size_t length = 4 + size_t{ReadUint32(input.data())};
+      if (length - 4 > kMaxQueryBytes) return false;
+      if (input.size() < length) break;
+      Answer(input.substr(4, length - 4), agent_cache, &connection->output);
+      consumed += length;
+    }
+    connection->input.erase(0, consumed);
+
+    while (connection->pending_answer_bytes() > 0) {
+      const ssize_t size = write(
+          connection->fd, connection->output.data() + connection->output_pos,
+          connection->pending_answer_bytes());
+      if (size < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return false;
+      }
+      connection->output_pos += size;
+    }
+    if (connection->pending_answer_bytes() == 0) {
+      connection->output.clear();
+      connection->output_pos = 0;
+    } else if (connection->output_pos > connection->output.size() / 2) {
+      connection->output.erase(0, connection->output_pos);
+      connection->output_pos = 0;
+    }
+    // Queries left because of too many pending answers, which are sent now.
+    query_bytes = connection->CompleteQueryBytes();
+    if (query_bytes == 0 || connection->pending_answer_bytes() > 0) break;
+  }
+  return !connection->eof || query_bytes != 0 ||
+         connection->pending_answer_bytes() > 0;
+}
+
+void RobotsServer::Run(int listen_fd) {
+  AgentCache agent_cache;
+  std::vector<std::unique_ptr<ServeConnection>> connections;
+  std::vector<pollfd> fds;
+  std::chrono::steady_clock::time_point accept_resume;
+  for (;;) {
+    // The listening socket is not polled while accepting is backed off.
+    fds.assign(1, pollfd{listen_fd, POLLIN, 0});
+    int timeout_millis = -1;
+    const auto now = std::chrono::steady_clock::now();
+    if (now < accept_resume) {
+      fds[0].events = 0;
+      timeout_millis = static_cast<int>(
+          std::chrono::ceil<std::chrono::milliseconds>(accept_resume - now)
+              .count());
+    }
+    for (const auto& connection : connections) {
+      short events = 0;
+      if (!connection->eof && connection->pending_answer_bytes() <
+                                  kMaxPendingAnswerBytes) {
+        events |= POLLIN;
+      }
+      if (connection->pending_answer_bytes() > 0) events |= POLLOUT;
+      fds.push_back(pollfd{connection->fd, events, 0});
+    }
+    if (poll(fds.data(), fds.size(), timeout_millis) < 0) {
+      if (errno == EINTR) continue;
+      perror("poll");
+      return;
+    }
+
+    for (size_t i = 1; i < fds.size(); ++i) {
+      if (fds[i].revents == 0) continue;
+      const bool readable = fds[i].revents & (POLLIN | POLLHUP | POLLERR);
+      if (!Serve(connections[i - 1].get(), readable, &agent_cache)) {
+        connections[i - 1].reset();
+      }
+    }
+    connections.erase(std::remove(connections.begin(), connections.end(),
+                                  nullptr),
+                      connections.end());
+
+    // All the threads poll the socket, the first one to accept a client
+    // serves it.
+    if (fds[0].revents & POLLIN) {
+      int fd;
+      while ((fd = accept(listen_fd, nullptr, nullptr)) >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        connections.emplace_back(new ServeConnection(fd));
+      }
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+          errno == ENOMEM) {
+        perror("accept");
+        accept_resume = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(kAcceptBackoffMillis);
+      }
+    }
+  }
+}
+
+// --serve: answers queries on the Unix socket 'socket_path'.
+int RunServe(const std::string& socket_path, const std::string& robots_dir,
+             size_t num_threads) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "invalid socket path \"" << socket_path << "\"" << std::endl;
+    return 2;
+  }
+  memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  // Replaces the socket of a previous server.
+  struct stat st;
+  if (stat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(socket_path.c_str());
+  }
+
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0 ||
+      bind(listen_fd, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    perror(("failed to listen on \"" + socket_path + "\"").c_str());
+    return 2;
+  }
+  fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+  // Writing to a client that left fails with EPIPE instead.
+  signal(SIGPIPE, SIG_IGN);
+
+  RobotsServer server(robots_dir);
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < num_threads; ++t) {
+    threads.emplace_back([&server, listen_fd] { server.Run(listen_fd); });
+  }
+  server.Run(listen_fd);
+  for (std::thread& thread : threads) thread.join();
+  return 2;
+}
+#endif  // _WIN32
+
 int main(int argc, char** argv) {
   std::string filename = argc >= 2 ? argv[1] : "";
   if (filename == "-h" || filename == "-help" || filename == "--help") {
     ShowHelp(argc, argv);
     return 2;
   }
+
+  size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  int arg = 1;
+  static const char kThreadsFlag[] = "--threads=";
+  if (arg < argc &&
+      strncmp(argv[arg], kThreadsFlag, sizeof(kThreadsFlag) - 1) == 0) {
+    num_threads = std::max(1, atoi(argv[arg] + sizeof(kThreadsFlag) - 1));
+    ++arg;
+  }
+  const std::string mode = arg < argc ? argv[arg] : "";
+  if (mode == "--batch" && argc - arg == 3) {
+    return RunBatch(argv[arg + 1], argv[arg + 2], num_threads);
+  }
+  if (mode == "--batch_tsv" && argc - arg == 1) {
+    return RunBatchTsv(num_threads);
+  }
+#ifndef _WIN32
+  if (mode == "--serve" && argc - arg == 3) {
+    return RunServe(argv[arg + 1], argv[arg + 2], num_threads);
+  }
+#endif
+
   if (argc != 4) {
     std::cerr << "Invalid amount of arguments. Showing help." << std::endl
               << std::endl;
     ShowHelp(argc, argv);
     return 2;
   }
-  std::string robots_content;
-  if (!(LoadFile(filename, &robots_content))) {
+  MappedFile robots_file;
+  if (!robots_file.Load(filename)) {
     std::cerr << "failed to read file \"" << filename << "\"" << std::endl;
     return 2;
   }
+  const std::string_view robots_content = robots_file.contents();
 
   std::string user_agent = argv[2];
   std::vector<std::string> user_agents(1, user_agent);
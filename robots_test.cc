@@ -17,19 +17,48 @@
 // https://tools.ietf.org/html/draft-koster-rep
 #include "robots.h"
 
+#include <cstdlib>
+#include <new>
 #include <string>
 
 #include "gtest/gtest.h"
 #include "absl/strings/str_cat.h"
 
+// Counts the allocations made while 'count_allocations' is set, to check that a
+// reused matcher does not allocate.
+static bool count_allocations = false;
+static int num_allocations = 0;
+
+void* operator new(size_t size) {
+  if (count_allocations) ++num_allocations;
+  void* ptr = malloc(size != 0 ? size : 1);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+// Not inlined, for compilers not to pair free() with the new expressions.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+
 namespace {
 
 using ::googlebot::RobotsMatcher;
+using ::googlebot::RobotsRuleSet;
+using ::googlebot::UserAgentSet;
 
 bool IsUserAgentAllowed(const std::string_view robotstxt,
                         const std::string& useragent, const std::string& url) {
   RobotsMatcher matcher;
-  return matcher.OneAgentAllowedByRobots(robotstxt, useragent, url);
+  const bool allowed =
+      matcher.OneAgentAllowedByRobots(robotstxt, useragent, url);
+
+  // The compiled rule set must always agree with the matcher.
+  const RobotsRuleSet rules(robotstxt);
+  EXPECT_EQ(allowed, rules.OneAgentAllowed(useragent, url))
+      << "user-agent: " << useragent << " url: " << url;
+  return allowed;
 }
 
 // Google-specific: system test.
@@ -467,6 +496,33 @@ TEST(RobotsUnittest, ID_SpecialCharacters) {
   }
 }
 
+// Wildcards may match empty sequences, several wildcards may follow each other
+// and a '$' is only an anchor at the very end of a pattern.
+TEST(RobotsUnittest, ID_SpecialCharacters_Wildcards) {
+  const std::string_view robotstxt =
+      "User-agent: FooBot\n"
+      "Disallow: /a*b**c$\n"
+      "Disallow: /x$y\n"
+      "Disallow: /*.php$\n"
+      "Disallow: /*?*sid=*&\n"
+      "Allow: /*\n";
+  EXPECT_FALSE(IsUserAgentAllowed(robotstxt, "FooBot", "http://foo.bar/abc"));
+  EXPECT_FALSE(
+      IsUserAgentAllowed(robotstxt, "FooBot", "http://foo.bar/a/b/c/bc"));
+  EXPECT_TRUE(IsUserAgentAllowed(robotstxt, "FooBot", "http://foo.bar/abcd"));
+  EXPECT_TRUE(IsUserAgentAllowed(robotstxt, "FooBot", "http://foo.bar/acb"));
+  EXPECT_FALSE(IsUserAgentAllowed(robotstxt, "FooBot", "http://foo.bar/x$yz"));
+  EXPECT_TRUE(IsUserAgentAllowed(robotstxt, "FooBot", "http://foo.bar/x"));
+  EXPECT_FALSE(
+      IsUserAgentAllowed(robotstxt, "FooBot", "http://foo.bar/a.php.php"));
+  EXPECT_TRUE(
+      IsUserAgentAllowed(robotstxt, "FooBot", "http://foo.bar/a.php?x=1"));
+  EXPECT_FALSE(IsUserAgentAllowed(robotstxt, "FooBot",
+                                  "http://foo.bar/p?a=1&sid=2&b=3"));
+  EXPECT_TRUE(
+      IsUserAgentAllowed(robotstxt, "FooBot", "http://foo.bar/p?a=1&sid=2"));
+}
+
 // Google-specific: "index.html" (and only that) at the end of a pattern is
 // equivalent to "/".
 TEST(RobotsUnittest, GoogleOnly_IndexHTMLisDirectory) {
@@ -735,12 +791,140 @@ TEST(RobotsUnittest, GoogleOnly_DocumentationChecks) {
   }
 }
 
+// A RobotsRuleSet reports the same matching line and agent information as
+// RobotsMatcher, for any number of URLs matched against one compiled body.
+TEST(RobotsUnittest, RuleSetMatchesLikeMatcher) {
+  const std::string_view robotstxt =
+      "allow: /orphan\n"
+      "user-agent: *\n"
+      "disallow: /\n"
+      "allow: /public\n"
+      "user-agent: FooBot\n"
+      "user-agent: BarBot/1.0\n"
+      "sitemap: http://foo.bar/sitemap.xml\n"
+      "disallow: /private\n"
+      "allow: /private/index.html\n"
+      "user-agent: BazBot\n"
+      "crawl-delay: 10\n"
+      "user-agent: QuxBot\n"
+      "disallow: /*.php$\n"
+      "disallow: /q\n"
+      "allow: /q\n";
+  const RobotsRuleSet rules(robotstxt);
+  const std::vector<std::vector<std::string>> agents = {
+      {"FooBot"}, {"barbot"}, {"BazBot"}, {"QuxBot"}, {"Other"},
+      {"Other", "QuxBot"}, {""}};
+  const std::vector<std::string> urls = {
+      "",
+      "http://foo.bar/",
+      "http://foo.bar/public/x",
+      "http://foo.bar/orphan",
+      "http://foo.bar/private/",
+      "http://foo.bar/private/index.html",
+      "http://foo.bar/private/x",
+      "http://foo.bar/a.php",
+      "http://foo.bar/a.php?x",
+      "http://foo.bar/q",
+  };
+  for (const auto& user_agents : agents) {
+    for (const auto& url : urls) {
+      RobotsMatcher matcher;
+      const bool allowed = matcher.AllowedByRobots(robotstxt, &user_agents, url);
+      const googlebot::RobotsMatchResult result = rules.Match(&user_agents, url);
+      EXPECT_EQ(allowed, result.allowed) << user_agents[0] << " " << url;
+      EXPECT_EQ(matcher.matching_line(), result.matching_line)
+          << user_agents[0] << " " << url;
+      EXPECT_EQ(matcher.ever_seen_specific_agent(),
+                result.ever_seen_specific_agent)
+          << user_agents[0] << " " << url;
+    }
+  }
+
+  // An empty rule set allows everything.
+  EXPECT_TRUE(RobotsRuleSet().OneAgentAllowed("FooBot", "http://foo.bar/"));
+}
+
+// Many rules sharing prefixes, duplicated and conflicting, as big sites have
+// them. The rule set indexes them by prefix, and must still report the same
+// verdicts and matching lines as the matcher.
+TEST(RobotsUnittest, RuleSetManyPrefixRules) {
+  std::string robotstxt = "user-agent: *\ndisallow: /\nuser-agent: FooBot\n";
+  for (int i = 0; i < 300; ++i) {
+    const std::string n = std::to_string(i % 50);
+    robotstxt += (i % 3 == 0 ? "allow: /d/" : "disallow: /d/") + n + "\n";
+    robotstxt += "disallow: /d/" + n + "/*.html$\n";
+    robotstxt += "allow: /d/" + n.substr(0, 1) + "\n";
+  }
+  robotstxt += "disallow:\nallow: /$\n";
+  const RobotsRuleSet rules(robotstxt);
+  for (const std::string agent : {"FooBot", "BarBot"}) {
+    const std::vector<std::string> user_agents(1, agent);
+    for (const std::string path :
+         {"/", "/d", "/d/", "/d/1", "/d/12", "/d/12/", "/d/12/a.html",
+          "/d/12/a.htm", "/d/49/x", "/d/7", "/e", "/d/3/b/c.html"}) {
+      const std::string url = "http://foo.bar" + path;
+      RobotsMatcher matcher;
+      const bool allowed = matcher.AllowedByRobots(robotstxt, &user_agents, url);
+      const googlebot::RobotsMatchResult result = rules.Match(&user_agents, url);
+      EXPECT_EQ(allowed, result.allowed) << agent << " " << url;
+      EXPECT_EQ(matcher.matching_line(), result.matching_line)
+          << agent << " " << url;
+    }
+  }
+}
+
+// A batch of URLs matched over a single parse gets the same verdicts as one
+// AllowedByRobots() call per URL.
+TEST(RobotsUnittest, BatchMatchesLikeSingleCalls) {
+  const std::string_view robotstxt =
+      "user-agent: *\n"
+      "disallow: /\n"
+      "allow: /public\n"
+      "user-agent: FooBot\n"
+      "disallow: /private\n"
+      "allow: /private/index.html\n"
+      "disallow: /*.php$\n";
+  const std::vector<std::string> urls = {
+      "",
+      "http://foo.bar/",
+      "http://foo.bar/public/x",
+      "http://foo.bar/private/",
+      "http://foo.bar/private/index.html",
+      "http://foo.bar/private/x",
+      "http://foo.bar/a.php",
+      "http://foo.bar/a.php?x",
+  };
+  for (const std::string agent : {"FooBot", "BarBot"}) {
+    const std::vector<std::string> user_agents(1, agent);
+    RobotsMatcher batch_matcher;
+    const std::vector<googlebot::RobotsMatchResult> results =
+        batch_matcher.AllowedByRobotsBatch(robotstxt, &user_agents, urls);
+    ASSERT_EQ(urls.size(), results.size());
+    for (size_t i = 0; i < urls.size(); ++i) {
+      RobotsMatcher matcher;
+      EXPECT_EQ(matcher.AllowedByRobots(robotstxt, &user_agents, urls[i]),
+                results[i].allowed)
+          << agent << " " << urls[i];
+      EXPECT_EQ(matcher.matching_line(), results[i].matching_line)
+          << agent << " " << urls[i];
+      EXPECT_EQ(matcher.ever_seen_specific_agent(),
+                results[i].ever_seen_specific_agent)
+          << agent << " " << urls[i];
+    }
+  }
+
+  RobotsMatcher matcher;
+  const std::vector<std::string> user_agents(1, "FooBot");
+  EXPECT_TRUE(matcher.AllowedByRobotsBatch(robotstxt, &user_agents, {}).empty());
+}
+
 class RobotsStatsReporter : public googlebot::RobotsParseHandler {
  public:
   void HandleRobotsStart() override {
     last_line_seen_ = 0;
     valid_directives_ = 0;
     unknown_directives_ = 0;
+    crawl_delays_ = 0;
     sitemap_.clear();
   }
   void HandleRobotsEnd() override {}
@@ -756,6 +940,7 @@ class RobotsStatsReporter : public googlebot::RobotsParseHandler {
   }
   void HandleCrawlDelay(int line_num, std::string_view value) override {
     Digest(line_num);
+    crawl_delays_++;
   }
 
   void HandleSitemap(int line_num, std::string_view value) override {
@@ -778,6 +963,9 @@ class RobotsStatsReporter : public googlebot::RobotsParseHandler {
   // Number of unknown directives.
   int unknown_directives() const { return unknown_directives_; }
 
+  // Number of crawl-delay directives.
+  int crawl_delays() const { return crawl_delays_; }
+
   // Parsed sitemap line.
   std::string sitemap() const { return sitemap_; }
 
@@ -791,6 +979,7 @@ class RobotsStatsReporter : public googlebot::RobotsParseHandler {
   int last_line_seen_ = 0;
   int valid_directives_ = 0;
   int unknown_directives_ = 0;
+  int crawl_delays_ = 0;
   std::string sitemap_;
 };
 
@@ -853,6 +1042,91 @@ TEST(RobotsUnittest, ID_LinesNumbersAreCountedCorrectly) {
   EXPECT_EQ(6, report.last_line_seen());
 }
 
+// Line endings, comments and separators are found wherever they fall in the
+// input, including past the first few bytes of long lines.
+TEST(RobotsUnittest, ID_LineEndingsAndSeparatorsAtAnyOffset) {
+  for (int padding = 0; padding < 40; ++padding) {
+    const std::string pad(padding, ' ');
+    const std::string path = "/" + std::string(padding, 'p');
+    const std::string robotstxt = pad + "User-Agent: foo\r\n" +
+                                  pad + "Allow" + pad + ":" + path + "\r" +
+                                  pad + "# Disallow: /\n" +
+                                  pad + "Disallow: /q" + pad + "#: x\r\n" +
+                                  pad + "Sitemap: " + path + "\n";
+    RobotsStatsReporter report;
+    googlebot::ParseRobotsTxt(robotstxt, &report);
+    EXPECT_EQ(4, report.valid_directives()) << padding;
+    EXPECT_EQ(0, report.unknown_directives()) << padding;
+    EXPECT_EQ(5, report.last_line_seen()) << padding;
+    EXPECT_EQ(path, report.sitemap()) << padding;
+
+    EXPECT_TRUE(IsUserAgentAllowed(robotstxt, "foo", "http://foo.bar" + path));
+    EXPECT_FALSE(IsUserAgentAllowed(robotstxt, "foo", "http://foo.bar/q"));
+  }
+}
+
+// Values that need no escaping are handed out as views into the body, which is
+// never modified, and nothing past the end of the body is ever read.
+TEST(RobotsUnittest, ID_ValuesAreViewsIntoTheBody) {
+  class ViewChecker : public googlebot::RobotsParseHandler {
+   public:
+    explicit ViewChecker(std::string_view body) : body_(body) {}
+    void HandleRobotsStart() override {}
+    void HandleRobotsEnd() override {}
+    void HandleUserAgent(int line_num, std::string_view value) override {
+      Check(value);
+    }
+    void HandleAllow(int line_num, std::string_view value) override {
+      Check(value);
+    }
+    void HandleDisallow(int line_num, std::string_view value) override {
+      Check(value);
+    }
+    void HandleCrawlDelay(int line_num, std::string_view value) override {
+      Check(value);
+    }
+    void HandleSitemap(int line_num, std::string_view value) override {
+      Check(value);
+    }
+    void HandleUnknownAction(int line_num, std::string_view action,
+                             std::string_view value) override {
+      Check(action);
+      Check(value);
+    }
+    int checked() const { return checked_; }
+
+   private:
+    void Check(std::string_view value) {
+      EXPECT_GE(value.data(), body_.data());
+      EXPECT_LE(value.data() + value.size(), body_.data() + body_.size());
+      ++checked_;
+    }
+    std::string_view body_;
+    int checked_ = 0;
+  };
+
+  const std::string storage =
+      "User-agent: FooBot\n"
+      "Disallow: /private # comment\n"
+      "Sitemap: http://foo.bar/sitemap.xml\n"
+      "Foo: bar\n"
+      "User-agent: BarBot"
+      "Bot\nDisallow: /\n";
+  // The body ends in the middle of the last user-agent line.
+  const std::string_view robotstxt(storage.data(), storage.rfind("Bot\n"));
+  ViewChecker checker(robotstxt);
+  googlebot::ParseRobotsTxt(robotstxt, &checker);
+  EXPECT_EQ(6, checker.checked());
+
+  // The agent of the last line is "BarBot", not what follows it in memory.
+  RobotsMatcher matcher;
+  EXPECT_TRUE(
+      matcher.OneAgentAllowedByRobots(robotstxt, "BarBot", "http://foo.bar/"));
+  EXPECT_TRUE(matcher.ever_seen_specific_agent());
+  EXPECT_FALSE(
+      IsUserAgentAllowed(robotstxt, "FooBot", "http://foo.bar/private"));
+}
+
 // BOM characters are unparseable and thus skipped. The rules following the line
 // are used.
 TEST(RobotsUnittest, ID_UTF8ByteOrderMarkIsSkipped) {
@@ -938,27 +1212,61 @@ TEST(RobotsUnittest, ID_NonStandardLineExample_Sitemap) {
   }
 }
 
+// Google specific: crawl-delay is recognized, including its common typos, but
+// is not an access rule.
+TEST(RobotsUnittest, ID_NonStandardLineExample_CrawlDelay) {
+  RobotsStatsReporter report;
+  static const char kRobotsTxt[] =
+      "User-Agent: foo\n"
+      "Crawl-delay: 5\n"
+      "CRAWLDELAY: 5\n"
+      "crawl delay: 5\n"
+      "crawl-delay-ish: 5\n"
+      "crawl_delay: 5\n"
+      "Disallow: /\n";
+  googlebot::ParseRobotsTxt(kRobotsTxt, &report);
+  // "crawl-delay-ish" starts like "crawl-delay", "crawl_delay" does not.
+  EXPECT_EQ(4, report.crawl_delays());
+  EXPECT_EQ(1, report.unknown_directives());
+  EXPECT_EQ(6, report.valid_directives());
+  EXPECT_FALSE(IsUserAgentAllowed(kRobotsTxt, "foo", "http://foo.bar/"));
+}
+
 }  // namespace
 
 // Integrity tests. These functions are available to the linker, but not in the
 // header, because they should only be used for testing.
 namespace googlebot {
 std::string GetPathParamsQuery(const std::string& url);
-bool MaybeEscapePattern(const char* src, char** dst);
+std::string_view GetPathParamsQueryView(std::string_view url,
+                                        bool* needs_leading_slash);
+std::string_view MaybeEscapePattern(std::string_view src,
+                                    std::string* scratch);
 }  // namespace googlebot
 
 void TestPath(const std::string& url, const std::string& expected_path) {
   EXPECT_EQ(expected_path, googlebot::GetPathParamsQuery(url));
+
+  bool needs_leading_slash;
+  const std::string_view path =
+      googlebot::GetPathParamsQueryView(url, &needs_leading_slash);
+  EXPECT_EQ(expected_path, (needs_leading_slash ? "/" : "") + std::string(path));
+  // The path is a part of the url, unless there is none.
+  if (path != "/") {
+    EXPECT_LE(url.data(), path.data());
+    EXPECT_LE(path.data() + path.size(), url.data() + url.size());
+  }
 }
 
 void TestEscape(const std::string& url, const std::string& expected) {
-  char* escaped_value = nullptr;
-  const bool is_escaped =
-      googlebot::MaybeEscapePattern(url.c_str(), &escaped_value);
-  const std::string escaped = escaped_value;
-  if (is_escaped) delete[] escaped_value;
-
+  std::string scratch = "previous content";
+  const std::string_view escaped =
+      googlebot::MaybeEscapePattern(url, &scratch);
   EXPECT_EQ(expected, escaped);
+  // Patterns that need no change are returned as they are.
+  if (url == expected) {
+    EXPECT_EQ(url.data(), escaped.data());
+  }
 }
 
 TEST(RobotsUnittest, TestGetPathParamsQuery) {
@@ -989,4 +1297,590 @@ TEST(RobotsUnittest, TestMaybeEscapePattern) {
   TestEscape("/a/b/c", "/a/b/c");
   TestEscape("á", "%C3%A1");
   TestEscape("%aa", "%AA");
+  TestEscape("%AA", "%AA");
+  TestEscape("/a%2fb%C3%a9/\xC3\xA9%", "/a%2Fb%C3%A9/%C3%A9%");
+  TestEscape("%a", "%a");
+}
+
+TEST(RobotsUnittest, UserAgentSet) {
+  UserAgentSet agents({"FooBot", "bar-bot", "FOOBOT"});
+  EXPECT_EQ(2, agents.size());
+  EXPECT_TRUE(agents.Contains("foobot"));
+  EXPECT_TRUE(agents.Contains("BAR-BOT"));
+  EXPECT_FALSE(agents.Contains("foobo"));
+  EXPECT_FALSE(agents.Contains("foobotx"));
+  EXPECT_FALSE(agents.Contains(""));
+
+  EXPECT_TRUE(agents.Intersects(UserAgentSet({"Other", "BarBot", "Bar-Bot"})));
+  EXPECT_FALSE(agents.Intersects(UserAgentSet({"Other", "BarBot"})));
+  EXPECT_FALSE(agents.Intersects(UserAgentSet()));
+
+  agents.Assign({"BazBot"});
+  EXPECT_EQ(1, agents.size());
+  EXPECT_TRUE(agents.Contains("bazbot"));
+  EXPECT_FALSE(agents.Contains("foobot"));
+
+  const std::string robotstxt =
+      "user-agent: FooBot\n"
+      "disallow: /foo\n"
+      "user-agent: BazBot\n"
+      "disallow: /baz\n";
+  RobotsMatcher matcher;
+  EXPECT_FALSE(matcher.AllowedByRobots(robotstxt, agents, "http://a/baz"));
+  EXPECT_TRUE(matcher.AllowedByRobots(robotstxt, agents, "http://a/foo"));
+  const RobotsRuleSet rules(robotstxt);
+  EXPECT_FALSE(rules.Match(agents, "http://a/baz").allowed);
+  EXPECT_TRUE(rules.Match(agents, "http://a/foo").allowed);
+}
+
+TEST(RobotsUnittest, RuleSetBytes) {
+  const std::string robotstxt =
+      "user-agent: FooBot\n"
+      "user-agent: BarBot\n"
+      "allow: /a/index.html\n"
+      "disallow: /a\n"
+      "disallow: /*.gif$\n"
+      "user-agent: *\n"
+      "disallow: /\n";
+  const RobotsRuleSet compiled(robotstxt);
+  const std::string bytes = compiled.ToBytes();
+  EXPECT_EQ(0, bytes.size() % 8);
+
+  RobotsRuleSet loaded;
+  ASSERT_TRUE(RobotsRuleSet::FromBytes(bytes, &loaded));
+  EXPECT_EQ(bytes, loaded.ToBytes());
+  const std::vector<std::string> agents = {"foobot", "BazBot"};
+  for (const char* url : {"http://h/", "http://h/a", "http://h/a/", "http://h/b",
+                          "http://h/x.gif", "http://h/x.gifs"}) {
+    for (const char* agent : {"FooBot", "barbot", "BazBot"}) {
+      EXPECT_EQ(compiled.OneAgentAllowed(agent, url),
+                loaded.OneAgentAllowed(agent, url))
+          << agent << " " << url;
+      EXPECT_EQ(compiled.Match(&agents, url).matching_line,
+                loaded.Match(&agents, url).matching_line)
+          << url;
+    }
+  }
+
+  RobotsRuleSet empty;
+  ASSERT_TRUE(RobotsRuleSet::FromBytes(RobotsRuleSet().ToBytes(), &empty));
+  EXPECT_TRUE(empty.OneAgentAllowed("FooBot", "http://h/"));
+
+  // Invalid encodings are rejected and leave the rule set untouched.
+  std::string corrupted = bytes;
+  corrupted[corrupted.size() / 2] ^= 1;
+  EXPECT_FALSE(RobotsRuleSet::FromBytes(corrupted, &loaded));
+  EXPECT_FALSE(RobotsRuleSet::FromBytes(
+      std::string_view(bytes).substr(0, bytes.size() - 8), &loaded));
+  EXPECT_FALSE(RobotsRuleSet::FromBytes(std::string_view(), &loaded));
+  std::string other_version = bytes;
+  other_version[4] ^= 1;
+  EXPECT_FALSE(RobotsRuleSet::FromBytes(other_version, &loaded));
+  std::string misaligned = "x" + bytes;
+  EXPECT_FALSE(RobotsRuleSet::FromBytes(
+      std::string_view(misaligned).substr(1), &loaded));
+  EXPECT_FALSE(loaded.OneAgentAllowed("FooBot", "http://h/a"));
+}
+
+// The stream parser emits the same directives as ParseRobotsTxt(), however the
+// body is split into chunks.
+TEST(RobotsUnittest, ID_StreamParserMatchesWholeBody) {
+  const std::string robotstxt =
+      "\xEF\xBB\xBF"
+      "User-Agent: foo\r\n"
+      "Allow: /some/path\r\n"
+      "\r\n"
+      "Crawl-delay: 5\r"
+      "Sitemap: http://foo.bar/sitemap.xml\n"
+      "Disallow: /" +
+      std::string(20000, 'a') +
+      "\n"
+      "Foo: bar\n"
+      "User-Agent: bar";
+  RobotsStatsReporter whole;
+  googlebot::ParseRobotsTxt(robotstxt, &whole);
+  EXPECT_EQ(6, whole.valid_directives());
+  EXPECT_EQ(8, whole.last_line_seen());
+
+  for (size_t chunk_size : {1, 2, 3, 7, 100, 20000}) {
+    RobotsStatsReporter streamed;
+    googlebot::RobotsStreamParser parser(&streamed);
+    for (size_t pos = 0; pos < robotstxt.size(); pos += chunk_size) {
+      parser.Feed(std::string_view(robotstxt).substr(pos, chunk_size));
+    }
+    parser.Finish();
+    EXPECT_EQ(whole.valid_directives(), streamed.valid_directives())
+        << chunk_size;
+    EXPECT_EQ(whole.unknown_directives(), streamed.unknown_directives())
+        << chunk_size;
+    EXPECT_EQ(whole.last_line_seen(), streamed.last_line_seen())
+        << chunk_size;
+    EXPECT_EQ(whole.sitemap(), streamed.sitemap()) << chunk_size;
+  }
+}
+
+// The template ParseRobotsTxt() takes any handler with the methods of
+// RobotsParseHandler, and calls them like the virtual ParseRobotsTxt() does.
+TEST(RobotsUnittest, StaticHandlerMatchesVirtualOne) {
+  struct LineRecorder {
+    void HandleRobotsStart() { lines.clear(); }
+    void HandleRobotsEnd() { ended = true; }
+    void HandleUserAgent(int line_num, std::string_view) { Record(line_num); }
+    void HandleAllow(int line_num, std::string_view) { Record(line_num); }
+    void HandleDisallow(int line_num, std::string_view) { Record(line_num); }
+    void HandleCrawlDelay(int line_num, std::string_view) { Record(line_num); }
+    void HandleSitemap(int line_num, std::string_view) { Record(line_num); }
+    void HandleUnknownAction(int line_num, std::string_view,
+                             std::string_view) {
+      Record(line_num);
+    }
+    bool IsDone(size_t) { return false; }
+
+    void Record(int line_num) { lines.push_back(line_num); }
+    std::vector<int> lines;
+    bool ended = false;
+  };
+  const std::string robotstxt =
+      "\xEF\xBB\xBF"
+      "User-Agent: foo\r\n"
+      "Allow: /some/path\r\n"
+      "\r\n"
+      "Crawl-delay: 5\r"
+      "Sitemap: http://foo.bar/sitemap.xml\n"
+      "Foo: bar\n"
+      "Disallow: /";
+  LineRecorder recorder;
+  googlebot::ParseRobotsTxt(robotstxt, recorder);
+  EXPECT_TRUE(recorder.ended);
+  EXPECT_EQ(std::vector<int>({1, 2, 4, 5, 6, 7}), recorder.lines);
+
+  RobotsStatsReporter report;
+  googlebot::ParseRobotsTxt(robotstxt, &report);
+  EXPECT_EQ(5, report.valid_directives());
+  EXPECT_EQ(1, report.unknown_directives());
+  EXPECT_EQ(recorder.lines.back(), report.last_line_seen());
+}
+
+TEST(RobotsUnittest, StreamParserStop) {
+  // Stops at the first disallow line.
+  class StoppingReporter : public RobotsStatsReporter {
+   public:
+    googlebot::RobotsStreamParser* parser = nullptr;
+    bool ended = false;
+
+    void HandleDisallow(int line_num, std::string_view value) override {
+      RobotsStatsReporter::HandleDisallow(line_num, value);
+      parser->Stop();
+    }
+    void HandleRobotsEnd() override { ended = true; }
+  };
+
+  StoppingReporter report;
+  googlebot::RobotsStreamParser parser(&report);
+  report.parser = &parser;
+  parser.Feed("User-Agent: foo\nDisallow: /a\nDisallow: /b\n");
+  EXPECT_TRUE(parser.stopped());
+  parser.Feed("Disallow: /c\n");
+  EXPECT_FALSE(report.ended);
+  parser.Finish("Disallow: /d");
+  EXPECT_TRUE(report.ended);
+  EXPECT_EQ(2, report.valid_directives());
+  EXPECT_EQ(2, report.last_line_seen());
+}
+
+TEST(RobotsUnittest, ID_HandlerStopsParse) {
+  // Stops once two directives were seen.
+  class StoppingReporter : public RobotsStatsReporter {
+   public:
+    bool IsDone(size_t max_bytes_left) override {
+      bytes_left.push_back(max_bytes_left);
+      return valid_directives() == 2;
+    }
+    std::vector<size_t> bytes_left;
+  };
+
+  StoppingReporter report;
+  googlebot::ParseRobotsTxt("User-Agent: foo\n\nAllow: /\nDisallow: /a\n",
+                            &report);
+  EXPECT_EQ(2, report.valid_directives());
+  EXPECT_EQ(3, report.last_line_seen());
+  EXPECT_EQ(std::vector<size_t>({23, 22, 13}), report.bytes_left);
+}
+
+TEST(RobotsUnittest, EarlyExitKeepsVerdict) {
+  const std::string robotstxt =
+      "user-agent: *\n"
+      "disallow: /\n"
+      "user-agent: FooBot\n"
+      "disallow: /folder/page\n"
+      "allow: /folder/\n"
+      "allow: /*\n"
+      "user-agent: FooBot\n"
+      "allow: /folder/p*****\n";
+  for (const char* url : {"http://foo.bar/", "http://foo.bar/folder/page",
+                          "http://foo.bar/folder/pa", "http://foo.bar/folder/"}) {
+    RobotsMatcher matcher;
+    const bool allowed = matcher.OneAgentAllowedByRobots(robotstxt, "FooBot", url);
+    const int matching_line = matcher.matching_line();
+    matcher.set_early_exit(true);
+    EXPECT_EQ(allowed, matcher.OneAgentAllowedByRobots(robotstxt, "FooBot", url))
+        << url;
+    EXPECT_EQ(matching_line, matcher.matching_line()) << url;
+  }
+}
+
+TEST(RobotsUnittest, PerAgentMatchesLikeSingleCalls) {
+  const std::string robotstxt =
+      "user-agent: *\n"
+      "disallow: /\n"
+      "user-agent: Googlebot\n"
+      "user-agent: FooBot\n"
+      "allow: /\n"
+      "disallow: /private\n"
+      "user-agent: Googlebot-Image\n"
+      "disallow: /images\n"
+      "user-agent: FooBot\n"
+      "allow: /private/ok\n";
+  const std::vector<std::string> agents = {"Googlebot", "Googlebot-Image",
+                                           "FooBot",    "BarBot",
+                                           "googlebot"};
+  const RobotsRuleSet rules(robotstxt);
+  for (const char* url :
+       {"http://foo.bar/", "http://foo.bar/private/ok", "http://foo.bar/images",
+        "http://foo.bar/private", "http://foo.bar/index.html"}) {
+    RobotsMatcher matcher;
+    const std::vector<googlebot::RobotsMatchResult> results =
+        matcher.AllowedByRobotsPerAgent(robotstxt, agents, url);
+    const std::vector<googlebot::RobotsMatchResult> rule_set_results =
+        rules.MatchPerAgent(agents, url);
+    ASSERT_EQ(agents.size(), results.size());
+    ASSERT_EQ(agents.size(), rule_set_results.size());
+    for (size_t i = 0; i < agents.size(); ++i) {
+      RobotsMatcher single;
+      EXPECT_EQ(single.OneAgentAllowedByRobots(robotstxt, agents[i], url),
+                results[i].allowed)
+          << agents[i] << " " << url;
+      EXPECT_EQ(single.matching_line(), results[i].matching_line);
+      EXPECT_EQ(single.ever_seen_specific_agent(),
+                results[i].ever_seen_specific_agent);
+      EXPECT_EQ(results[i].allowed, rule_set_results[i].allowed);
+      EXPECT_EQ(results[i].matching_line, rule_set_results[i].matching_line);
+      EXPECT_EQ(results[i].ever_seen_specific_agent,
+                rule_set_results[i].ever_seen_specific_agent);
+    }
+  }
+}
+
+TEST(RobotsUnittest, ReusedMatcherDoesNotAllocate) {
+  const std::string robotstxt =
+      "\xEF\xBB\xBFuser-agent: FooBot-with-a-long-name\r\n"
+      "allow: /caf\xc3\xa9/a/very/long/path/to/be/escaped\r\n"
+      "allow: /a/b/c/index.html\r\n"
+      "disallow: /*/c/" + std::string(100, 'x') + "\r\n"
+      "disallow: /a/\n";
+  const std::vector<std::string> agents = {"FooBot-with-a-long-name", "BarBot"};
+  const std::string urls[] = {
+      "http://foo.bar/a/b/c/", "http://foo.bar/a/" + std::string(200, 'y'),
+      "http://foo.bar/caf%C3%A9/a/very/long/path/to/be/escaped?q=1"};
+  RobotsMatcher matcher;
+  for (const std::string& url : urls) {
+    matcher.AllowedByRobots(robotstxt, &agents, url);
+    matcher.OneAgentAllowedByRobots(robotstxt, agents[0], url);
+  }
+
+  count_allocations = true;
+  num_allocations = 0;
+  bool allowed[3];
+  for (int i = 0; i < 3; ++i) {
+    allowed[i] = matcher.AllowedByRobots(robotstxt, &agents, urls[i]) &&
+                 matcher.OneAgentAllowedByRobots(robotstxt, agents[0], urls[i]);
+  }
+  count_allocations = false;
+  EXPECT_EQ(0, num_allocations);
+  EXPECT_TRUE(allowed[0]);
+  EXPECT_FALSE(allowed[1]);
+  EXPECT_TRUE(allowed[2]);
+}
+
+TEST(RobotsUnittest, RuleSetDropsDeadRules) {
+  const std::string robotstxt =
+      "user-agent: FooBot\n"
+      "user-agent: BarBot\n"
+      "disallow: /x**\n"
+      "disallow: /x*\n"  // Same paths as /x** but shorter.
+      "disallow: /x\n"   // Same.
+      "allow: /x/y\n"
+      "disallow: /x/y\n"  // Same priority as /x** but later.
+      "allow: /z*$\n"
+      "allow: /z\n"  // Same paths as /z*$ but shorter.
+      "user-agent: *\n"
+      "disallow: /x*\n"
+      "disallow: /y$\n";
+  const std::string without_dead_rules =
+      "user-agent: FooBot\n"
+      "user-agent: BarBot\n"
+      "disallow: /x**\n"
+      "# dead\n"
+      "# dead\n"
+      "allow: /x/y\n"
+      "# dead\n"
+      "allow: /z*$\n"
+      "# dead\n"
+      "user-agent: *\n"
+      "disallow: /x*\n"
+      "disallow: /y$\n";
+  const RobotsRuleSet rules(robotstxt);
+  EXPECT_EQ(RobotsRuleSet(without_dead_rules).ToBytes(), rules.ToBytes());
+
+  for (const char* agent : {"FooBot", "BarBot", "BazBot"}) {
+    for (const char* url : {"http://foo.bar/x", "http://foo.bar/x/y",
+                            "http://foo.bar/x/yz", "http://foo.bar/z",
+                            "http://foo.bar/zz", "http://foo.bar/y"}) {
+      RobotsMatcher matcher;
+      const bool allowed = matcher.OneAgentAllowedByRobots(robotstxt, agent, url);
+      const googlebot::RobotsMatchResult result =
+          rules.Match(UserAgentSet({agent}), url);
+      EXPECT_EQ(allowed, result.allowed) << agent << " " << url;
+      EXPECT_EQ(matcher.matching_line(), result.matching_line)
+          << agent << " " << url;
+    }
+  }
+}
+
+TEST(RobotsUnittest, RuleSetCrawlDelayAndSitemaps) {
+  const std::string robotstxt =
+      "crawl-delay: 99\n"  // Before any user-agent, ignored.
+      "sitemap: http://foo.bar/sitemap1.xml\n"
+      "user-agent: FooBot\n"
+      "crawl-delay: 2.5\n"
+      "crawl-delay: 7\n"  // Not the first one of the group.
+      "disallow: /x\n"
+      "user-agent: *\n"
+      "crawldelay: 1\n"
+      "user-agent: BarBot\n"
+      "crawl-delay: soon\n"
+      "crawl-delay: -3\n"
+      "site-map: http://foo.bar/sitemap2.xml\n"
+      "user-agent: BarBot\n"
+      "crawl-delay: 4.\n"
+      "sitemap:\n";
+  RobotsRuleSet decoded;
+  const std::string bytes = RobotsRuleSet(robotstxt).ToBytes();
+  ASSERT_TRUE(RobotsRuleSet::FromBytes(bytes, &decoded));
+  for (const RobotsRuleSet& rules : {RobotsRuleSet(robotstxt), decoded}) {
+    double seconds = 0;
+    EXPECT_TRUE(rules.CrawlDelay(UserAgentSet({"FooBot"}), &seconds));
+    EXPECT_EQ(2.5, seconds);
+    EXPECT_TRUE(rules.CrawlDelay(UserAgentSet({"BazBot"}), &seconds));
+    EXPECT_EQ(1, seconds);
+    // The invalid delays of the first BarBot group are ignored.
+    EXPECT_TRUE(rules.CrawlDelay(UserAgentSet({"BarBot"}), &seconds));
+    EXPECT_EQ(4, seconds);
+    // The largest delay of all the groups of the agents.
+    EXPECT_TRUE(rules.CrawlDelay(UserAgentSet({"FooBot", "BarBot"}), &seconds));
+    EXPECT_EQ(4, seconds);
+    const std::vector<std::string_view> expected_sitemaps = {
+        "http://foo.bar/sitemap1.xml", "http://foo.bar/sitemap2.xml"};
+    EXPECT_EQ(expected_sitemaps, rules.Sitemaps());
+  }
+
+  double seconds = 0;
+  EXPECT_FALSE(RobotsRuleSet("user-agent: *\ndisallow: /\n")
+                   .CrawlDelay(UserAgentSet({"FooBot"}), &seconds));
+  // A group of the agent, even without crawl-delay, hides the global one.
+  EXPECT_FALSE(RobotsRuleSet("user-agent: *\ncrawl-delay: 5\n"
+                             "user-agent: FooBot\ndisallow: /\n")
+                   .CrawlDelay(UserAgentSet({"FooBot"}), &seconds));
+}
+
+TEST(RobotsUnittest, Stats) {
+  const std::string robotstxt =
+      "user-agent: FooBot\n"
+      "disallow: /a*b\n"
+      "allow: /a/\xc3\xa9\n"
+      "\n";  // And the empty line after it: 5 lines.
+  ::googlebot::RobotsStats stats;
+  {
+    ::googlebot::RobotsStatsScope scope(&stats);
+    RobotsMatcher matcher;
+    EXPECT_FALSE(matcher.OneAgentAllowedByRobots(robotstxt, "FooBot",
+                                                 "http://foo.bar/axxb"));
+  }
+  if (!::googlebot::RobotsStats::kEnabled) {
+    EXPECT_EQ(0, stats.lines_parsed);
+    EXPECT_EQ(0, stats.rules_evaluated);
+    return;
+  }
+  EXPECT_EQ(5, stats.lines_parsed);
+  EXPECT_EQ(0, stats.truncated_bytes);
+  EXPECT_EQ(1, stats.escaped_values);
+  EXPECT_EQ(2, stats.rules_evaluated);
+  EXPECT_EQ(1, stats.pattern_matches);
+  EXPECT_GT(stats.pattern_bytes_scanned, 0);
+  EXPECT_GT(stats.match_nanos, 0);
+
+  // Patterns only anchored at their end count too.
+  ::googlebot::RobotsStats anchored;
+  {
+    ::googlebot::RobotsStatsScope scope(&anchored);
+    RobotsMatcher matcher;
+    EXPECT_FALSE(matcher.OneAgentAllowedByRobots(
+        "user-agent: FooBot\ndisallow: /x$\n", "FooBot", "http://foo.bar/x"));
+  }
+  EXPECT_EQ(1, anchored.pattern_matches);
+  EXPECT_EQ(2, anchored.pattern_bytes_scanned);
+
+  // Scopes nest, and outer scopes do not see the work of inner ones.
+  ::googlebot::RobotsStats outer, inner;
+  {
+    ::googlebot::RobotsStatsScope outer_scope(&outer);
+    {
+      ::googlebot::RobotsStatsScope inner_scope(&inner);
+      RobotsRuleSet rules(robotstxt + "disallow: /" + std::string(20000, 'x'));
+    }
+    RobotsRuleSet(robotstxt).Match(UserAgentSet({"FooBot"}),
+                                   "http://foo.bar/axxb");
+  }
+  EXPECT_EQ(5, inner.lines_parsed);
+  EXPECT_GT(inner.truncated_bytes, 0);
+  EXPECT_GT(inner.parse_nanos, 0);
+  EXPECT_EQ(0, inner.match_nanos);
+  EXPECT_EQ(5, outer.lines_parsed);
+  EXPECT_EQ(0, outer.truncated_bytes);
+  EXPECT_GT(outer.rules_evaluated, 0);
+
+  stats.Add(outer);
+  EXPECT_EQ(10, stats.lines_parsed);
+  ::googlebot::RobotsStats exceeded;
+  exceeded.limits_exceeded = 2;
+  stats.Add(exceeded);
+  stats.Add(exceeded);
+  EXPECT_EQ(4, stats.limits_exceeded);
+  EXPECT_EQ(10, stats.lines_parsed);
+  stats.Clear();
+  EXPECT_EQ(0, stats.lines_parsed);
+}
+
+TEST(RobotsUnittest, Limits) {
+  std::string hostile = "user-agent: FooBot\nallow: /\n";
+  for (int i = 0; i < 1000; ++i) {
+    hostile += "disallow: /*a*a*a*a*b" + std::to_string(i) + "\n";
+  }
+  const std::string url = "http://foo.bar/" + std::string(2000, 'a');
+  const std::string benign = "user-agent: FooBot\ndisallow: /a*b\n";
+
+  ::googlebot::RobotsLimits limits;
+  limits.max_match_steps = 100000;
+  RobotsMatcher matcher;
+  matcher.set_limits(limits);
+  EXPECT_FALSE(matcher.OneAgentAllowedByRobots(hostile, "FooBot", url));
+  EXPECT_TRUE(matcher.limit_exceeded());
+  EXPECT_EQ(0, matcher.matching_line());
+  EXPECT_EQ(1, matcher.num_limits_exceeded());
+  // Without limits, the URL is allowed after a long match.
+  RobotsMatcher unlimited;
+  EXPECT_TRUE(unlimited.OneAgentAllowedByRobots(hostile, "FooBot", url));
+  EXPECT_FALSE(unlimited.limit_exceeded());
+  EXPECT_EQ(2, unlimited.matching_line());
+  // Short URLs fit in the budget.
+  EXPECT_TRUE(matcher.OneAgentAllowedByRobots(hostile, "FooBot",
+                                              "http://foo.bar/ab"));
+  EXPECT_FALSE(matcher.limit_exceeded());
+  EXPECT_FALSE(matcher.OneAgentAllowedByRobots(benign, "FooBot", url + "b"));
+  EXPECT_FALSE(matcher.limit_exceeded());
+
+  const std::vector<std::string> agents = {"FooBot", "BarBot"};
+  const std::vector<std::string> urls = {url, "http://foo.bar/ab"};
+  std::vector<::googlebot::RobotsMatchResult> results =
+      matcher.AllowedByRobotsBatch(hostile, &agents, urls);
+  ASSERT_EQ(2, results.size());
+  EXPECT_TRUE(results[0].limit_exceeded);
+  EXPECT_FALSE(results[0].allowed);
+  EXPECT_FALSE(results[1].limit_exceeded);
+  EXPECT_TRUE(results[1].allowed);
+  results = matcher.AllowedByRobotsPerAgent(hostile, agents, url);
+  ASSERT_EQ(2, results.size());
+  EXPECT_TRUE(results[0].limit_exceeded);
+  EXPECT_TRUE(results[1].limit_exceeded);
+  EXPECT_EQ(4, matcher.num_limits_exceeded());
+
+  const RobotsRuleSet rules(hostile, limits);
+  EXPECT_FALSE(rules.limit_exceeded());
+  RobotsRuleSet decoded;
+  const std::string bytes = rules.ToBytes();
+  ASSERT_TRUE(RobotsRuleSet::FromBytes(bytes, &decoded));
+  for (const RobotsRuleSet& rule_set : {rules, decoded}) {
+    ::googlebot::RobotsMatchResult result =
+        rule_set.Match(UserAgentSet({"FooBot"}), url);
+    EXPECT_TRUE(result.limit_exceeded);
+    EXPECT_FALSE(result.allowed);
+    result = rule_set.Match(UserAgentSet({"FooBot"}), "http://foo.bar/ab");
+    EXPECT_FALSE(result.limit_exceeded);
+    EXPECT_TRUE(result.allowed);
+  }
+
+  // The limits on the robots.txt itself, whatever the agent or URL.
+  ::googlebot::RobotsLimits body_limits;
+  body_limits.fallback_allowed = true;
+  body_limits.max_body_bytes = benign.size();
+  EXPECT_FALSE(RobotsRuleSet(benign, body_limits).limit_exceeded());
+  body_limits.max_body_bytes = benign.size() - 1;
+  EXPECT_TRUE(RobotsRuleSet(benign, body_limits).limit_exceeded());
+  body_limits.max_body_bytes = 0;
+  body_limits.max_rules = 1;
+  EXPECT_FALSE(RobotsRuleSet(benign, body_limits).limit_exceeded());
+  EXPECT_TRUE(RobotsRuleSet(benign + "allow: /\n", body_limits)
+                  .limit_exceeded());
+  body_limits.max_rules = 0;
+  body_limits.max_wildcards = 1;
+  EXPECT_FALSE(RobotsRuleSet(benign, body_limits).limit_exceeded());
+  EXPECT_TRUE(RobotsRuleSet(benign + "user-agent: BarBot\nallow: /**\n",
+                            body_limits)
+                  .limit_exceeded());
+  for (const bool fallback_allowed : {false, true}) {
+    body_limits.fallback_allowed = fallback_allowed;
+    matcher.set_limits(body_limits);
+    EXPECT_EQ(fallback_allowed,
+              matcher.OneAgentAllowedByRobots(hostile, "FooBot", "/ab"));
+    EXPECT_TRUE(matcher.limit_exceeded());
+    decoded = RobotsRuleSet(hostile, body_limits);
+    EXPECT_TRUE(decoded.limit_exceeded());
+    const ::googlebot::RobotsMatchResult result =
+        decoded.Match(UserAgentSet({"FooBot"}), "/ab");
+    EXPECT_TRUE(result.limit_exceeded);
+    EXPECT_EQ(fallback_allowed, result.allowed);
+  }
+}
+
+TEST(RobotsUnittest, FirstMatchStrategy) {
+  const std::string robotstxt =
+      "user-agent: *\n"
+      "allow: /\n"
+      "user-agent: FooBot\n"
+      "disallow: /a\n"
+      "allow: /a/b\n"
+      "allow: /c\n"
+      "disallow: /c/d\n"
+      "disallow:\n";
+  for (const bool early_exit : {false, true}) {
+    RobotsMatcher longest;
+    ::googlebot::FirstMatchRobotsMatcher first;
+    longest.set_early_exit(early_exit);
+    first.set_early_exit(early_exit);
+    EXPECT_TRUE(
+        longest.OneAgentAllowedByRobots(robotstxt, "FooBot", "/a/b/c"));
+    EXPECT_EQ(5, longest.matching_line());
+    EXPECT_FALSE(first.OneAgentAllowedByRobots(robotstxt, "FooBot", "/a/b/c"));
+    EXPECT_EQ(4, first.matching_line());
+
+    EXPECT_FALSE(longest.OneAgentAllowedByRobots(robotstxt, "FooBot", "/c/d"));
+    EXPECT_EQ(7, longest.matching_line());
+    EXPECT_TRUE(first.OneAgentAllowedByRobots(robotstxt, "FooBot", "/c/d"));
+    EXPECT_EQ(6, first.matching_line());
+
+    // An empty disallow still allows everything.
+    EXPECT_TRUE(first.OneAgentAllowedByRobots(robotstxt, "FooBot", "/e"));
+    EXPECT_TRUE(first.OneAgentAllowedByRobots(robotstxt, "BarBot", "/a"));
+    EXPECT_EQ(2, first.matching_line());
+  }
 }